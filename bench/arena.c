@@ -0,0 +1,102 @@
+/*
+ * Benchmark harness: preallocated, prefaulted sample arena.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/* Each array starts on its own cache line. */
+#define ARENA_ALIGN   64
+
+/* Size of explicit huge pages (the common default on x86 and ARM). */
+#define HUGE_PAGE_SIZE   ((size_t)2 << 20)
+
+void
+bench_prefault(void *buf, size_t len)
+{
+	volatile unsigned char *p = buf;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < len; i += page) {
+		p[i] = p[i];
+	}
+	if (len > 0) {
+		p[len - 1] = p[len - 1];
+	}
+}
+
+static size_t
+align_up(size_t x, size_t a)
+{
+	return (x + a - 1) & ~(a - 1);
+}
+
+int
+bench_arena_init(bench_arena *a, size_t cap, unsigned num_aux,
+	unsigned flags)
+{
+	memset(a, 0, sizeof *a);
+	if (cap == 0 || num_aux > BENCH_ARENA_MAX_AUX
+		|| cap > ((size_t)-1 >> 8) / (20 + 8 * (size_t)num_aux))
+	{
+		return -1;
+	}
+	size_t len = 2 * align_up(cap * 8, ARENA_ALIGN)
+		+ align_up(cap * 4, ARENA_ALIGN)
+		+ num_aux * align_up(cap * 8, ARENA_ALIGN);
+
+	void *mem = MAP_FAILED;
+	size_t mem_len = 0;
+#ifdef MAP_HUGETLB
+	if (flags & BENCH_ARENA_HUGE) {
+		mem_len = align_up(len, HUGE_PAGE_SIZE);
+		mem = mmap(NULL, mem_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		a->huge = mem != MAP_FAILED;
+	}
+#endif
+	if (mem == MAP_FAILED) {
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		mem_len = align_up(len, page);
+		mem = mmap(NULL, mem_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			return -1;
+		}
+#ifdef MADV_HUGEPAGE
+		if (flags & BENCH_ARENA_HUGE) {
+			madvise(mem, mem_len, MADV_HUGEPAGE);
+		}
+#endif
+	}
+	a->mem = mem;
+	a->mem_len = mem_len;
+	a->cap = cap;
+	a->num_aux = num_aux;
+
+	unsigned char *p = mem;
+	a->begin = (uint64_t *)p;
+	p += align_up(cap * 8, ARENA_ALIGN);
+	a->end = (uint64_t *)p;
+	p += align_up(cap * 8, ARENA_ALIGN);
+	a->cpu = (uint32_t *)p;
+	p += align_up(cap * 4, ARENA_ALIGN);
+	for (unsigned k = 0; k < num_aux; k ++) {
+		a->aux[k] = (uint64_t *)p;
+		p += align_up(cap * 8, ARENA_ALIGN);
+	}
+	bench_prefault(mem, mem_len);
+	return 0;
+}
+
+void
+bench_arena_free(bench_arena *a)
+{
+	if (a->mem != NULL) {
+		munmap(a->mem, a->mem_len);
+	}
+	memset(a, 0, sizeof *a);
+}
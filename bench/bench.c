@@ -0,0 +1,241 @@
+/*
+ * Benchmark harness: sample collection and statistics.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+void
+bench_opts_init(bench_opts *opt)
+{
+	opt->warmup = 20;
+	opt->samples = 100;
+	opt->iters = 1000;
+	opt->seed = 3;
+	opt->adaptive = 0;
+	opt->rel_ci = 0.01;
+	opt->max_samples = 10000;
+	opt->huge_pages = 0;
+}
+
+static int
+cmp_double(const void *v1, const void *v2)
+{
+	double x1 = *(const double *)v1;
+	double x2 = *(const double *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+/* Value of rank floor(q*n) in a sorted array (q = 0.5 is the median). */
+static double
+quantile(const double *s, size_t n, double q)
+{
+	size_t k = (size_t)(q * (double)n);
+	return s[k < n ? k : n - 1];
+}
+
+void
+bench_stats_compute(const double *v, size_t n, bench_stats *st)
+{
+	memset(st, 0, sizeof *st);
+	st->n = n;
+	if (n == 0) {
+		return;
+	}
+	double *s = malloc(n * sizeof *s);
+	if (s == NULL) {
+		st->n = 0;
+		return;
+	}
+	memcpy(s, v, n * sizeof *s);
+	qsort(s, n, sizeof *s, &cmp_double);
+	st->min = s[0];
+	st->p10 = quantile(s, n, 0.10);
+	st->p25 = quantile(s, n, 0.25);
+	st->median = quantile(s, n, 0.50);
+	st->p75 = quantile(s, n, 0.75);
+	st->p90 = quantile(s, n, 0.90);
+	st->p99 = quantile(s, n, 0.99);
+	st->max = s[n - 1];
+	double sum = 0.0;
+	for (size_t i = 0; i < n; i ++) {
+		sum += s[i];
+	}
+	st->mean = sum / (double)n;
+	double sq = 0.0;
+	for (size_t i = 0; i < n; i ++) {
+		double d = s[i] - st->mean;
+		sq += d * d;
+	}
+	st->stddev = n > 1 ? sqrt(sq / (double)(n - 1)) : 0.0;
+
+	/* Distribution-free interval for the median: the number of
+	   samples below the median is binomial (n, 1/2). */
+	double h = 1.96 * sqrt((double)n) / 2.0;
+	double lo = floor((double)n / 2.0 - h);
+	double hi = ceil((double)n / 2.0 + h);
+	st->ci_lo = s[lo < 0.0 ? 0 : (size_t)lo];
+	st->ci_hi = s[hi >= (double)n ? n - 1 : (size_t)hi];
+	free(s);
+}
+
+/*
+ * Take 'num' samples into the arena, then append them (scaled to
+ * per-operation values) to res->samples. Nothing but the arena is
+ * written while sampling.
+ */
+static void
+take_samples(const bench_desc *b, void *ctx, uint64_t iters, double scale,
+	bench_arena *ar, bench_result *res, size_t num)
+{
+	size_t first = ar->num;
+	for (size_t i = 0; i < num; i ++) {
+		uint64_t begin = core_cycles();
+		b->kernel(ctx, iters);
+		uint64_t end = core_cycles();
+		bench_arena_record(ar, begin, end, cyc_current_cpu());
+	}
+	for (size_t i = first; i < ar->num; i ++) {
+		res->samples[res->num_samples ++] =
+			(double)(ar->end[i] - ar->begin[i]) * scale;
+		if (i > 0 && ar->cpu[i] != ar->cpu[i - 1]) {
+			res->migrations ++;
+		}
+	}
+}
+
+int
+bench_run(const bench_desc *b, const bench_opts *opt, bench_result *res)
+{
+	memset(res, 0, sizeof *res);
+	res->desc = b;
+	res->opt = *opt;
+	res->cpu = -1;
+	size_t cap = opt->samples;
+	if (opt->adaptive && opt->max_samples > cap) {
+		cap = opt->max_samples;
+	}
+	if (cap == 0 || opt->iters == 0) {
+		return -1;
+	}
+	bench_arena ar;
+	if (bench_arena_init(&ar, cap, 0,
+		opt->huge_pages ? BENCH_ARENA_HUGE : 0) < 0)
+	{
+		return -1;
+	}
+	void *ctx = calloc(1, b->ctx_len > 0 ? b->ctx_len : 1);
+	res->samples = malloc(cap * sizeof *res->samples);
+	if (ctx == NULL || res->samples == NULL) {
+		free(ctx);
+		bench_arena_free(&ar);
+		bench_result_free(res);
+		return -1;
+	}
+	if (b->setup != NULL && b->setup(ctx, opt->seed) != 0) {
+		free(ctx);
+		bench_arena_free(&ar);
+		bench_result_free(res);
+		return -1;
+	}
+	double ops = b->ops_per_iter > 0.0 ? b->ops_per_iter : 1.0;
+	double scale = 1.0 / ((double)opt->iters * ops);
+
+	for (size_t i = 0; i < opt->warmup; i ++) {
+		b->kernel(ctx, opt->iters);
+	}
+	take_samples(b, ctx, opt->iters, scale, &ar, res, opt->samples);
+	bench_stats_compute(res->samples, res->num_samples, &res->stats);
+	while (opt->adaptive && res->num_samples < cap
+		&& res->stats.ci_hi - res->stats.ci_lo
+		> opt->rel_ci * res->stats.median)
+	{
+		size_t num = opt->samples;
+		if (num > cap - res->num_samples) {
+			num = cap - res->num_samples;
+		}
+		take_samples(b, ctx, opt->iters, scale, &ar, res, num);
+		bench_stats_compute(res->samples, res->num_samples,
+			&res->stats);
+	}
+	res->check = b->check != NULL ? b->check(ctx) : 0;
+	uint32_t cpu = ar.cpu[ar.num - 1];
+	res->cpu = cpu == CYC_CPU_UNKNOWN ? -1 : (int)cpu;
+	free(ctx);
+	bench_arena_free(&ar);
+	return 0;
+}
+
+void
+bench_result_free(bench_result *res)
+{
+	free(res->samples);
+	res->samples = NULL;
+	res->num_samples = 0;
+}
+
+void
+bench_print_result(FILE *out, const bench_result *res)
+{
+	bench_print_result_label(out, res->desc->name, 16, res);
+}
+
+void
+bench_print_result_label(FILE *out, const char *label, int width,
+	const bench_result *res)
+{
+	const bench_stats *st = &res->stats;
+	fprintf(out, "%-*s %9.3f  (min %.3f, p10 %.3f, p90 %.3f,"
+		" p99 %.3f, max %.3f; %zu samples)\n",
+		width, label, st->median, st->min, st->p10, st->p90,
+		st->p99, st->max, st->n);
+}
+
+void
+bench_print_distribution(FILE *out, const bench_result *res)
+{
+	const bench_stats *st = &res->stats;
+	fprintf(out, "  n=%zu  min %.3f  p10 %.3f  p25 %.3f  median %.3f"
+		" [%.3f, %.3f]\n", st->n, st->min, st->p10, st->p25,
+		st->median, st->ci_lo, st->ci_hi);
+	fprintf(out, "  p75 %.3f  p90 %.3f  p99 %.3f  max %.3f"
+		"  mean %.3f  stddev %.3f\n", st->p75, st->p90, st->p99,
+		st->max, st->mean, st->stddev);
+
+	/* Histogram over [min, p99]; values above p99 go into the last
+	   bin, so that a few outliers do not squash the rest. */
+	enum { BINS = 10, WIDTH = 50 };
+	size_t bin[BINS] = { 0 };
+	double lo = st->min;
+	double w = (st->p99 - lo) / BINS;
+	for (size_t i = 0; i < res->num_samples; i ++) {
+		double x = res->samples[i];
+		size_t k = w > 0.0 ? (size_t)((x - lo) / w) : 0;
+		bin[k < BINS ? k : BINS - 1] ++;
+	}
+	size_t most = 1;
+	for (int k = 0; k < BINS; k ++) {
+		if (bin[k] > most) {
+			most = bin[k];
+		}
+	}
+	for (int k = 0; k < BINS; k ++) {
+		fprintf(out, "  %10.3f %c %7zu |", lo + k * w,
+			k == BINS - 1 ? '+' : ' ', bin[k]);
+		size_t len = (bin[k] * WIDTH + most - 1) / most;
+		for (size_t j = 0; j < len; j ++) {
+			fputc('#', out);
+		}
+		fputc('\n', out);
+	}
+}
@@ -0,0 +1,904 @@
+/*
+ * Benchmark harness: repeated measurement of small kernels with
+ * core_cycles(), statistics over the samples, and assertions against
+ * per-CPU-model cycle budgets.
+ *
+ * A benchmark is described by a bench_desc structure. The harness
+ * allocates a context of 'ctx_len' bytes, calls setup() once, then
+ * calls kernel() repeatedly: each call runs 'iters' iterations and is
+ * timed as one sample. The first samples are warmup and discarded.
+ * Samples are reported per operation: a kernel whose iteration performs
+ * 'ops_per_iter' operations (e.g. 20 multiplications) yields samples of
+ * cycles / (iters * ops_per_iter).
+ *
+ * The kernel must keep its state in the context (loaded at entry, stored
+ * at exit), so that the compiler cannot optimize the work away; check()
+ * (optional) returns a value derived from the final state, which callers
+ * print or fold into a checksum for the same reason.
+ */
+
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../core_cycles.h"
+
+typedef struct {
+	const char *name;
+	size_t ctx_len;
+	/* Initialize the context from a seed; returns 0 on success. */
+	int (*setup)(void *ctx, uint64_t seed);
+	void (*kernel)(void *ctx, uint64_t iters);
+	uint64_t (*check)(const void *ctx);
+	double ops_per_iter;
+} bench_desc;
+
+/*
+ * Run parameters. With 'adaptive' set, after the first 'samples'
+ * samples, more are taken (by batches of 'samples') until the 95%
+ * confidence interval of the median is narrower than 'rel_ci' times the
+ * median, or 'max_samples' samples have been taken. 'huge_pages'
+ * requests that the sample arena be backed by huge pages.
+ */
+typedef struct {
+	size_t warmup;
+	size_t samples;
+	uint64_t iters;
+	uint64_t seed;
+	int adaptive;
+	double rel_ci;
+	size_t max_samples;
+	int huge_pages;
+} bench_opts;
+
+/* Defaults: 20 warmup, 100 samples of 1000 iterations, no adaptation. */
+void bench_opts_init(bench_opts *opt);
+
+/*
+ * Statistics over per-operation samples (in cycles). 'ci_lo' and
+ * 'ci_hi' bound the 95% confidence interval of the median.
+ */
+typedef struct {
+	size_t n;
+	double min;
+	double p10;
+	double p25;
+	double median;
+	double p75;
+	double p90;
+	double p99;
+	double max;
+	double mean;
+	double stddev;
+	double ci_lo;
+	double ci_hi;
+} bench_stats;
+
+typedef struct {
+	const bench_desc *desc;
+	bench_opts opt;
+	/* Per-operation samples, in measurement order (malloc'ed). */
+	double *samples;
+	size_t num_samples;
+	bench_stats stats;
+	uint64_t check;
+	/* CPU on which the last sample was taken (-1 if unknown), and
+	   number of samples taken on another CPU than the previous one. */
+	int cpu;
+	size_t migrations;
+} bench_result;
+
+/*
+ * Run a benchmark. Returns 0 on success, -1 on error (allocation or
+ * setup failure). The result must be released with bench_result_free().
+ */
+int bench_run(const bench_desc *b, const bench_opts *opt, bench_result *res);
+void bench_result_free(bench_result *res);
+
+/*
+ * Fork-per-benchmark isolation: the benchmark runs in a freshly forked
+ * child, so that earlier benchmarks cannot leave state (caches,
+ * predictors, allocator) behind for later ones. The child is pinned to
+ * 'cpu' (if not -1), locks its memory if BENCH_CHILD_MLOCK is set
+ * (memory locks are not inherited), runs bench_run(), and sends the
+ * result back through a pipe. bench_child_start() forks the child;
+ * bench_child_finish() reads its result and reaps it, so several
+ * children may be started before they are finished (they block, after
+ * measuring, until their result is read). Both return 0 on success, -1
+ * on error; 'status' receives the child's wait status (e.g. to report
+ * a crash).
+ */
+#define BENCH_CHILD_MLOCK   0x01
+
+typedef struct {
+	const bench_desc *desc;
+	bench_opts opt;
+	int cpu;
+	int pid;
+	int fd;
+	int status;
+} bench_child;
+
+int bench_child_start(bench_child *c, const bench_desc *b,
+	const bench_opts *opt, int cpu, unsigned flags);
+int bench_child_finish(bench_child *c, bench_result *res);
+
+/*
+ * Run a benchmark in a child (start, then finish).
+ */
+int bench_run_forked(const bench_desc *b, const bench_opts *opt, int cpu,
+	unsigned flags, bench_result *res);
+
+/*
+ * Parallel scheduling of independent single-core benchmarks: each job
+ * runs in a forked child (see bench_child_start()) pinned to one of
+ * the given CPUs, with at most one child per CPU at any time; a job is
+ * started as soon as a CPU is free. The parent moves itself off these
+ * CPUs while children run (if other CPUs are allowed). For each job,
+ * 'err' is set if it could not run and 'status' is the child's wait
+ * status. Returns 0 on success, -1 on error (no CPU, or allocation
+ * failure).
+ */
+typedef struct {
+	const bench_desc *desc;
+	int err;
+	int status;
+	bench_result res;
+} bench_job;
+
+int bench_run_parallel(bench_job *jobs, size_t num_jobs,
+	const bench_opts *opt, const int *cpus, int num_cpus, unsigned flags);
+
+/*
+ * Time-budgeted runs: the jobs (with 'desc' set) share a total budget of
+ * 'seconds' of wall-clock time. Each benchmark first takes
+ * BENCH_PILOT_SAMPLES samples, which give its cost per sample t and its
+ * relative spread s (interquartile range over the median). The rest of
+ * the budget is then allocated to maximize the overall precision of the
+ * medians (Neyman allocation: benchmark i gets a number of further
+ * samples proportional to s_i / sqrt(t_i)), so that noisy benchmarks get
+ * more samples than stable ones, and cheap ones more than expensive
+ * ones. The further samples are taken in a second run (with the same
+ * seed and warmup) and merged with the pilot ones; at most
+ * BENCH_TIMED_MAX_SAMPLES samples are taken per benchmark. 'opt' gives
+ * the other parameters ('samples' and 'adaptive' are ignored). The plan
+ * is written to 'log' (if not NULL) once all runs are done. Returns 0
+ * on success, -1 on error (allocation failure); jobs that could not run
+ * have 'err' set.
+ */
+#define BENCH_PILOT_SAMPLES       30
+#define BENCH_TIMED_MAX_SAMPLES   1000000
+
+int bench_run_timed(bench_job *jobs, size_t num_jobs, const bench_opts *opt,
+	double seconds, FILE *log);
+
+/*
+ * Select CPUs for parallel runs among the candidates (cand[i] != 0 for
+ * CPU i): at most one hardware thread per core, so that benchmarks do
+ * not compete for the resources of a core, and, with
+ * BENCH_PICK_CLUSTER, at most one CPU per cluster (CPUs sharing an L2
+ * cache, or listed together in topology/cluster_cpus_list). At most
+ * 'max' CPUs are written into cpus[], lowest first; returns their
+ * number. 'root' prefixes the /sys paths (NULL for none).
+ */
+#define BENCH_PICK_CLUSTER   0x01
+
+int bench_cpu_pick(const char *root, const unsigned char *cand,
+	unsigned flags, int *cpus, int max);
+
+/*
+ * Default candidates for parallel runs: the isolated CPUs (isolcpus=)
+ * that the process may run on, or all the CPUs it may run on if none is
+ * isolated. Returns the number of candidates.
+ */
+int bench_cpu_candidates(const char *root, unsigned char *cand);
+
+/*
+ * Get the CPUs the process may run on (its affinity mask, which only
+ * contains online CPUs): set[i] is 1 for each such CPU i, 0 otherwise.
+ * Returns their number.
+ */
+int bench_cpu_allowed(unsigned char *set);
+
+/*
+ * Compute statistics over 'n' values (the array is not modified).
+ */
+void bench_stats_compute(const double *v, size_t n, bench_stats *st);
+
+/*
+ * Print the statistics of a result as one line: name, median, then the
+ * spread (min, p10, p90, p99, max) and the number of samples.
+ */
+void bench_print_result(FILE *out, const bench_result *res);
+
+/*
+ * Same as bench_print_result(), with the given label (left-aligned in
+ * 'width' columns) instead of the benchmark name.
+ */
+void bench_print_result_label(FILE *out, const char *label, int width,
+	const bench_result *res);
+
+/*
+ * Print the distribution of the samples of a result: quantiles and an
+ * ASCII histogram between the minimum and the 99th percentile.
+ */
+void bench_print_distribution(FILE *out, const bench_result *res);
+
+/*
+ * Sample arena: raw samples, stored as a structure of arrays (start and
+ * end counter values, CPU, and up to BENCH_ARENA_MAX_AUX auxiliary
+ * values per sample) so that recording a sample is a few stores into
+ * hot cache lines. The arena is allocated with its final capacity and
+ * prefaulted before sampling starts, so that the measurement loop never
+ * takes a page fault; with BENCH_ARENA_HUGE, huge pages are used if
+ * available (explicit huge pages, else transparent ones).
+ */
+#define BENCH_ARENA_MAX_AUX   4
+#define BENCH_ARENA_HUGE      0x01
+
+typedef struct {
+	uint64_t *begin;
+	uint64_t *end;
+	uint32_t *cpu;
+	uint64_t *aux[BENCH_ARENA_MAX_AUX];
+	size_t num;
+	size_t cap;
+	unsigned num_aux;
+	/* Set if the arena is backed by explicit huge pages. */
+	int huge;
+	void *mem;
+	size_t mem_len;
+} bench_arena;
+
+/*
+ * Allocate an arena for 'cap' samples with 'num_aux' auxiliary values
+ * each. Returns 0 on success, -1 on error.
+ */
+int bench_arena_init(bench_arena *a, size_t cap, unsigned num_aux,
+	unsigned flags);
+void bench_arena_free(bench_arena *a);
+
+/*
+ * Record a sample; returns its index (auxiliary values are then stored
+ * by the caller in a->aux[k][index]), or (size_t)-1 if the arena is
+ * full.
+ */
+static inline size_t
+bench_arena_record(bench_arena *a, uint64_t begin, uint64_t end,
+	uint32_t cpu)
+{
+	size_t i = a->num;
+	if (i >= a->cap) {
+		return (size_t)-1;
+	}
+	a->begin[i] = begin;
+	a->end[i] = end;
+	a->cpu[i] = cpu;
+	a->num = i + 1;
+	return i;
+}
+
+/*
+ * Touch every page of a buffer, so that it is mapped before it is used
+ * in a measurement.
+ */
+void bench_prefault(void *buf, size_t len);
+
+/*
+ * Structured output of results, for regression databases and plotting
+ * scripts. In JSON, the output is one object with the counter backend,
+ * the CPU model, and an array of results; in CSV, it is a header line
+ * then one line per result. Each result has the benchmark name, the run
+ * parameters, the number of samples, all statistics, the CPU number and
+ * core type (see bench_core_type()), and, if 'raw' is set, the samples
+ * in measurement order. BENCH_FMT_TEXT prints bench_print_result() lines.
+ */
+#define BENCH_FMT_TEXT   0
+#define BENCH_FMT_JSON   1
+#define BENCH_FMT_CSV    2
+
+typedef struct {
+	FILE *out;
+	int format;
+	int raw;
+	size_t count;
+	char cpu_model[128];
+} bench_output;
+
+void bench_output_begin(bench_output *bo, FILE *out, int format, int raw);
+void bench_output_result(bench_output *bo, const bench_result *res);
+void bench_output_end(bench_output *bo);
+
+/*
+ * Parse a format name ("text", "json" or "csv"); returns -1 if unknown.
+ */
+int bench_format_parse(const char *name);
+
+/*
+ * Get the core type of a CPU, for heterogeneous systems: "core" or
+ * "atom" on Intel hybrid processors, the MIDR part number (e.g. "0xd05")
+ * on ARM. The string is empty if the type is unknown.
+ */
+void bench_core_type(int cpu, char *dst, size_t len);
+
+/*
+ * Machine fingerprint: what determines whether two results can be
+ * compared. The "machine" fields are the CPU identification (CPUID
+ * vendor, family, model and stepping on x86; MIDR_EL1 on ARM; marchid
+ * and mimpid on RISC-V) and model string, the core type, the SMT state,
+ * the frequency governor and the counter backend; results with distinct
+ * machine fields are never compared. The "environment" fields (kernel
+ * release, microcode version, compiler version and flags) are recorded
+ * along with each result; a change in them is what a comparison is
+ * usually meant to evaluate, and is reported as such. Fields that could
+ * not be obtained are empty strings.
+ */
+typedef struct {
+	char cpu_model[128];
+	char cpu_id[64];
+	int cpu;
+	char core_type[32];
+	char smt[16];
+	char governor[32];
+	char backend[16];
+	char kernel[96];
+	char microcode[32];
+	char compiler[256];
+} bench_fingerprint;
+
+/*
+ * Fill a fingerprint for the given CPU (-1: the current one).
+ */
+void bench_fingerprint_get(bench_fingerprint *fp, int cpu);
+
+/*
+ * Machine identifier: hash of the machine fields of a fingerprint, as
+ * 16 hexadecimal digits. bench_machine_id() computes it for the current
+ * CPU.
+ */
+void bench_fingerprint_id(const bench_fingerprint *fp, char *dst, size_t len);
+void bench_machine_id(char *dst, size_t len);
+
+/*
+ * Encode the environment fields as "key=value;key=value..." (';', '='
+ * and tabs in values are replaced with spaces). Returns the encoded
+ * length; the output is truncated to 'len' bytes (including the NUL).
+ */
+size_t bench_fingerprint_env(const bench_fingerprint *fp,
+	char *dst, size_t len);
+
+/*
+ * Print all fields of a fingerprint, one "name: value" line each, with
+ * the given prefix.
+ */
+void bench_fingerprint_print(FILE *out, const char *prefix,
+	const bench_fingerprint *fp);
+
+/*
+ * Read the first line of a file, without its newline; 'dst' is set to
+ * an empty string on error.
+ */
+void bench_read_line(const char *path, char *dst, size_t len);
+
+/*
+ * Read a CPU list file (e.g. "0-7,16", as found in sysfs): set[i] is set
+ * to 1 for each listed CPU i below 'max', and to 0 for the others.
+ * Returns the number of listed CPUs, or -1 if the file cannot be read.
+ * bench_cpu_list_parse() does the same with a string.
+ */
+#define BENCH_MAX_CPUS   1024
+int bench_cpu_list(const char *path, unsigned char *set, int max);
+int bench_cpu_list_parse(const char *s, unsigned char *set, int max);
+
+/*
+ * Preflight check of the measurement environment, for a given CPU:
+ *
+ *   governor    cpufreq scaling governor is "performance"
+ *   boost       turbo / boost is disabled (intel_pstate/no_turbo or
+ *               cpufreq/boost)
+ *   smt         SMT is off, or the sibling hardware threads are idle
+ *               (measured over BENCH_PF_LOAD_MS milliseconds)
+ *   isolation   the CPU is in the isolcpus and nohz_full lists
+ *   cpuidle     no enabled idle state with a large exit latency
+ *   backend     the counter backend reads core cycles directly (not a
+ *               fixed-frequency timer) and is enabled for user space
+ *
+ * Each check is OK, WARN or BAD, or N/A when the information is not
+ * available (e.g. no cpufreq in a virtual machine). The score (0 to
+ * 100) is the weighted proportion of passed checks among those that
+ * apply, a warning counting for half. All /sys and /proc paths are taken
+ * relative to 'root' (NULL for the real files), so that the checks can
+ * be tested against a fake tree.
+ */
+#define BENCH_PF_NA     0
+#define BENCH_PF_OK     1
+#define BENCH_PF_WARN   2
+#define BENCH_PF_BAD    3
+
+#define BENCH_PF_MAX_CHECKS   8
+#define BENCH_PF_LOAD_MS      200
+
+typedef struct {
+	const char *name;
+	int status;
+	int weight;
+	char detail[128];
+} bench_pf_check;
+
+typedef struct {
+	int cpu;
+	bench_pf_check check[BENCH_PF_MAX_CHECKS];
+	int num_checks;
+	int score;
+} bench_preflight;
+
+/*
+ * Run the checks for a CPU (-1: the current one). This sleeps for
+ * BENCH_PF_LOAD_MS to measure the load of SMT siblings.
+ */
+void bench_preflight_run(bench_preflight *pf, int cpu, const char *root);
+
+/*
+ * Print the report: one line per check, then the score.
+ */
+void bench_preflight_print(FILE *out, const bench_preflight *pf);
+
+/*
+ * Isolation session, for the most precise measurements: the calling
+ * thread is pinned to one CPU; all interrupts that can be moved are
+ * steered away from it (/proc/irq/<n>/smp_affinity, and
+ * /proc/irq/default_smp_affinity for new interrupts); the thread gets
+ * real-time (SCHED_FIFO) priority; and memory is locked with mlockall()
+ * (the stack is prefaulted, and new mappings are populated when created,
+ * so that sample buffers do not fault during measurements).
+ * bench_session_end() restores everything. The IRQ masks outlive the
+ * process, so they are also restored on SIGINT, SIGTERM and SIGHUP, and
+ * on exit() if the session is still active. An irqbalance daemon may
+ * undo the changes; stop it first.
+ *
+ * The privileged steps are attempted individually: failures are
+ * reported on the log, and the session goes on with the steps that
+ * succeeded. With 'dry_run', nothing is modified and the planned
+ * changes are logged; 'root' (NULL for none) prefixes the /proc paths,
+ * so that a fake tree can be used for testing.
+ */
+typedef struct {
+	int cpu;
+	int rt_priority;
+	int lock_memory;
+	int dry_run;
+	const char *root;
+	FILE *log;
+} bench_session_opts;
+
+/*
+ * Defaults: CPU -1 (the current one), SCHED_FIFO priority 50 (0 to keep
+ * the normal scheduling), memory locked, log on stderr.
+ */
+void bench_session_opts_init(bench_session_opts *opt);
+
+typedef struct bench_irq_saved_ bench_irq_saved;
+
+typedef struct {
+	bench_session_opts opt;
+	unsigned char old_cpus[BENCH_MAX_CPUS];
+	int pinned;
+	bench_irq_saved *irq;
+	size_t num_irqs;
+	int sched_set;
+	int old_policy;
+	int old_priority;
+	int locked;
+} bench_session;
+
+/*
+ * Start a session. Returns 0 on success, -1 if the thread could not be
+ * pinned to the CPU (nothing else is then changed). Only one session
+ * may be active at a time.
+ */
+int bench_session_begin(bench_session *s, const bench_session_opts *opt);
+
+/*
+ * End a session, restoring the IRQ masks, scheduling policy, memory
+ * locking and CPU affinity.
+ */
+void bench_session_end(bench_session *s);
+
+/*
+ * Result store: a single text file to which runs are appended, one line
+ * per benchmark result, keyed by benchmark name, machine identifier and
+ * build identifier (and timestamped). The line format is:
+ *
+ *    <bench> TAB <machine> TAB <build> TAB <time> TAB <n> TAB <samples>
+ *        [ TAB <env> ]
+ *
+ * where 'time' is in seconds since the Epoch, 'samples' lists the n
+ * per-operation samples, separated by spaces, and 'env' holds the
+ * environment fields of the fingerprint (see bench_fingerprint_env()).
+ * Lines starting with '#' are comments; the full fingerprint of the
+ * machine is written as a comment before the records of each run. Keys
+ * may not contain tabs or newlines.
+ */
+typedef struct {
+	char *bench;
+	char *machine;
+	char *build;
+	int64_t time;
+	char *env;
+	double *samples;
+	size_t num_samples;
+} bench_record;
+
+typedef struct {
+	bench_record *rec;
+	size_t num;
+} bench_store;
+
+
+/*
+ * Append a result to a store file (created if needed), with the
+ * environment fields of the fingerprint of the machine that ran it.
+ * bench_store_describe() appends the whole fingerprint as comment lines.
+ * Both return 0 on success, -1 on error.
+ */
+int bench_store_append(const char *path, const bench_result *res,
+	const char *machine, const char *build, const bench_fingerprint *fp);
+int bench_store_describe(const char *path, const char *machine,
+	const bench_fingerprint *fp);
+
+/*
+ * Load all records of a store file. Returns 0 on success, -1 on error
+ * (with a message on stderr). bench_store_free() releases the records.
+ */
+int bench_store_load(bench_store *st, const char *path);
+void bench_store_free(bench_store *st);
+
+/*
+ * Find the most recent record for a benchmark, machine and build, or
+ * NULL.
+ */
+const bench_record *bench_store_find(const bench_store *st,
+	const char *bench, const char *machine, const char *build);
+
+/*
+ * Result cache: a text file of measured results, keyed by strings, one
+ * line per result:
+ *
+ *    <key> TAB <time> TAB <cpu> TAB <migrations> TAB <check> TAB <n>
+ *        TAB <samples>
+ *
+ * where 'time' is in seconds since the Epoch, 'check' is in hexadecimal
+ * and the n samples are written with full precision, so that a cached
+ * result is the measured one. Lines are appended and synced one at a
+ * time; a line cut short by an interruption is ignored.
+ *
+ * bench_cache_open() loads a cache file (none if it does not exist) and
+ * opens it for appending; bench_cache_close() releases it. Both return
+ * 0 on success, -1 on error (with a message on stderr).
+ */
+typedef struct {
+	char *key;
+	int64_t time;
+	int cpu;
+	size_t migrations;
+	uint64_t check;
+	double *samples;
+	size_t num_samples;
+} bench_cache_entry;
+
+typedef struct {
+	char *path;
+	bench_cache_entry *ent;
+	size_t num;
+	FILE *f;
+} bench_cache;
+
+int bench_cache_open(bench_cache *c, const char *path);
+int bench_cache_close(bench_cache *c);
+
+/*
+ * Get the latest result cached under 'key', if not older than 'max_age'
+ * seconds (no limit if negative): 'res' is then filled as if by
+ * bench_run(b, opt, res), and 0 is returned. Returns -1 if there is no
+ * such result.
+ */
+int bench_cache_get(const bench_cache *c, const char *key, int64_t max_age,
+	const bench_desc *b, const bench_opts *opt, bench_result *res);
+
+/*
+ * Append a result to the cache under 'key'. Returns 0 on success, -1 on
+ * error.
+ */
+int bench_cache_put(bench_cache *c, const char *key,
+	const bench_result *res);
+
+/*
+ * Cache key for running a benchmark with some options on a machine:
+ * the benchmark name, then a hash of the machine code of its functions
+ * (read in memory, see cyc_sym_range()), of its description, of the
+ * options and of the fingerprint (machine and environment fields). Code
+ * called from the functions is covered only when inlined in them.
+ * Returns 0 on success, -1 if the code of the benchmark could not be
+ * located (its results should then not be cached).
+ */
+int bench_cache_key(const bench_desc *b, const bench_opts *opt,
+	const bench_fingerprint *fp, char *dst, size_t len);
+
+/*
+ * Parameter sweeps: a sweep file lists axes, one per line, each with
+ * its values:
+ *
+ *    <axis> <value>...
+ *
+ * The axes are "bench" (benchmark name patterns, shell wildcards),
+ * "cpu" (CPU lists, e.g. "0 4-7"), "seed", "iters", "samples" and
+ * "warmup"; each may appear once. Empty lines and lines starting with
+ * '#' are ignored. The sweep is the cartesian product of the axes, in
+ * file order (the last axis varies fastest); axes that are not listed
+ * take the value of the base options (the "bench" axis is mandatory).
+ * Each point has a key, "axis=value" for the listed axes, separated by
+ * spaces (e.g. "bench=mul32 seed=0").
+ */
+#define BENCH_SWEEP_BENCH      0
+#define BENCH_SWEEP_CPU        1
+#define BENCH_SWEEP_SEED       2
+#define BENCH_SWEEP_ITERS      3
+#define BENCH_SWEEP_SAMPLES    4
+#define BENCH_SWEEP_WARMUP     5
+#define BENCH_SWEEP_NUM_AXES   6
+
+typedef struct {
+	/* Values of each axis (indexes into 'benches' for the bench
+	   axis), and the listed axes in file order. */
+	uint64_t *val[BENCH_SWEEP_NUM_AXES];
+	size_t num[BENCH_SWEEP_NUM_AXES];
+	int order[BENCH_SWEEP_NUM_AXES];
+	int num_axes;
+	const bench_desc *const *benches;
+	bench_opts base;
+	size_t num_points;
+} bench_sweep;
+
+typedef struct {
+	const bench_desc *desc;
+	bench_opts opt;
+	/* CPU to run on, -1 if the sweep has no cpu axis. */
+	int cpu;
+	char key[256];
+} bench_sweep_point;
+
+/*
+ * Load a sweep file; benchmark names are matched against the given
+ * list. Returns 0 on success, -1 on error (with a message on stderr).
+ * bench_sweep_free() releases the sweep.
+ */
+int bench_sweep_load(bench_sweep *sw, const char *path,
+	const bench_desc *const *benches, size_t num_benches,
+	const bench_opts *base);
+void bench_sweep_free(bench_sweep *sw);
+
+/*
+ * Get point 'index' (below sw->num_points) of a sweep.
+ */
+void bench_sweep_point_get(const bench_sweep *sw, size_t index,
+	bench_sweep_point *pt);
+
+/*
+ * Run all points of a sweep, each in a forked child (see
+ * bench_child_start()) pinned to the CPU of the point, or to the
+ * current CPU if the sweep has no cpu axis; jobs[i] receives the
+ * outcome of point i. With a checkpoint file (not NULL), the result of
+ * each completed point is appended to it (and synced) as soon as it is
+ * known; points already in the file are not run again but taken from
+ * it, so that an interrupted sweep resumes where it stopped. A summary
+ * is written to 'log' once all points are done (nothing is printed
+ * between points). Returns 0 on success (whether points failed or not:
+ * see jobs[i].err), -1 if the checkpoint file cannot be opened. The
+ * checkpoint is a result cache file (see bench_cache_open()) keyed by
+ * the point key followed by the cache key (see bench_cache_key()), so
+ * that only results of the same code, options and machine are resumed.
+ */
+int bench_sweep_run(const bench_sweep *sw, const char *ckpt,
+	bench_job *jobs, FILE *log);
+
+/*
+ * Comparison of two sample sets (baseline 'a', new 'b'): relative change
+ * of the median ((median(b) - median(a)) / median(a)) with a bootstrap
+ * 95% confidence interval, and the two-sided p-value of the
+ * Mann-Whitney U test (normal approximation, with tie correction).
+ */
+typedef struct {
+	double median_a;
+	double median_b;
+	double delta;
+	double ci_lo;
+	double ci_hi;
+	double p;
+} bench_cmp;
+
+int bench_compare(const double *a, size_t na, const double *b, size_t nb,
+	bench_cmp *cmp);
+
+/*
+ * Cycle budgets, loaded from a text file with one rule per line:
+ *
+ *    <cpu-pattern> <bench-pattern> <statistic> <max>
+ *
+ * Patterns are shell wildcards (fnmatch()) matched against the CPU model
+ * string and the benchmark name; a CPU pattern containing spaces must be
+ * quoted with double quotes. The statistic is one of min, p10, p25,
+ * median, p75, p90, p99, max and mean; 'max' is in cycles per operation.
+ * Empty lines and lines starting with '#' are ignored. For a given
+ * benchmark, the first matching rule applies; more specific rules
+ * should therefore come first.
+ */
+typedef struct {
+	char *cpu;
+	char *bench;
+	char *stat;
+	double max;
+	unsigned line;
+} bench_budget;
+
+typedef struct {
+	bench_budget *rule;
+	size_t num;
+} bench_budgets;
+
+/*
+ * Load budgets from a file. Returns 0 on success, -1 on error (an error
+ * message is written to stderr). bench_budgets_free() releases them.
+ */
+int bench_budgets_load(bench_budgets *bud, const char *path);
+void bench_budgets_free(bench_budgets *bud);
+
+/*
+ * Find the rule for a benchmark on a CPU model, or NULL.
+ */
+const bench_budget *bench_budget_find(const bench_budgets *bud,
+	const char *cpu, const char *name);
+
+/* Outcome of bench_assert(). */
+#define BENCH_PASS        0
+#define BENCH_FAIL        1
+#define BENCH_NO_BUDGET   2
+
+/*
+ * Compare a result against its budget: BENCH_NO_BUDGET if no rule
+ * applies, BENCH_PASS if the statistic is within the budget,
+ * BENCH_FAIL otherwise; on failure, the rule and the observed
+ * distribution are written to 'log' (if not NULL).
+ */
+int bench_assert(const bench_budgets *bud, const char *cpu,
+	const bench_result *res, FILE *log);
+
+/*
+ * Run a benchmark with adaptive sampling and compare it against the
+ * budgets: this is the entry point for performance unit tests. Returns
+ * BENCH_PASS, BENCH_FAIL or BENCH_NO_BUDGET, or -1 if the benchmark
+ * could not run.
+ */
+int bench_check(const bench_desc *b, const bench_budgets *bud,
+	const char *cpu, FILE *log);
+
+/*
+ * Constant-time tests. A test defines input classes (e.g. "operands are
+ * 0 or 1" and "random operands"); prepare() sets up the context with an
+ * input of the given class, drawn with the provided random value, and
+ * kernel() processes it for 'iters' iterations. Samples are taken with
+ * the class of each sample chosen at random, so that drifts of the
+ * machine affect all classes alike; each sample is the cost per
+ * iteration. Each class is then compared with the first one with
+ * Welch's t-test, on all samples and on samples cropped at several
+ * percentiles of the pooled distribution (which removes the outliers
+ * due to interrupts and other noise). A leak is reported when the
+ * largest |t| exceeds the threshold (4.5 by default, which for
+ * constant-time code is very unlikely to happen by chance).
+ */
+#define BENCH_CT_MAX_CLASSES   8
+
+typedef struct {
+	const char *name;
+	size_t ctx_len;
+	unsigned num_classes;
+	const char *const *class_names;
+	int (*prepare)(void *ctx, unsigned cls, uint64_t rnd);
+	void (*kernel)(void *ctx, uint64_t iters);
+	uint64_t (*check)(const void *ctx);
+} bench_ct_desc;
+
+typedef struct {
+	size_t samples;
+	uint64_t iters;
+	double threshold;
+	uint64_t seed;
+	int huge_pages;
+} bench_ct_opts;
+
+/* Defaults: 50000 samples of 100 iterations, threshold 4.5. */
+void bench_ct_opts_init(bench_ct_opts *opt);
+
+typedef struct {
+	const bench_ct_desc *desc;
+	/* Largest |t|, the class compared with class 0 and the cropping
+	   percentile (1 for no cropping) where it was found. */
+	double t;
+	unsigned cls;
+	double crop;
+	int leak;
+	size_t n[BENCH_CT_MAX_CLASSES];
+	double median[BENCH_CT_MAX_CLASSES];
+	uint64_t check;
+} bench_ct_result;
+
+/*
+ * Run a constant-time test. Returns 0 on success (whether a leak was
+ * detected or not: see res->leak), -1 on error.
+ */
+int bench_ct_run(const bench_ct_desc *d, const bench_ct_opts *opt,
+	bench_ct_result *res);
+
+/*
+ * Print the outcome of a constant-time test: the largest t-statistic
+ * and the median cost per iteration of each class.
+ */
+void bench_ct_print(FILE *out, const bench_ct_result *res);
+
+/*
+ * Built-in benchmarks and constant-time tests (integer multiplications).
+ */
+extern const bench_desc *const bench_builtin[];
+extern const size_t bench_builtin_count;
+extern const bench_ct_desc *const bench_ct_builtin[];
+extern const size_t bench_ct_builtin_count;
+
+/*
+ * Plugins: a shared object that exports, under the name
+ * BENCH_PLUGIN_SYMBOL, a bench_plugin table of benchmark descriptors
+ * (bench_desc) and constant-time test descriptors (bench_ct_desc, with
+ * their input classes). The layout of these structures is the plugin
+ * ABI: the table must have 'abi' set to BENCH_PLUGIN_ABI, which is
+ * incremented on any change to them. A plugin needs only this header
+ * (no harness code), and is built with e.g.:
+ *
+ *    cc -O2 -fPIC -shared -o myplugin.so myplugin.c
+ *
+ * See bench/divplugin.c for an example.
+ */
+#define BENCH_PLUGIN_ABI      1
+#define BENCH_PLUGIN_SYMBOL   "bench_plugin_table"
+
+typedef struct {
+	unsigned abi;
+	const bench_desc *const *bench;
+	size_t num_bench;
+	const bench_ct_desc *const *ct;
+	size_t num_ct;
+} bench_plugin;
+
+/*
+ * Suite of benchmarks and constant-time tests, gathered from lists
+ * (e.g. the built-in ones) and plugins. bench_suite_add() appends lists;
+ * bench_suite_load() loads a plugin with dlopen() and appends its
+ * tables (the plugin stays loaded until the process exits). Names must
+ * be unique among benchmarks, and among constant-time tests. Both
+ * return 0 on success, -1 on error (with a message on stderr).
+ */
+typedef struct {
+	const bench_desc **bench;
+	size_t num_bench;
+	const bench_ct_desc **ct;
+	size_t num_ct;
+} bench_suite;
+
+void bench_suite_init(bench_suite *s);
+int bench_suite_add(bench_suite *s,
+	const bench_desc *const *bench, size_t num_bench,
+	const bench_ct_desc *const *ct, size_t num_ct);
+int bench_suite_load(bench_suite *s, const char *path);
+void bench_suite_free(bench_suite *s);
+
+#endif
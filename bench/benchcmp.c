@@ -0,0 +1,183 @@
+/*
+ * benchcmp: compare two builds in a benchmark result store.
+ *
+ * Usage: benchcmp [ -m machine ] [ -t threshold ] [ -a alpha ]
+ *                 store base-build new-build
+ *
+ * For each benchmark that has results for both builds on the machine
+ * (by default, the current one; see bench_machine_id()), the latest
+ * records are compared: medians, relative change with its 95% bootstrap
+ * confidence interval, and Mann-Whitney p-value. A change is flagged as
+ * a regression (or improvement) when it exceeds the threshold (in
+ * percent, default 2) and is significant (p < alpha, default 0.01). The
+ * exit status is non-zero if any regression is flagged.
+ *
+ * Since records are matched by machine identifier, only results from
+ * the same hardware configuration are compared; differences in the
+ * recorded environment (kernel, microcode, compiler) between the two
+ * builds are listed before the table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: benchcmp [ -m machine ] [ -t threshold ] [ -a alpha ]\n"
+"                store base-build new-build\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Find the value of 'key' in an environment string; returns its length
+ * and sets *val, or returns -1 if absent.
+ */
+static int
+env_value(const char *env, const char *key, const char **val)
+{
+	size_t kl = strlen(key);
+	for (const char *p = env; *p != 0;) {
+		size_t n = strcspn(p, ";");
+		if (n > kl && strncmp(p, key, kl) == 0 && p[kl] == '=') {
+			*val = p + kl + 1;
+			return (int)(n - kl - 1);
+		}
+		p += n;
+		if (*p == ';') {
+			p ++;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Print the environment fields that differ between two records.
+ */
+static void
+print_env_changes(const bench_record *ra, const bench_record *rb)
+{
+	static const char *const keys[] = {
+		"kernel", "microcode", "compiler", NULL
+	};
+	for (int i = 0; keys[i] != NULL; i ++) {
+		const char *va = "", *vb = "";
+		int la = env_value(ra->env, keys[i], &va);
+		int lb = env_value(rb->env, keys[i], &vb);
+		la = la < 0 ? 0 : la;
+		lb = lb < 0 ? 0 : lb;
+		if (la == lb && memcmp(va, vb, (size_t)la) == 0) {
+			continue;
+		}
+		if (la == 0) {
+			va = "?";
+			la = 1;
+		}
+		if (lb == 0) {
+			vb = "?";
+			lb = 1;
+		}
+		printf("  %s: %.*s -> %.*s\n", keys[i], la, va, lb, vb);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char machine[64];
+	bench_machine_id(machine, sizeof machine);
+	double threshold = 2.0;
+	double alpha = 0.01;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:t:a:")) != -1) {
+		switch (opt) {
+		case 'm':
+			snprintf(machine, sizeof machine, "%s", optarg);
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 3) {
+		usage();
+	}
+	const char *base = argv[optind + 1];
+	const char *cur = argv[optind + 2];
+
+	bench_store st;
+	if (bench_store_load(&st, argv[optind]) < 0) {
+		exit(EXIT_FAILURE);
+	}
+	printf("machine %s: %s -> %s\n", machine, base, cur);
+
+	/* Environment of the latest record of each build. */
+	const bench_record *ea = NULL, *eb = NULL;
+	for (size_t i = 0; i < st.num; i ++) {
+		const bench_record *r = &st.rec[i];
+		if (strcmp(r->machine, machine) != 0) {
+			continue;
+		}
+		if (strcmp(r->build, base) == 0) {
+			ea = r;
+		} else if (strcmp(r->build, cur) == 0) {
+			eb = r;
+		}
+	}
+	if (ea != NULL && eb != NULL) {
+		print_env_changes(ea, eb);
+	}
+	printf("%-16s %10s %10s %8s %18s %9s\n",
+		"benchmark", "base", "new", "delta", "95% CI", "p");
+	int regressions = 0;
+	size_t compared = 0;
+	for (size_t i = 0; i < st.num; i ++) {
+		const bench_record *r = &st.rec[i];
+		/* Each benchmark once: at its latest record for 'cur'. */
+		if (strcmp(r->machine, machine) != 0
+			|| strcmp(r->build, cur) != 0
+			|| bench_store_find(&st, r->bench, machine, cur) != r)
+		{
+			continue;
+		}
+		const bench_record *rb = bench_store_find(&st,
+			r->bench, machine, base);
+		if (rb == NULL) {
+			continue;
+		}
+		bench_cmp c;
+		if (bench_compare(rb->samples, rb->num_samples,
+			r->samples, r->num_samples, &c) < 0)
+		{
+			fprintf(stderr, "%s: comparison failed\n", r->bench);
+			continue;
+		}
+		compared ++;
+		const char *verdict = "";
+		if (c.p < alpha && 100.0 * c.delta > threshold) {
+			verdict = "REGRESSION";
+			regressions ++;
+		} else if (c.p < alpha && 100.0 * c.delta < -threshold) {
+			verdict = "improvement";
+		}
+		printf("%-16s %10.3f %10.3f %+7.2f%% [%+6.2f%%, %+6.2f%%]"
+			" %9.2g  %s\n", r->bench, c.median_a, c.median_b,
+			100.0 * c.delta, 100.0 * c.ci_lo, 100.0 * c.ci_hi,
+			c.p, verdict);
+	}
+	bench_store_free(&st);
+	if (compared == 0) {
+		fprintf(stderr, "no benchmark has results for both builds\n");
+		exit(EXIT_FAILURE);
+	}
+	return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*
+ * benchsweep: run a parameter sweep over the built-in and plugin
+ * benchmarks.
+ *
+ * Usage: benchsweep [ -f text|json|csv ] [ -o file ] [ -r ] [ -a ] [ -H ]
+ *                   [ -c checkpoint | -n ] [ -L plugin ]... sweep-file
+ *
+ * The sweep file (see bench.h) lists the values of each axis; every
+ * point of their cartesian product is run in a forked child, pinned to
+ * the CPU of the point (or to the CPU on which benchsweep started), and
+ * the results are written in the given format once all points are done
+ * (see bench_output_begin(); -o and -r as in bench). In text format,
+ * each result line is labelled with the values of the point. -a enables
+ * adaptive sampling and -H huge pages, for all points. -L loads the
+ * benchmarks of a plugin (see bench_plugin), which the sweep file may
+ * then name.
+ *
+ * Completed points are recorded in a checkpoint file (by default, the
+ * sweep file name with ".ckpt" appended; -c selects another one, -n
+ * disables it). When a sweep is interrupted, running it again with the
+ * same checkpoint resumes it: points found in the checkpoint are not
+ * measured again, and the final output covers all of them. Only results
+ * of the same code, options and machine are resumed; remove the
+ * checkpoint to measure everything anew. The exit status is non-zero if
+ * any point could not run.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: benchsweep [ -f text|json|csv ] [ -o file ] [ -r ] [ -a ] [ -H ]\n"
+"                  [ -c checkpoint | -n ] [ -L plugin ]... sweep-file\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_opts opt;
+	bench_opts_init(&opt);
+	int format = BENCH_FMT_TEXT;
+	const char *out_path = NULL;
+	int raw = 0;
+	const char *ckpt = NULL;
+	int no_ckpt = 0;
+	bench_suite suite;
+	bench_suite_init(&suite);
+	if (bench_suite_add(&suite, bench_builtin, bench_builtin_count,
+		NULL, 0) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	int opt_c;
+	while ((opt_c = getopt(argc, argv, "f:o:raHc:nL:")) != -1) {
+		switch (opt_c) {
+		case 'f':
+			format = bench_format_parse(optarg);
+			if (format < 0) {
+				usage();
+			}
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		case 'a':
+			opt.adaptive = 1;
+			break;
+		case 'H':
+			opt.huge_pages = 1;
+			break;
+		case 'c':
+			ckpt = optarg;
+			break;
+		case 'n':
+			no_ckpt = 1;
+			break;
+		case 'L':
+			if (bench_suite_load(&suite, optarg) < 0) {
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 1 || (no_ckpt && ckpt != NULL)) {
+		usage();
+	}
+	const char *path = argv[optind];
+
+	bench_sweep sw;
+	if (bench_sweep_load(&sw, path, suite.bench, suite.num_bench,
+		&opt) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	char *ckpt_buf = NULL;
+	if (ckpt == NULL && !no_ckpt) {
+		size_t n = strlen(path) + 6;
+		ckpt_buf = malloc(n);
+		if (ckpt_buf == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		snprintf(ckpt_buf, n, "%s.ckpt", path);
+		ckpt = ckpt_buf;
+	}
+
+	FILE *log = format == BENCH_FMT_TEXT && out_path == NULL
+		? stdout : stderr;
+	bench_job *jobs = calloc(sw.num_points, sizeof *jobs);
+	if (jobs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	if (bench_sweep_run(&sw, ckpt, jobs, log) < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *out = stdout;
+	if (out_path != NULL) {
+		out = fopen(out_path, "w");
+		if (out == NULL) {
+			perror(out_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	/* Text lines are labelled with the point, aligned on the longest. */
+	int width = 0;
+	for (size_t i = 0; i < sw.num_points; i ++) {
+		bench_sweep_point pt;
+		bench_sweep_point_get(&sw, i, &pt);
+		int n = (int)strlen(pt.key);
+		width = n > width ? n : width;
+	}
+	bench_output bo;
+	bench_output_begin(&bo, out, format, raw);
+	int failed = 0;
+	for (size_t i = 0; i < sw.num_points; i ++) {
+		bench_job *j = &jobs[i];
+		bench_sweep_point pt;
+		bench_sweep_point_get(&sw, i, &pt);
+		if (j->err) {
+			if (WIFSIGNALED(j->status)) {
+				fprintf(stderr, "%s: killed by signal %d\n",
+					pt.key, WTERMSIG(j->status));
+			} else {
+				fprintf(stderr, "%s: could not run\n", pt.key);
+			}
+			failed = 1;
+			continue;
+		}
+		if (format == BENCH_FMT_TEXT) {
+			bench_print_result_label(out, pt.key, width, &j->res);
+		} else {
+			bench_output_result(&bo, &j->res);
+		}
+		bench_result_free(&j->res);
+	}
+	bench_output_end(&bo);
+	if (out != stdout && fclose(out) != 0) {
+		perror(out_path);
+		failed = 1;
+	}
+	free(jobs);
+	free(ckpt_buf);
+	bench_sweep_free(&sw);
+	bench_suite_free(&suite);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/*
+ * Benchmark harness: cycle budgets and assertions.
+ */
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * Extract the next field of a line (whitespace-separated, or enclosed
+ * in double quotes). The field is NUL-terminated in place; '*pp' is
+ * moved past it. Returns NULL if there is no further field.
+ */
+static char *
+next_field(char **pp)
+{
+	char *p = *pp;
+	while (*p == ' ' || *p == '\t') {
+		p ++;
+	}
+	if (*p == 0 || *p == '\n' || *p == '#') {
+		return NULL;
+	}
+	char *f;
+	if (*p == '"') {
+		f = ++ p;
+		while (*p != 0 && *p != '"') {
+			p ++;
+		}
+		if (*p != '"') {
+			return NULL;
+		}
+	} else {
+		f = p;
+		while (*p != 0 && *p != ' ' && *p != '\t' && *p != '\n') {
+			p ++;
+		}
+	}
+	if (*p != 0) {
+		*p ++ = 0;
+	}
+	*pp = p;
+	return f;
+}
+
+static int
+stat_known(const char *s)
+{
+	static const char *const names[] = {
+		"min", "p10", "p25", "median", "p75", "p90", "p99", "max",
+		"mean", NULL
+	};
+	for (int i = 0; names[i] != NULL; i ++) {
+		if (strcmp(s, names[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static double
+stat_value(const bench_stats *st, const char *s)
+{
+	if (strcmp(s, "min") == 0) {
+		return st->min;
+	} else if (strcmp(s, "p10") == 0) {
+		return st->p10;
+	} else if (strcmp(s, "p25") == 0) {
+		return st->p25;
+	} else if (strcmp(s, "median") == 0) {
+		return st->median;
+	} else if (strcmp(s, "p75") == 0) {
+		return st->p75;
+	} else if (strcmp(s, "p90") == 0) {
+		return st->p90;
+	} else if (strcmp(s, "p99") == 0) {
+		return st->p99;
+	} else if (strcmp(s, "max") == 0) {
+		return st->max;
+	} else {
+		return st->mean;
+	}
+}
+
+static char *
+xstrdup(const char *s)
+{
+	size_t n = strlen(s) + 1;
+	char *d = malloc(n);
+	if (d != NULL) {
+		memcpy(d, s, n);
+	}
+	return d;
+}
+
+int
+bench_budgets_load(bench_budgets *bud, const char *path)
+{
+	bud->rule = NULL;
+	bud->num = 0;
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	size_t cap = 0;
+	char line[512];
+	unsigned ln = 0;
+	while (fgets(line, sizeof line, f) != NULL) {
+		ln ++;
+		char *p = line;
+		char *cpu = next_field(&p);
+		if (cpu == NULL) {
+			continue;
+		}
+		char *name = next_field(&p);
+		char *stat = next_field(&p);
+		char *max = next_field(&p);
+		char *end = NULL;
+		double m = max != NULL ? strtod(max, &end) : 0.0;
+		if (stat == NULL || !stat_known(stat)
+			|| end == max || *end != 0 || next_field(&p) != NULL)
+		{
+			fprintf(stderr, "%s:%u: invalid budget rule\n", path, ln);
+			goto fail;
+		}
+		if (bud->num == cap) {
+			cap = cap == 0 ? 16 : cap << 1;
+			bench_budget *r = realloc(bud->rule, cap * sizeof *r);
+			if (r == NULL) {
+				goto oom;
+			}
+			bud->rule = r;
+		}
+		bench_budget *r = &bud->rule[bud->num];
+		r->cpu = xstrdup(cpu);
+		r->bench = xstrdup(name);
+		r->stat = xstrdup(stat);
+		r->max = m;
+		r->line = ln;
+		bud->num ++;
+		if (r->cpu == NULL || r->bench == NULL || r->stat == NULL) {
+			goto oom;
+		}
+	}
+	fclose(f);
+	return 0;
+
+oom:
+	fprintf(stderr, "%s: out of memory\n", path);
+fail:
+	fclose(f);
+	bench_budgets_free(bud);
+	return -1;
+}
+
+void
+bench_budgets_free(bench_budgets *bud)
+{
+	for (size_t i = 0; i < bud->num; i ++) {
+		free(bud->rule[i].cpu);
+		free(bud->rule[i].bench);
+		free(bud->rule[i].stat);
+	}
+	free(bud->rule);
+	bud->rule = NULL;
+	bud->num = 0;
+}
+
+const bench_budget *
+bench_budget_find(const bench_budgets *bud, const char *cpu, const char *name)
+{
+	for (size_t i = 0; i < bud->num; i ++) {
+		const bench_budget *r = &bud->rule[i];
+		if (fnmatch(r->cpu, cpu, 0) == 0
+			&& fnmatch(r->bench, name, 0) == 0)
+		{
+			return r;
+		}
+	}
+	return NULL;
+}
+
+int
+bench_assert(const bench_budgets *bud, const char *cpu,
+	const bench_result *res, FILE *log)
+{
+	const bench_budget *r = bench_budget_find(bud, cpu, res->desc->name);
+	if (r == NULL) {
+		return BENCH_NO_BUDGET;
+	}
+	double v = stat_value(&res->stats, r->stat);
+	if (v <= r->max) {
+		return BENCH_PASS;
+	}
+	if (log != NULL) {
+		fprintf(log, "FAIL %s: %s %.3f > %.3f cycles"
+			" (budget line %u, cpu \"%s\")\n",
+			res->desc->name, r->stat, v, r->max, r->line, cpu);
+		bench_print_distribution(log, res);
+	}
+	return BENCH_FAIL;
+}
+
+int
+bench_check(const bench_desc *b, const bench_budgets *bud,
+	const char *cpu, FILE *log)
+{
+	bench_opts opt;
+	bench_opts_init(&opt);
+	opt.adaptive = 1;
+	bench_result res;
+	if (bench_run(b, &opt, &res) < 0) {
+		return -1;
+	}
+	int r = bench_assert(bud, cpu, &res, log);
+	bench_result_free(&res);
+	return r;
+}
@@ -0,0 +1,291 @@
+/*
+ * Benchmark harness: result cache.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+static char *
+xstrdup(const char *s)
+{
+	size_t n = strlen(s) + 1;
+	char *d = malloc(n);
+	if (d != NULL) {
+		memcpy(d, s, n);
+	}
+	return d;
+}
+
+/*
+ * Parse one cache line (modified in place). Returns 0 on success, -1 on
+ * a malformed line or allocation failure.
+ */
+static int
+parse_entry(char *line, bench_cache_entry *e)
+{
+	char *field[7];
+	char *p = line;
+	for (int i = 0; i < 7; i ++) {
+		field[i] = p;
+		if (i < 6) {
+			p = strchr(p, '\t');
+			if (p == NULL) {
+				return -1;
+			}
+			*p ++ = 0;
+		}
+	}
+	char *end;
+	long long t = strtoll(field[1], &end, 10);
+	if (*end != 0) {
+		return -1;
+	}
+	long cpu = strtol(field[2], &end, 10);
+	if (*end != 0) {
+		return -1;
+	}
+	unsigned long long mig = strtoull(field[3], &end, 10);
+	if (*end != 0) {
+		return -1;
+	}
+	unsigned long long check = strtoull(field[4], &end, 16);
+	if (*end != 0) {
+		return -1;
+	}
+	unsigned long long n = strtoull(field[5], &end, 10);
+	if (*end != 0 || n == 0 || n > ((size_t)-1 / sizeof(double))) {
+		return -1;
+	}
+	double *s = malloc((size_t)n * sizeof *s);
+	if (s == NULL) {
+		return -1;
+	}
+	p = field[6];
+	for (size_t i = 0; i < n; i ++) {
+		s[i] = strtod(p, &end);
+		if (end == p) {
+			free(s);
+			return -1;
+		}
+		p = end;
+	}
+	e->key = *p == 0 ? xstrdup(field[0]) : NULL;
+	if (e->key == NULL) {
+		free(s);
+		return -1;
+	}
+	e->time = (int64_t)t;
+	e->cpu = (int)cpu;
+	e->migrations = (size_t)mig;
+	e->check = (uint64_t)check;
+	e->samples = s;
+	e->num_samples = (size_t)n;
+	return 0;
+}
+
+int
+bench_cache_open(bench_cache *c, const char *path)
+{
+	c->ent = NULL;
+	c->num = 0;
+	c->f = NULL;
+	c->path = xstrdup(path);
+	if (c->path == NULL) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return -1;
+	}
+	int partial = 0;
+	FILE *f = fopen(path, "r");
+	if (f == NULL && errno != ENOENT) {
+		perror(path);
+		bench_cache_close(c);
+		return -1;
+	}
+	if (f != NULL) {
+		size_t cap = 0;
+		char *line = NULL;
+		size_t line_cap = 0;
+		ssize_t len;
+		while ((len = getline(&line, &line_cap, f)) >= 0) {
+			partial = len > 0 && line[len - 1] != '\n';
+			if (len > 0 && line[len - 1] == '\n') {
+				line[-- len] = 0;
+			}
+			if (c->num == cap) {
+				cap = cap == 0 ? 64 : cap << 1;
+				bench_cache_entry *e = realloc(c->ent,
+					cap * sizeof *e);
+				if (e == NULL) {
+					fprintf(stderr, "%s: out of memory\n",
+						path);
+					free(line);
+					fclose(f);
+					bench_cache_close(c);
+					return -1;
+				}
+				c->ent = e;
+			}
+			if (parse_entry(line, &c->ent[c->num]) == 0) {
+				c->num ++;
+			}
+		}
+		free(line);
+		fclose(f);
+	}
+	c->f = fopen(path, "a");
+	if (c->f == NULL) {
+		perror(path);
+		bench_cache_close(c);
+		return -1;
+	}
+	/* Terminate a line cut short by an interruption. */
+	if (partial) {
+		fputc('\n', c->f);
+	}
+	return 0;
+}
+
+int
+bench_cache_close(bench_cache *c)
+{
+	int r = 0;
+	if (c->f != NULL && fclose(c->f) != 0) {
+		perror(c->path);
+		r = -1;
+	}
+	c->f = NULL;
+	for (size_t i = 0; i < c->num; i ++) {
+		free(c->ent[i].key);
+		free(c->ent[i].samples);
+	}
+	free(c->ent);
+	free(c->path);
+	c->ent = NULL;
+	c->num = 0;
+	c->path = NULL;
+	return r;
+}
+
+int
+bench_cache_get(const bench_cache *c, const char *key, int64_t max_age,
+	const bench_desc *b, const bench_opts *opt, bench_result *res)
+{
+	int64_t now = (int64_t)time(NULL);
+	/* Entries are in append order; the last match is the latest. */
+	const bench_cache_entry *e = NULL;
+	for (size_t i = c->num; i -- > 0;) {
+		if (strcmp(c->ent[i].key, key) == 0) {
+			e = &c->ent[i];
+			break;
+		}
+	}
+	if (e == NULL || (max_age >= 0 && now - e->time > max_age)) {
+		return -1;
+	}
+	memset(res, 0, sizeof *res);
+	res->samples = malloc(e->num_samples * sizeof *res->samples);
+	if (res->samples == NULL) {
+		return -1;
+	}
+	memcpy(res->samples, e->samples,
+		e->num_samples * sizeof *res->samples);
+	res->num_samples = e->num_samples;
+	res->desc = b;
+	res->opt = *opt;
+	bench_stats_compute(res->samples, res->num_samples, &res->stats);
+	res->check = e->check;
+	res->cpu = e->cpu;
+	res->migrations = e->migrations;
+	return 0;
+}
+
+int
+bench_cache_put(bench_cache *c, const char *key, const bench_result *res)
+{
+	if (c->f == NULL || strpbrk(key, "\t\n") != NULL) {
+		return -1;
+	}
+	fprintf(c->f, "%s\t%lld\t%d\t%zu\t%016llx\t%zu\t", key,
+		(long long)time(NULL), res->cpu, res->migrations,
+		(unsigned long long)res->check, res->num_samples);
+	for (size_t i = 0; i < res->num_samples; i ++) {
+		fprintf(c->f, "%s%.17g", i > 0 ? " " : "", res->samples[i]);
+	}
+	fputc('\n', c->f);
+	if (fflush(c->f) != 0 || fsync(fileno(c->f)) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* FNV-1a, continued from 'h'. */
+static uint64_t
+fnv(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	for (size_t i = 0; i < len; i ++) {
+		h = (h ^ p[i]) * 0x100000001B3ull;
+	}
+	return h;
+}
+
+static uint64_t
+fnv_str(uint64_t h, const char *s)
+{
+	return fnv(h, s, strlen(s) + 1);
+}
+
+/*
+ * Hash the machine code of the function at 'fn' (nothing if NULL).
+ * Returns -1 if the function cannot be located.
+ */
+static int
+hash_code(uint64_t *h, const void *fn)
+{
+	if (fn == NULL) {
+		*h = fnv(*h, "", 1);
+		return 0;
+	}
+	const void *start;
+	size_t size;
+	if (cyc_sym_range(fn, &start, &size) < 0 || start != fn) {
+		return -1;
+	}
+	*h = fnv(*h, &size, sizeof size);
+	*h = fnv(*h, start, size);
+	return 0;
+}
+
+int
+bench_cache_key(const bench_desc *b, const bench_opts *opt,
+	const bench_fingerprint *fp, char *dst, size_t len)
+{
+	uint64_t h = 0xCBF29CE484222325ull;
+	if (hash_code(&h, (const void *)b->setup) < 0
+		|| hash_code(&h, (const void *)b->kernel) < 0
+		|| hash_code(&h, (const void *)b->check) < 0)
+	{
+		return -1;
+	}
+	uint64_t v[] = {
+		b->ctx_len, opt->warmup, opt->samples, opt->iters, opt->seed,
+		(uint64_t)opt->adaptive, opt->max_samples,
+		(uint64_t)opt->huge_pages
+	};
+	h = fnv(h, v, sizeof v);
+	h = fnv(h, &b->ops_per_iter, sizeof b->ops_per_iter);
+	h = fnv(h, &opt->rel_ci, sizeof opt->rel_ci);
+	char id[32], env[512];
+	bench_fingerprint_id(fp, id, sizeof id);
+	bench_fingerprint_env(fp, env, sizeof env);
+	h = fnv_str(h, id);
+	h = fnv_str(h, env);
+	snprintf(dst, len, "%s-%016llx", b->name, (unsigned long long)h);
+	return 0;
+}
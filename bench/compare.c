@@ -0,0 +1,168 @@
+/*
+ * Benchmark harness: statistical comparison of two sample sets.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/* Number of bootstrap resamples. */
+#define BOOTSTRAP_ROUNDS   1000
+
+static int
+cmp_double(const void *v1, const void *v2)
+{
+	double x1 = *(const double *)v1;
+	double x2 = *(const double *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+typedef struct {
+	double v;
+	int set;
+} tagged;
+
+static int
+cmp_tagged(const void *v1, const void *v2)
+{
+	return cmp_double(&((const tagged *)v1)->v, &((const tagged *)v2)->v);
+}
+
+/*
+ * Two-sided p-value of the Mann-Whitney U test. Returns -1.0 on
+ * allocation failure.
+ */
+static double
+mann_whitney(const double *a, size_t na, const double *b, size_t nb)
+{
+	size_t n = na + nb;
+	tagged *t = malloc(n * sizeof *t);
+	if (t == NULL) {
+		return -1.0;
+	}
+	for (size_t i = 0; i < na; i ++) {
+		t[i].v = a[i];
+		t[i].set = 0;
+	}
+	for (size_t i = 0; i < nb; i ++) {
+		t[na + i].v = b[i];
+		t[na + i].set = 1;
+	}
+	qsort(t, n, sizeof *t, &cmp_tagged);
+
+	/* Rank sum of 'a' (ties get the average rank), and the tie
+	   correction term sum(t^3 - t). */
+	double ra = 0.0;
+	double ties = 0.0;
+	for (size_t i = 0; i < n;) {
+		size_t j = i + 1;
+		while (j < n && t[j].v == t[i].v) {
+			j ++;
+		}
+		double rank = ((double)i + (double)j + 1.0) / 2.0;
+		for (size_t k = i; k < j; k ++) {
+			if (t[k].set == 0) {
+				ra += rank;
+			}
+		}
+		double tc = (double)(j - i);
+		ties += tc * tc * tc - tc;
+		i = j;
+	}
+	free(t);
+
+	double n1 = (double)na, n2 = (double)nb, nn = (double)n;
+	double u = ra - n1 * (n1 + 1.0) / 2.0;
+	double mu = n1 * n2 / 2.0;
+	double var = n1 * n2 / 12.0 * ((nn + 1.0) - ties / (nn * (nn - 1.0)));
+	if (var <= 0.0) {
+		return 1.0;
+	}
+	/* Continuity correction. */
+	double d = fabs(u - mu) - 0.5;
+	if (d < 0.0) {
+		d = 0.0;
+	}
+	return erfc(d / sqrt(var) / sqrt(2.0));
+}
+
+static uint64_t
+next_rand(uint64_t *state)
+{
+	/* xorshift64* */
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+/* Median of a resample (with replacement) of v[], using tmp[]. */
+static double
+resample_median(const double *v, size_t n, double *tmp, uint64_t *rng)
+{
+	for (size_t i = 0; i < n; i ++) {
+		tmp[i] = v[(size_t)((next_rand(rng) >> 32) * n >> 32)];
+	}
+	qsort(tmp, n, sizeof *tmp, &cmp_double);
+	return tmp[n / 2];
+}
+
+static double
+median(const double *v, size_t n, double *tmp)
+{
+	memcpy(tmp, v, n * sizeof *tmp);
+	qsort(tmp, n, sizeof *tmp, &cmp_double);
+	return tmp[n / 2];
+}
+
+int
+bench_compare(const double *a, size_t na, const double *b, size_t nb,
+	bench_cmp *cmp)
+{
+	memset(cmp, 0, sizeof *cmp);
+	if (na == 0 || nb == 0) {
+		return -1;
+	}
+	double *tmp = malloc((na > nb ? na : nb) * sizeof *tmp);
+	double *boot = malloc(BOOTSTRAP_ROUNDS * sizeof *boot);
+	if (tmp == NULL || boot == NULL) {
+		free(tmp);
+		free(boot);
+		return -1;
+	}
+	cmp->median_a = median(a, na, tmp);
+	cmp->median_b = median(b, nb, tmp);
+	if (cmp->median_a <= 0.0) {
+		free(tmp);
+		free(boot);
+		return -1;
+	}
+	cmp->delta = (cmp->median_b - cmp->median_a) / cmp->median_a;
+
+	/* Percentile bootstrap of the relative change of the median;
+	   the seed is fixed so that reports are reproducible. */
+	uint64_t rng = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < BOOTSTRAP_ROUNDS; i ++) {
+		double ma = resample_median(a, na, tmp, &rng);
+		double mb = resample_median(b, nb, tmp, &rng);
+		boot[i] = ma > 0.0 ? (mb - ma) / ma : 0.0;
+	}
+	qsort(boot, BOOTSTRAP_ROUNDS, sizeof *boot, &cmp_double);
+	cmp->ci_lo = boot[BOOTSTRAP_ROUNDS / 40];
+	cmp->ci_hi = boot[BOOTSTRAP_ROUNDS - 1 - BOOTSTRAP_ROUNDS / 40];
+	free(tmp);
+	free(boot);
+
+	cmp->p = mann_whitney(a, na, b, nb);
+	return cmp->p < 0.0 ? -1 : 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Benchmark harness: constant-time tests (Welch's t-test between input
+ * classes, in the manner of dudect).
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+void
+bench_ct_opts_init(bench_ct_opts *opt)
+{
+	opt->samples = 50000;
+	opt->iters = 100;
+	opt->threshold = 4.5;
+	opt->seed = 1;
+	opt->huge_pages = 0;
+}
+
+static uint64_t
+next_rand(uint64_t *state)
+{
+	/* xorshift64* */
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+static int
+cmp_double(const void *v1, const void *v2)
+{
+	double x1 = *(const double *)v1;
+	double x2 = *(const double *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+/* Running mean and variance (Welford). */
+typedef struct {
+	double n, mean, m2;
+} welford;
+
+static void
+welford_add(welford *w, double x)
+{
+	w->n += 1.0;
+	double d = x - w->mean;
+	w->mean += d / w->n;
+	w->m2 += d * (x - w->mean);
+}
+
+static double
+welch_t(const welford *a, const welford *b)
+{
+	if (a->n < 2.0 || b->n < 2.0) {
+		return 0.0;
+	}
+	double va = a->m2 / (a->n - 1.0);
+	double vb = b->m2 / (b->n - 1.0);
+	double den = sqrt(va / a->n + vb / b->n);
+	if (den == 0.0) {
+		/* No variance at all: any difference is a leak. */
+		return a->mean == b->mean ? 0.0 : INFINITY;
+	}
+	return (a->mean - b->mean) / den;
+}
+
+int
+bench_ct_run(const bench_ct_desc *d, const bench_ct_opts *opt,
+	bench_ct_result *res)
+{
+	static const double crops[] = { 1.0, 0.99, 0.9, 0.75, 0.5 };
+	enum { NUM_CROPS = sizeof crops / sizeof crops[0] };
+
+	memset(res, 0, sizeof *res);
+	res->desc = d;
+	res->crop = 1.0;
+	unsigned nc = d->num_classes;
+	if (nc < 2 || nc > BENCH_CT_MAX_CLASSES
+		|| opt->samples == 0 || opt->iters == 0)
+	{
+		return -1;
+	}
+	size_t n = opt->samples;
+	bench_arena ar;
+	if (bench_arena_init(&ar, n, 1,
+		opt->huge_pages ? BENCH_ARENA_HUGE : 0) < 0)
+	{
+		return -1;
+	}
+	void *ctx = calloc(1, d->ctx_len > 0 ? d->ctx_len : 1);
+	double *v = malloc(n * sizeof *v);
+	unsigned char *cls = malloc(n);
+	double *tmp = malloc(n * sizeof *tmp);
+	if (ctx == NULL || v == NULL || cls == NULL || tmp == NULL) {
+		bench_arena_free(&ar);
+		free(ctx);
+		free(v);
+		free(cls);
+		free(tmp);
+		return -1;
+	}
+
+	uint64_t rng = opt->seed | 1;
+	double scale = 1.0 / (double)opt->iters;
+	int err = 0;
+	for (size_t i = 0; i < n; i ++) {
+		unsigned c = (unsigned)((next_rand(&rng) >> 32) % nc);
+		if (d->prepare(ctx, c, next_rand(&rng)) != 0) {
+			err = 1;
+			break;
+		}
+		uint64_t begin = core_cycles();
+		d->kernel(ctx, opt->iters);
+		uint64_t end = core_cycles();
+		size_t k = bench_arena_record(&ar, begin, end,
+			cyc_current_cpu());
+		ar.aux[0][k] = c;
+		if (d->check != NULL) {
+			res->check ^= d->check(ctx);
+		}
+	}
+	for (size_t i = 0; i < ar.num; i ++) {
+		v[i] = (double)(ar.end[i] - ar.begin[i]) * scale;
+		cls[i] = (unsigned char)ar.aux[0][i];
+	}
+	bench_arena_free(&ar);
+	if (err) {
+		free(ctx);
+		free(v);
+		free(cls);
+		free(tmp);
+		return -1;
+	}
+
+	/* Per-class medians. */
+	for (unsigned c = 0; c < nc; c ++) {
+		size_t k = 0;
+		for (size_t i = 0; i < n; i ++) {
+			if (cls[i] == c) {
+				tmp[k ++] = v[i];
+			}
+		}
+		res->n[c] = k;
+		if (k > 0) {
+			qsort(tmp, k, sizeof *tmp, &cmp_double);
+			res->median[c] = tmp[k / 2];
+		}
+	}
+
+	/* Cropping thresholds, from the pooled distribution. */
+	memcpy(tmp, v, n * sizeof *tmp);
+	qsort(tmp, n, sizeof *tmp, &cmp_double);
+	double limit[NUM_CROPS];
+	for (int j = 0; j < NUM_CROPS; j ++) {
+		size_t k = (size_t)(crops[j] * (double)n);
+		limit[j] = crops[j] >= 1.0 ? INFINITY : tmp[k < n ? k : n - 1];
+	}
+
+	welford w[NUM_CROPS][BENCH_CT_MAX_CLASSES];
+	memset(w, 0, sizeof w);
+	for (size_t i = 0; i < n; i ++) {
+		for (int j = 0; j < NUM_CROPS; j ++) {
+			if (v[i] <= limit[j]) {
+				welford_add(&w[j][cls[i]], v[i]);
+			}
+		}
+	}
+	res->cls = 1;
+	for (int j = 0; j < NUM_CROPS; j ++) {
+		for (unsigned c = 1; c < nc; c ++) {
+			double t = fabs(welch_t(&w[j][c], &w[j][0]));
+			if (t > res->t) {
+				res->t = t;
+				res->cls = c;
+				res->crop = crops[j];
+			}
+		}
+	}
+	res->leak = res->t > opt->threshold;
+
+	free(ctx);
+	free(v);
+	free(cls);
+	free(tmp);
+	return 0;
+}
+
+static const char *
+class_name(const bench_ct_desc *d, unsigned c, char *buf, size_t len)
+{
+	if (d->class_names != NULL && d->class_names[c] != NULL) {
+		return d->class_names[c];
+	}
+	snprintf(buf, len, "class %u", c);
+	return buf;
+}
+
+void
+bench_ct_print(FILE *out, const bench_ct_result *res)
+{
+	const bench_ct_desc *d = res->desc;
+	char b1[32], b2[32];
+	fprintf(out, "%-16s %s  max |t| = %.2f (%s vs %s",
+		d->name, res->leak ? "LEAK" : "ok  ", res->t,
+		class_name(d, res->cls, b1, sizeof b1),
+		class_name(d, 0, b2, sizeof b2));
+	if (res->crop < 1.0) {
+		fprintf(out, ", below p%.0f", res->crop * 100.0);
+	}
+	fprintf(out, ")\n");
+	for (unsigned c = 0; c < d->num_classes; c ++) {
+		fprintf(out, "  %-14s median %9.3f  (%zu samples)\n",
+			class_name(d, c, b1, sizeof b1),
+			res->median[c], res->n[c]);
+	}
+}
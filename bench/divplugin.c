@@ -0,0 +1,86 @@
+/*
+ * Example benchmark plugin: latency of 64-bit integer divisions, which
+ * on many CPUs depends on the size of the operands. Load it with
+ * "bench -L bench/divplugin.so"; "bench -t -L bench/divplugin.so div64"
+ * runs the constant-time test, with small and large dividends.
+ *
+ * Each iteration performs 8 dependent divisions x = x / d + x0; with
+ * d >= 2 the dividend stays close to x0 * d / (d - 1), so that its size
+ * is set by x0.
+ */
+
+#include "bench.h"
+
+typedef struct {
+	uint64_t x, x0, d;
+} div64_ctx;
+
+static int
+div64_setup(void *ctx, uint64_t seed)
+{
+	div64_ctx *c = ctx;
+	/* Same operand classes as the multiplication benchmarks: 0 and 1
+	   give small dividends, other seeds large ones. */
+	c->x0 = seed <= 1 ? seed + 1 : (seed * 0x9E3779B97F4A7C15) >> 2;
+	c->x = c->x0;
+	c->d = 3;
+	return 0;
+}
+
+static void
+div64_kernel(void *ctx, uint64_t iters)
+{
+	div64_ctx *c = ctx;
+	uint64_t x = c->x;
+	uint64_t x0 = c->x0;
+	uint64_t d = c->d;
+	for (uint64_t j = 0; j < iters; j ++) {
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+		x = x / d + x0;
+	}
+	c->x = x;
+}
+
+static uint64_t
+div64_check(const void *ctx)
+{
+	const div64_ctx *c = ctx;
+	return c->x;
+}
+
+static const char *const div64_classes[] = { "small", "large" };
+
+static int
+div64_prepare(void *ctx, unsigned cls, uint64_t rnd)
+{
+	div64_ctx *c = ctx;
+	c->x0 = cls == 0 ? (rnd & 0xFF) + 1 : (rnd >> 2) | (1ull << 61);
+	c->x = c->x0;
+	c->d = 3 + ((rnd >> 8) & 0x0F);
+	return 0;
+}
+
+static const bench_desc bench_div64 = {
+	"div64", sizeof(div64_ctx),
+	&div64_setup, &div64_kernel, &div64_check, 8.0
+};
+
+static const bench_ct_desc ct_div64 = {
+	"div64", sizeof(div64_ctx), 2, div64_classes,
+	&div64_prepare, &div64_kernel, &div64_check
+};
+
+static const bench_desc *const benches[] = { &bench_div64 };
+static const bench_ct_desc *const cts[] = { &ct_div64 };
+
+const bench_plugin bench_plugin_table = {
+	BENCH_PLUGIN_ABI,
+	benches, sizeof benches / sizeof benches[0],
+	cts, sizeof cts / sizeof cts[0]
+};
@@ -0,0 +1,302 @@
+/*
+ * Benchmark harness: machine fingerprint and system information.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+#if defined __i386__ || defined __x86_64__
+#include <cpuid.h>
+#endif
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+/*
+ * Compilation flags, as given by the Makefile; only the compiler version
+ * is known otherwise.
+ */
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS   ""
+#endif
+
+void
+bench_read_line(const char *path, char *dst, size_t len)
+{
+	dst[0] = 0;
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return;
+	}
+	if (fgets(dst, (int)len, f) != NULL) {
+		dst[strcspn(dst, "\n")] = 0;
+	} else {
+		dst[0] = 0;
+	}
+	fclose(f);
+}
+
+int
+bench_cpu_list_parse(const char *s, unsigned char *set, int max)
+{
+	memset(set, 0, (size_t)max);
+	int num = 0;
+	const char *p = s;
+	while (*p != 0 && *p != '\n') {
+		char *end;
+		long lo = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		long hi = lo;
+		p = end;
+		if (*p == '-') {
+			hi = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long i = lo; i <= hi; i ++) {
+			num ++;
+			if (i >= 0 && i < max) {
+				set[i] = 1;
+			}
+		}
+		if (*p == ',') {
+			p ++;
+		}
+	}
+	return num;
+}
+
+int
+bench_cpu_list(const char *path, unsigned char *set, int max)
+{
+	memset(set, 0, (size_t)max);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	char buf[1024];
+	int num = 0;
+	if (fgets(buf, sizeof buf, f) != NULL) {
+		num = bench_cpu_list_parse(buf, set, max);
+	}
+	fclose(f);
+	return num;
+}
+
+/*
+ * Get the value of the first field with the given name in /proc/cpuinfo.
+ */
+static void
+cpuinfo_field(const char *key, char *dst, size_t len)
+{
+	dst[0] = 0;
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if (f == NULL) {
+		return;
+	}
+	char line[256];
+	size_t kl = strlen(key);
+	while (fgets(line, sizeof line, f) != NULL) {
+		if (strncmp(line, key, kl) != 0
+			|| (line[kl] != ' ' && line[kl] != '\t' && line[kl] != ':'))
+		{
+			continue;
+		}
+		char *p = strchr(line, ':');
+		if (p == NULL) {
+			continue;
+		}
+		p ++;
+		while (*p == ' ' || *p == '\t') {
+			p ++;
+		}
+		p[strcspn(p, "\n")] = 0;
+		snprintf(dst, len, "%s", p);
+		break;
+	}
+	fclose(f);
+}
+
+/*
+ * CPU identification from the hardware: CPUID vendor, family, model and
+ * stepping on x86; MIDR_EL1 on ARM (as exposed by the kernel); marchid
+ * and mimpid on RISC-V (only known through /proc/cpuinfo).
+ */
+static void
+cpu_id(int cpu, char *dst, size_t len)
+{
+	dst[0] = 0;
+#if defined __i386__ || defined __x86_64__
+	(void)cpu;
+	unsigned a, b, c, d;
+	if (!__get_cpuid(0, &a, &b, &c, &d)) {
+		return;
+	}
+	char vendor[13];
+	memcpy(vendor, &b, 4);
+	memcpy(vendor + 4, &d, 4);
+	memcpy(vendor + 8, &c, 4);
+	vendor[12] = 0;
+	if (!__get_cpuid(1, &a, &b, &c, &d)) {
+		snprintf(dst, len, "%s", vendor);
+		return;
+	}
+	/* Display family and model, as documented by both vendors. */
+	unsigned family = (a >> 8) & 0x0F;
+	unsigned model = (a >> 4) & 0x0F;
+	if (family == 0x0F) {
+		family += (a >> 20) & 0xFF;
+	}
+	if (family == 0x06 || family >= 0x0F) {
+		model |= ((a >> 16) & 0x0F) << 4;
+	}
+	snprintf(dst, len, "%s %u-%u-%u", vendor, family, model, a & 0x0F);
+#else
+	char path[96], buf[64];
+	snprintf(path, sizeof path,
+		"/sys/devices/system/cpu/cpu%d/regs/identification/midr_el1",
+		cpu < 0 ? 0 : cpu);
+	bench_read_line(path, buf, sizeof buf);
+	if (buf[0] != 0) {
+		snprintf(dst, len, "midr %s", buf);
+		return;
+	}
+	char arch[32], imp[32];
+	cpuinfo_field("marchid", arch, sizeof arch);
+	cpuinfo_field("mimpid", imp, sizeof imp);
+	if (arch[0] != 0 || imp[0] != 0) {
+		snprintf(dst, len, "marchid %s mimpid %s", arch, imp);
+	}
+#endif
+}
+
+void
+bench_fingerprint_get(bench_fingerprint *fp, int cpu)
+{
+	memset(fp, 0, sizeof *fp);
+	if (cpu < 0) {
+		uint32_t c = cyc_current_cpu();
+		cpu = c == CYC_CPU_UNKNOWN ? -1 : (int)c;
+	}
+	fp->cpu = cpu;
+	cyc_cpu_model(fp->cpu_model, sizeof fp->cpu_model);
+	cpu_id(cpu, fp->cpu_id, sizeof fp->cpu_id);
+	bench_core_type(cpu, fp->core_type, sizeof fp->core_type);
+
+	/* "control" tells whether SMT is enabled (on, off, forceoff,
+	   notsupported...); "active" only whether siblings are online. */
+	bench_read_line("/sys/devices/system/cpu/smt/control",
+		fp->smt, sizeof fp->smt);
+	if (fp->smt[0] == 0) {
+		char buf[8];
+		bench_read_line("/sys/devices/system/cpu/smt/active",
+			buf, sizeof buf);
+		if (buf[0] != 0) {
+			snprintf(fp->smt, sizeof fp->smt, "%s",
+				buf[0] == '1' ? "on" : "off");
+		}
+	}
+
+	char path[96];
+	if (cpu >= 0) {
+		snprintf(path, sizeof path,
+			"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+			cpu);
+		bench_read_line(path, fp->governor, sizeof fp->governor);
+	}
+	snprintf(fp->backend, sizeof fp->backend, "%s", CORE_CYCLES_BACKEND);
+
+	struct utsname u;
+	if (uname(&u) == 0) {
+		snprintf(fp->kernel, sizeof fp->kernel, "%s", u.release);
+	}
+	if (cpu >= 0) {
+		snprintf(path, sizeof path,
+			"/sys/devices/system/cpu/cpu%d/microcode/version", cpu);
+		bench_read_line(path, fp->microcode, sizeof fp->microcode);
+	}
+	if (fp->microcode[0] == 0) {
+		cpuinfo_field("microcode", fp->microcode, sizeof fp->microcode);
+	}
+	snprintf(fp->compiler, sizeof fp->compiler, "%s%s%s", __VERSION__,
+		BENCH_CFLAGS[0] != 0 ? " " : "", BENCH_CFLAGS);
+}
+
+void
+bench_fingerprint_id(const bench_fingerprint *fp, char *dst, size_t len)
+{
+	/* FNV-1a over the machine fields, separated by newlines. */
+	uint64_t h = 0xCBF29CE484222325ull;
+	const char *parts[] = {
+		fp->cpu_model, fp->cpu_id, fp->core_type,
+		fp->smt, fp->governor, fp->backend
+	};
+	for (size_t i = 0; i < sizeof parts / sizeof parts[0]; i ++) {
+		for (const char *p = parts[i]; *p != 0; p ++) {
+			h = (h ^ (unsigned char)*p) * 0x100000001B3ull;
+		}
+		h = (h ^ '\n') * 0x100000001B3ull;
+	}
+	snprintf(dst, len, "%016llx", (unsigned long long)h);
+}
+
+void
+bench_machine_id(char *dst, size_t len)
+{
+	bench_fingerprint fp;
+	bench_fingerprint_get(&fp, -1);
+	bench_fingerprint_id(&fp, dst, len);
+}
+
+size_t
+bench_fingerprint_env(const bench_fingerprint *fp, char *dst, size_t len)
+{
+	const char *keys[] = { "kernel", "microcode", "compiler" };
+	const char *vals[] = { fp->kernel, fp->microcode, fp->compiler };
+	size_t n = 0;
+	for (size_t i = 0; i < sizeof keys / sizeof keys[0]; i ++) {
+		const char *k = keys[i];
+		if (i > 0) {
+			if (n + 1 < len) {
+				dst[n] = ';';
+			}
+			n ++;
+		}
+		for (; *k != 0; k ++, n ++) {
+			if (n + 1 < len) {
+				dst[n] = *k;
+			}
+		}
+		if (n + 1 < len) {
+			dst[n] = '=';
+		}
+		n ++;
+		for (const char *v = vals[i]; *v != 0; v ++, n ++) {
+			if (n + 1 < len) {
+				dst[n] = strchr(";=\t\n", *v) != NULL ? ' ' : *v;
+			}
+		}
+	}
+	if (len > 0) {
+		dst[n < len ? n : len - 1] = 0;
+	}
+	return n;
+}
+
+void
+bench_fingerprint_print(FILE *out, const char *prefix,
+	const bench_fingerprint *fp)
+{
+	fprintf(out, "%scpu_model: %s\n", prefix, fp->cpu_model);
+	fprintf(out, "%scpu_id: %s\n", prefix, fp->cpu_id);
+	fprintf(out, "%scpu: %d\n", prefix, fp->cpu);
+	fprintf(out, "%score_type: %s\n", prefix, fp->core_type);
+	fprintf(out, "%ssmt: %s\n", prefix, fp->smt);
+	fprintf(out, "%sgovernor: %s\n", prefix, fp->governor);
+	fprintf(out, "%sbackend: %s\n", prefix, fp->backend);
+	fprintf(out, "%skernel: %s\n", prefix, fp->kernel);
+	fprintf(out, "%smicrocode: %s\n", prefix, fp->microcode);
+	fprintf(out, "%scompiler: %s\n", prefix, fp->compiler);
+}
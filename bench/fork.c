@@ -0,0 +1,186 @@
+/*
+ * Benchmark harness: running benchmarks in forked children.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * What the child sends back: this header, then 'num_samples' doubles.
+ * Parent and child are the same program, so the layout needs no
+ * encoding.
+ */
+typedef struct {
+	int err;
+	int cpu;
+	uint64_t check;
+	uint64_t migrations;
+	uint64_t num_samples;
+	bench_stats stats;
+} child_header;
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	while (len > 0) {
+		ssize_t r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+static int
+read_all(int fd, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	while (len > 0) {
+		ssize_t r = read(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (r == 0) {
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+static void
+child_main(int fd, const bench_desc *b, const bench_opts *opt, int cpu,
+	unsigned flags)
+{
+	if (cpu >= 0) {
+		cpu_set_t one;
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		if (sched_setaffinity(0, sizeof one, &one) < 0) {
+			_exit(EXIT_FAILURE);
+		}
+	}
+	if (flags & BENCH_CHILD_MLOCK) {
+		mlockall(MCL_CURRENT | MCL_FUTURE);
+	}
+	child_header hd;
+	memset(&hd, 0, sizeof hd);
+	bench_result res;
+	if (bench_run(b, opt, &res) < 0) {
+		hd.err = 1;
+		write_all(fd, &hd, sizeof hd);
+		_exit(EXIT_FAILURE);
+	}
+	hd.cpu = res.cpu;
+	hd.check = res.check;
+	hd.migrations = res.migrations;
+	hd.num_samples = res.num_samples;
+	hd.stats = res.stats;
+	if (write_all(fd, &hd, sizeof hd) < 0 || write_all(fd, res.samples,
+		res.num_samples * sizeof *res.samples) < 0)
+	{
+		_exit(EXIT_FAILURE);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+int
+bench_child_start(bench_child *c, const bench_desc *b,
+	const bench_opts *opt, int cpu, unsigned flags)
+{
+	c->desc = b;
+	c->opt = *opt;
+	c->cpu = cpu;
+	c->pid = -1;
+	c->fd = -1;
+	c->status = 0;
+	int p[2];
+	if (pipe(p) < 0) {
+		return -1;
+	}
+	/* Pending output would otherwise be written twice. */
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(p[0]);
+		child_main(p[1], b, opt, cpu, flags);
+	}
+	close(p[1]);
+	c->pid = (int)pid;
+	c->fd = p[0];
+	return 0;
+}
+
+int
+bench_child_finish(bench_child *c, bench_result *res)
+{
+	memset(res, 0, sizeof *res);
+	res->desc = c->desc;
+	res->opt = c->opt;
+	res->cpu = -1;
+	child_header hd;
+	int err = read_all(c->fd, &hd, sizeof hd) < 0 || hd.err
+		|| hd.num_samples == 0
+		|| hd.num_samples > (size_t)-1 / sizeof *res->samples;
+	if (!err) {
+		res->samples = malloc(hd.num_samples * sizeof *res->samples);
+		err = res->samples == NULL || read_all(c->fd, res->samples,
+			hd.num_samples * sizeof *res->samples) < 0;
+	}
+	close(c->fd);
+	c->fd = -1;
+	while (waitpid((pid_t)c->pid, &c->status, 0) < 0) {
+		if (errno != EINTR) {
+			err = 1;
+			break;
+		}
+	}
+	c->pid = -1;
+	if (err || !WIFEXITED(c->status)
+		|| WEXITSTATUS(c->status) != EXIT_SUCCESS)
+	{
+		bench_result_free(res);
+		return -1;
+	}
+	res->num_samples = (size_t)hd.num_samples;
+	res->stats = hd.stats;
+	res->check = hd.check;
+	res->cpu = hd.cpu;
+	res->migrations = (size_t)hd.migrations;
+	return 0;
+}
+
+int
+bench_run_forked(const bench_desc *b, const bench_opts *opt, int cpu,
+	unsigned flags, bench_result *res)
+{
+	bench_child c;
+	if (bench_child_start(&c, b, opt, cpu, flags) < 0) {
+		memset(res, 0, sizeof *res);
+		return -1;
+	}
+	return bench_child_finish(&c, res);
+}
@@ -0,0 +1,280 @@
+/*
+ * Built-in benchmarks: latency of integer multiplications, as measured
+ * by test_cycle.c, expressed as harness kernels. The seed plays the role
+ * of the test_cycle argument: 0 and 1 exercise special cases (values for
+ * which a variable-time multiplier is likely to return early), while 3
+ * yields more-or-less pseudorandom values.
+ *
+ * The same kernels serve as constant-time tests, with two input classes:
+ * operands equal to 1 (which stay 1), and large random operands.
+ */
+
+#include "bench.h"
+
+typedef struct {
+	uint32_t x, y;
+} mul32_ctx;
+
+static int
+mul32_setup(void *ctx, uint64_t seed)
+{
+	mul32_ctx *c = ctx;
+	uint32_t x32 = (uint32_t)seed;
+	uint32_t y32 = x32;
+	for (int i = 0; i < 100; i ++) {
+		y32 *= x32;
+	}
+	c->x = y32;
+	c->y = y32;
+	return 0;
+}
+
+static void
+mul32_kernel(void *ctx, uint64_t iters)
+{
+	mul32_ctx *c = ctx;
+	uint32_t x32 = c->x;
+	uint32_t y32 = c->y;
+	for (uint64_t j = 0; j < iters; j ++) {
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+		x32 *= y32;
+		y32 *= x32;
+	}
+	c->x = x32;
+	c->y = y32;
+}
+
+static uint64_t
+mul32_check(const void *ctx)
+{
+	const mul32_ctx *c = ctx;
+	return c->x;
+}
+
+typedef struct {
+	uint64_t x, y;
+} mul64_ctx;
+
+static int
+mul64_setup(void *ctx, uint64_t seed)
+{
+	mul64_ctx *c = ctx;
+	mul32_ctx c32;
+	mul32_setup(&c32, seed);
+	uint64_t x64 = c32.x;
+	x64 *= x64 * x64;
+	c->x = x64;
+	c->y = x64;
+	return 0;
+}
+
+static void
+mul64_kernel(void *ctx, uint64_t iters)
+{
+	mul64_ctx *c = ctx;
+	uint64_t x64 = c->x;
+	uint64_t y64 = c->y;
+	for (uint64_t j = 0; j < iters; j ++) {
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+		x64 *= y64;
+		y64 *= x64;
+	}
+	c->x = x64;
+	c->y = y64;
+}
+
+static uint64_t
+mul64_check(const void *ctx)
+{
+	const mul64_ctx *c = ctx;
+	return c->x;
+}
+
+static const char *const ct_classes[] = { "one", "random" };
+
+static int
+mul32_prepare(void *ctx, unsigned cls, uint64_t rnd)
+{
+	mul32_ctx *c = ctx;
+	if (cls == 0) {
+		c->x = 1;
+		c->y = 1;
+	} else {
+		c->x = (uint32_t)rnd | 0x80000001;
+		c->y = (uint32_t)(rnd >> 32) | 0x80000001;
+	}
+	return 0;
+}
+
+static int
+mul64_prepare(void *ctx, unsigned cls, uint64_t rnd)
+{
+	mul64_ctx *c = ctx;
+	if (cls == 0) {
+		c->x = 1;
+		c->y = 1;
+	} else {
+		c->x = rnd | 0x8000000000000001;
+		c->y = ((rnd << 32) | (rnd >> 32)) | 0x8000000000000001;
+	}
+	return 0;
+}
+
+static const bench_desc bench_mul32 = {
+	"mul32", sizeof(mul32_ctx),
+	&mul32_setup, &mul32_kernel, &mul32_check, 20.0
+};
+
+static const bench_desc bench_mul64 = {
+	"mul64", sizeof(mul64_ctx),
+	&mul64_setup, &mul64_kernel, &mul64_check, 20.0
+};
+
+static const bench_ct_desc ct_mul32 = {
+	"mul32", sizeof(mul32_ctx), 2, ct_classes,
+	&mul32_prepare, &mul32_kernel, &mul32_check
+};
+
+static const bench_ct_desc ct_mul64 = {
+	"mul64", sizeof(mul64_ctx), 2, ct_classes,
+	&mul64_prepare, &mul64_kernel, &mul64_check
+};
+
+#if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
+
+typedef struct {
+	uint64_t x, y;
+	uint64_t xorig, yorig;
+} mul128_ctx;
+
+static int
+mul128_setup(void *ctx, uint64_t seed)
+{
+	mul128_ctx *c = ctx;
+	mul64_ctx c64;
+	mul64_setup(&c64, seed);
+	/* As in test_cycle: we really measure latency to access to the
+	   upper half of the result; to avoid the value becoming too
+	   small, the top bit is set (unless the source was 0 or 1). */
+	uint64_t t64 = (uint64_t)((c64.y >> 1) != 0) << 63;
+	c->x = c64.x | t64;
+	c->y = c64.y | t64;
+	c->xorig = c->x;
+	c->yorig = c->y;
+	return 0;
+}
+
+static void
+mul128_kernel(void *ctx, uint64_t iters)
+{
+	mul128_ctx *c = ctx;
+	uint64_t x64 = c->x;
+	uint64_t y64 = c->y;
+	uint64_t x64orig = c->xorig;
+	uint64_t y64orig = c->yorig;
+	for (uint64_t j = 0; j < iters; j ++) {
+		x64 ^= x64orig;
+		y64 ^= y64orig;
+		x64 = ((unsigned __int128)x64 * y64) >> 64;
+		y64 = ((unsigned __int128)y64 * x64) >> 64;
+		x64 = ((unsigned __int128)x64 * y64) >> 64;
+		y64 = ((unsigned __int128)y64 * x64) >> 64;
+		x64 = ((unsigned __int128)x64 * y64) >> 64;
+		y64 = ((unsigned __int128)y64 * x64) >> 64;
+		x64 = ((unsigned __int128)x64 * y64) >> 64;
+		y64 = ((unsigned __int128)y64 * x64) >> 64;
+	}
+	c->x = x64;
+	c->y = y64;
+}
+
+static uint64_t
+mul128_check(const void *ctx)
+{
+	const mul128_ctx *c = ctx;
+	return c->x;
+}
+
+static int
+mul128_prepare(void *ctx, unsigned cls, uint64_t rnd)
+{
+	mul128_ctx *c = ctx;
+	if (cls == 0) {
+		c->x = 1;
+		c->y = 1;
+	} else {
+		c->x = rnd | 0x8000000000000000;
+		c->y = ((rnd << 32) | (rnd >> 32)) | 0x8000000000000000;
+	}
+	c->xorig = c->x;
+	c->yorig = c->y;
+	return 0;
+}
+
+static const bench_desc bench_mul128 = {
+	"mul128", sizeof(mul128_ctx),
+	&mul128_setup, &mul128_kernel, &mul128_check, 8.0
+};
+
+static const bench_ct_desc ct_mul128 = {
+	"mul128", sizeof(mul128_ctx), 2, ct_classes,
+	&mul128_prepare, &mul128_kernel, &mul128_check
+};
+
+#endif
+
+const bench_desc *const bench_builtin[] = {
+	&bench_mul32,
+	&bench_mul64,
+#if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
+	&bench_mul128,
+#endif
+};
+
+const size_t bench_builtin_count =
+	sizeof bench_builtin / sizeof bench_builtin[0];
+
+const bench_ct_desc *const bench_ct_builtin[] = {
+	&ct_mul32,
+	&ct_mul64,
+#if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
+	&ct_mul128,
+#endif
+};
+
+const size_t bench_ct_builtin_count =
+	sizeof bench_ct_builtin / sizeof bench_ct_builtin[0];
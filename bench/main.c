@@ -0,0 +1,582 @@
+/*
+ * bench: run the built-in benchmarks, and optionally check them against
+ * cycle budgets.
+ *
+ * Usage: bench [ -s seed ] [ -a ] [ -b budgets ] [ -t ]
+ *              [ -f text|json|csv ] [ -o file ] [ -r ]
+ *              [ -S store ] [ -B build ] [ -M machine ]
+ *              [ -p ] [ -P min-score ] [ -i cpu ] [ -n ] [ -R root ]
+ *              [ -H ] [ -F ] [ -j cpus|auto ] [ -C ] [ -T seconds ]
+ *              [ -K cache ] [ -A max-age ] [ -L plugin ]... [ pattern... ]
+ *
+ * Benchmarks whose name matches one of the patterns (shell wildcards)
+ * are run; all are run if no pattern is given. The median cost per
+ * operation, in cycles, is printed after each benchmark, with the spread
+ * of the samples. -a enables adaptive sampling (more samples until the
+ * median is known within 1%). -b loads a budget file (see bench.h) and
+ * implies -a; each benchmark is then checked against the budget that
+ * matches the current CPU model, and the exit status is non-zero if any
+ * benchmark exceeds its budget.
+ *
+ * With -t, the constant-time tests are run instead of the benchmarks;
+ * for each, the largest t-statistic and the per-class medians are
+ * printed, and the exit status is non-zero if a leak is detected.
+ *
+ * -f selects the output format of the benchmark results (see
+ * bench_output_begin()); -o writes them into a file instead of standard
+ * output; -r includes the raw samples in JSON and CSV output. With JSON
+ * or CSV on standard output, all other messages go to standard error.
+ *
+ * -S appends the results to a result store (see bench.h), under the
+ * build identifier given with -B (default: BENCH_BUILD_ID, which the
+ * Makefile sets to the git revision of the tree; -S without any build
+ * identifier is an error, so that different builds are never mixed) and
+ * the machine identifier given with -M (default: the identifier of the
+ * fingerprint of the CPU that ran each benchmark, see
+ * bench_fingerprint_id()). The benchcmp tool compares two builds from a
+ * store.
+ *
+ * -p prints a preflight report on the measurement environment (see
+ * bench_preflight_run()) before running; -P also refuses to run if the
+ * environment score is below the given minimum.
+ *
+ * -i runs the benchmarks in an isolation session on the given CPU (see
+ * bench_session_begin()): pinned, with interrupts steered away, at
+ * real-time priority and with memory locked; this needs privileges. -n
+ * only prints the changes that the session would make. -R takes the
+ * /proc and /sys files from another root directory, for testing the
+ * preflight checks and the session against a fake tree.
+ *
+ * -H backs the sample buffers with huge pages (see bench_arena_init()).
+ * -F runs each benchmark in a freshly forked child (see
+ * bench_child_start()), pinned to the session CPU with -i, or else to
+ * the CPU on which bench started.
+ *
+ * -j runs the benchmarks in parallel, each in a forked child, on the
+ * listed CPUs (e.g. "2-5,8"; all must be online and allowed), or with
+ * "auto" on the isolated CPUs (all allowed CPUs if none is isolated);
+ * see bench_run_parallel(). Only one hardware thread per core is used,
+ * and with -C only one CPU per cluster (CPUs sharing an L2 cache). -j
+ * cannot be combined with -i.
+ *
+ * -T runs the benchmarks within a total time budget, in seconds: after
+ * a short pilot run of each, the remaining time is spread over them
+ * according to their cost and noise (see bench_run_timed()), instead of
+ * a fixed number of samples. -T cannot be combined with -F or -j.
+ *
+ * -K keeps the results in a cache file (see bench_cache_open()), keyed
+ * by the machine code of each benchmark, the run parameters and the
+ * fingerprint of the CPU that runs it (see bench_cache_key()): a
+ * benchmark whose cached result is at most max-age seconds old (-A,
+ * default one day) is not measured again. Benchmarks whose code cannot
+ * be located (e.g. in a stripped binary) are measured each time, with a
+ * note. -K cannot be combined with -j or -T.
+ *
+ * -L loads the benchmarks and constant-time tests of a plugin (see
+ * bench_plugin), in addition to the built-in ones; it may be repeated.
+ * Patterns then select among all of them.
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+#ifndef BENCH_BUILD_ID
+#define BENCH_BUILD_ID   NULL
+#endif
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: bench [ -s seed ] [ -a ] [ -b budgets ] [ -t ]\n"
+"             [ -f text|json|csv ] [ -o file ] [ -r ]\n"
+"             [ -S store ] [ -B build ] [ -M machine ]\n"
+"             [ -p ] [ -P min-score ] [ -i cpu ] [ -n ] [ -R root ]\n"
+"             [ -H ] [ -F ] [ -j cpus|auto ] [ -C ] [ -T seconds ]\n"
+"             [ -K cache ] [ -A max-age ] [ -L plugin ]...\n"
+"             [ pattern... ]\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Parse a decimal integer option value in the lo..hi range; anything
+ * else is a usage error.
+ */
+static int
+parse_int(const char *s, int lo, int hi)
+{
+	char *end;
+	errno = 0;
+	long v = strtol(s, &end, 10);
+	if (end == s || *end != 0 || errno != 0 || v < lo || v > hi) {
+		usage();
+	}
+	return (int)v;
+}
+
+static int
+selected(const char *name, int argc, char *argv[])
+{
+	if (argc == 0) {
+		return 1;
+	}
+	for (int i = 0; i < argc; i ++) {
+		if (fnmatch(argv[i], name, 0) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Results are kept in memory until all measurements are done; only then
+ * are they formatted and written, so that output never disturbs the
+ * caches, branch predictors or measuring core between benchmarks.
+ */
+typedef struct {
+	const bench_ct_desc *desc;
+	int err;
+	bench_ct_result res;
+} ct_entry;
+
+/*
+ * Run the selected constant-time tests, then print the results; returns
+ * 1 if any leaks (or could not run), 0 otherwise.
+ */
+static int
+run_ct_tests(const bench_suite *suite, uint64_t seed, int huge_pages,
+	bench_session *sess, int argc, char *argv[])
+{
+	bench_ct_opts opt;
+	bench_ct_opts_init(&opt);
+	opt.seed = seed;
+	opt.huge_pages = huge_pages;
+	ct_entry *runs = calloc(suite->num_ct + 1, sizeof *runs);
+	if (runs == NULL) {
+		return 1;
+	}
+	size_t num = 0;
+	for (size_t i = 0; i < suite->num_ct; i ++) {
+		const bench_ct_desc *d = suite->ct[i];
+		if (!selected(d->name, argc, argv)) {
+			continue;
+		}
+		ct_entry *e = &runs[num ++];
+		e->desc = d;
+		e->err = bench_ct_run(d, &opt, &e->res) < 0;
+	}
+	if (sess != NULL) {
+		bench_session_end(sess);
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < num; i ++) {
+		ct_entry *e = &runs[i];
+		if (e->err) {
+			fprintf(stderr, "%s: could not run\n", e->desc->name);
+			failed = 1;
+			continue;
+		}
+		bench_ct_print(stdout, &e->res);
+		failed |= e->res.leak;
+	}
+	free(runs);
+	return failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_opts opt;
+	bench_opts_init(&opt);
+	const char *budget_path = NULL;
+	const char *out_path = NULL;
+	int format = BENCH_FMT_TEXT;
+	int raw = 0;
+	int ct = 0;
+	const char *store_path = NULL;
+	const char *build = BENCH_BUILD_ID;
+	char machine[64] = "";
+	int preflight = 0;
+	int min_score = -1;
+	bench_session_opts so;
+	bench_session_opts_init(&so);
+	int isolate = 0;
+	int fork_each = 0;
+	const char *parallel = NULL;
+	unsigned pick_flags = 0;
+	double budget_time = 0.0;
+	const char *cache_path = NULL;
+	int64_t max_age = 86400;
+	bench_suite suite;
+	bench_suite_init(&suite);
+	if (bench_suite_add(&suite, bench_builtin, bench_builtin_count,
+		bench_ct_builtin, bench_ct_builtin_count) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	int opt_c;
+	while ((opt_c = getopt(argc, argv,
+		"s:ab:tf:o:rS:B:M:pP:i:nR:HFj:CT:K:A:L:")) != -1)
+	{
+		switch (opt_c) {
+		case 's':
+			opt.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'a':
+			opt.adaptive = 1;
+			break;
+		case 'b':
+			budget_path = optarg;
+			opt.adaptive = 1;
+			break;
+		case 't':
+			ct = 1;
+			break;
+		case 'f':
+			format = bench_format_parse(optarg);
+			if (format < 0) {
+				usage();
+			}
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		case 'S':
+			store_path = optarg;
+			break;
+		case 'B':
+			build = optarg;
+			break;
+		case 'M':
+			snprintf(machine, sizeof machine, "%s", optarg);
+			break;
+		case 'p':
+			preflight = 1;
+			break;
+		case 'P':
+			preflight = 1;
+			min_score = parse_int(optarg, 0, 100);
+			break;
+		case 'i':
+			isolate = 1;
+			so.cpu = parse_int(optarg, 0, BENCH_MAX_CPUS - 1);
+			break;
+		case 'n':
+			so.dry_run = 1;
+			break;
+		case 'R':
+			so.root = optarg;
+			break;
+		case 'H':
+			opt.huge_pages = 1;
+			break;
+		case 'F':
+			fork_each = 1;
+			break;
+		case 'j':
+			parallel = optarg;
+			break;
+		case 'C':
+			pick_flags |= BENCH_PICK_CLUSTER;
+			break;
+		case 'T':
+			budget_time = atof(optarg);
+			if (budget_time <= 0.0) {
+				usage();
+			}
+			break;
+		case 'K':
+			cache_path = optarg;
+			break;
+		case 'A':
+			max_age = strtoll(optarg, NULL, 0);
+			break;
+		case 'L':
+			if (bench_suite_load(&suite, optarg) < 0) {
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if ((parallel != NULL && isolate) || (budget_time > 0.0
+		&& (parallel != NULL || fork_each)) || (cache_path != NULL
+		&& (parallel != NULL || budget_time > 0.0)))
+	{
+		usage();
+	}
+	if (store_path != NULL && (build == NULL || build[0] == 0)) {
+		fprintf(stderr, "no build identifier for -S: use -B\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* With structured output, human-readable lines go to stderr. */
+	FILE *log = format == BENCH_FMT_TEXT && out_path == NULL
+		? stdout : stderr;
+	if (preflight) {
+		bench_preflight pf;
+		bench_preflight_run(&pf, isolate ? so.cpu : -1, so.root);
+		bench_preflight_print(log, &pf);
+		fflush(log);
+		if (pf.score < min_score) {
+			fprintf(stderr, "environment score %d is below %d,"
+				" not running\n", pf.score, min_score);
+			exit(EXIT_FAILURE);
+		}
+	}
+	bench_session sess;
+	if (isolate) {
+		so.log = log;
+		if (bench_session_begin(&sess, &so) < 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (ct) {
+		return run_ct_tests(&suite, opt.seed, opt.huge_pages,
+			isolate ? &sess : NULL, argc, argv)
+			? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	FILE *out = stdout;
+	if (out_path != NULL) {
+		out = fopen(out_path, "w");
+		if (out == NULL) {
+			perror(out_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	bench_budgets bud = { NULL, 0 };
+	char cpu[128];
+	cyc_cpu_model(cpu, sizeof cpu);
+	if (budget_path != NULL) {
+		if (bench_budgets_load(&bud, budget_path) < 0) {
+			exit(EXIT_FAILURE);
+		}
+		fprintf(log, "cpu: %s (%s)\n", cpu[0] != 0 ? cpu : "unknown",
+			CORE_CYCLES_BACKEND);
+	}
+
+	bench_job *runs = calloc(suite.num_bench + 1, sizeof *runs);
+	if (runs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t num_runs = 0;
+	int child_cpu = -1;
+	unsigned child_flags = 0;
+	if (fork_each) {
+		uint32_t c = cyc_current_cpu();
+		child_cpu = isolate ? sess.opt.cpu
+			: c == CYC_CPU_UNKNOWN ? -1 : (int)c;
+		child_flags = isolate && sess.locked ? BENCH_CHILD_MLOCK : 0;
+	}
+	bench_cache cache;
+	char (*keys)[160] = NULL;
+	unsigned char *no_key = NULL;
+	bench_fingerprint cache_fp;
+	size_t cached = 0;
+	if (cache_path != NULL) {
+		keys = calloc(suite.num_bench + 1, sizeof *keys);
+		no_key = calloc(suite.num_bench + 1, 1);
+		if (keys == NULL || no_key == NULL
+			|| bench_cache_open(&cache, cache_path) < 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+		/* Fingerprint of the CPU on which the benchmarks run. */
+		bench_fingerprint_get(&cache_fp, fork_each ? child_cpu
+			: isolate ? sess.opt.cpu : -1);
+	}
+	for (size_t i = 0; i < suite.num_bench; i ++) {
+		const bench_desc *b = suite.bench[i];
+		if (!selected(b->name, argc, argv)) {
+			continue;
+		}
+		bench_job *e = &runs[num_runs ++];
+		e->desc = b;
+		if (cache_path != NULL && bench_cache_key(b, &opt, &cache_fp,
+			keys[num_runs - 1], sizeof keys[0]) < 0)
+		{
+			/* Reported after the runs. */
+			keys[num_runs - 1][0] = 0;
+			no_key[num_runs - 1] = 1;
+		} else if (cache_path != NULL
+			&& bench_cache_get(&cache, keys[num_runs - 1], max_age,
+			b, &opt, &e->res) == 0)
+		{
+			/* Cached: nothing more to store. */
+			keys[num_runs - 1][0] = 0;
+			cached ++;
+			continue;
+		}
+		if (parallel != NULL || budget_time > 0.0) {
+			continue;
+		} else if (fork_each) {
+			bench_child c;
+			e->err = bench_child_start(&c, b, &opt,
+				child_cpu, child_flags) < 0
+				|| bench_child_finish(&c, &e->res) < 0;
+			e->status = c.status;
+		} else {
+			e->err = bench_run(b, &opt, &e->res) < 0;
+		}
+	}
+	if (parallel != NULL) {
+		unsigned char cand[BENCH_MAX_CPUS];
+		if (strcmp(parallel, "auto") == 0) {
+			bench_cpu_candidates(so.root, cand);
+		} else {
+			/* Children cannot be pinned to CPUs outside of our
+			   affinity mask (or offline): reject them up front. */
+			unsigned char allowed[BENCH_MAX_CPUS];
+			bench_cpu_allowed(allowed);
+			if (strspn(parallel, "0123456789,-") != strlen(parallel)
+				|| bench_cpu_list_parse(parallel, cand,
+				BENCH_MAX_CPUS) <= 0)
+			{
+				fprintf(stderr, "invalid CPU list '%s'\n",
+					parallel);
+				exit(EXIT_FAILURE);
+			}
+			for (int i = 0; i < BENCH_MAX_CPUS; i ++) {
+				if (cand[i] && !allowed[i]) {
+					fprintf(stderr, "CPU %d is offline"
+						" or not allowed\n", i);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+		int cpus[BENCH_MAX_CPUS];
+		int n = bench_cpu_pick(so.root, cand, pick_flags,
+			cpus, BENCH_MAX_CPUS);
+		if (bench_run_parallel(runs, num_runs, &opt, cpus, n, 0) < 0) {
+			fprintf(stderr, "no CPU for parallel runs\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (budget_time > 0.0
+		&& bench_run_timed(runs, num_runs, &opt, budget_time, log) < 0)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	if (isolate) {
+		bench_session_end(&sess);
+	}
+	if (cache_path != NULL) {
+		for (size_t i = 0; i < num_runs; i ++) {
+			if (no_key[i]) {
+				fprintf(stderr, "%s: not cached (code not in"
+					" the symbol tables; stripped?)\n",
+					runs[i].desc->name);
+			}
+		}
+		for (size_t i = 0; i < num_runs; i ++) {
+			if (!runs[i].err && keys[i][0] != 0
+				&& bench_cache_put(&cache, keys[i],
+				&runs[i].res) < 0)
+			{
+				fprintf(stderr, "%s: cannot cache result\n",
+					cache_path);
+				break;
+			}
+		}
+		if (cached > 0) {
+			fprintf(log, "%zu of %zu results taken from %s\n",
+				cached, num_runs, cache_path);
+		}
+		bench_cache_close(&cache);
+		free(keys);
+		free(no_key);
+	}
+
+	bench_output bo;
+	bench_output_begin(&bo, out, format, raw);
+	int failed = 0;
+	int described = 0;
+	uint64_t check = 0;
+	for (size_t i = 0; i < num_runs; i ++) {
+		const bench_desc *b = runs[i].desc;
+		bench_result res = runs[i].res;
+		if (runs[i].err) {
+			if (WIFSIGNALED(runs[i].status)) {
+				fprintf(stderr, "%s: killed by signal %d\n",
+					b->name, WTERMSIG(runs[i].status));
+			} else {
+				fprintf(stderr, "%s: could not run\n", b->name);
+			}
+			failed = 1;
+			continue;
+		}
+		bench_output_result(&bo, &res);
+		check ^= res.check;
+		if (store_path != NULL) {
+			bench_fingerprint fp;
+			bench_fingerprint_get(&fp, res.cpu);
+			char id[64];
+			if (machine[0] != 0) {
+				snprintf(id, sizeof id, "%s", machine);
+			} else {
+				bench_fingerprint_id(&fp, id, sizeof id);
+			}
+			/* Full fingerprint once per run, as a comment. */
+			if ((!described && bench_store_describe(store_path,
+				id, &fp) < 0) || bench_store_append(store_path,
+				&res, id, build, &fp) < 0)
+			{
+				fprintf(stderr, "%s: cannot store result\n",
+					store_path);
+				failed = 1;
+			}
+			described = 1;
+		}
+		if (budget_path != NULL) {
+			fflush(out);
+			switch (bench_assert(&bud, cpu, &res, log)) {
+			case BENCH_PASS:
+				fprintf(log, "  %s: ok\n", b->name);
+				break;
+			case BENCH_FAIL:
+				failed = 1;
+				break;
+			default:
+				fprintf(log, "  %s: no budget\n", b->name);
+				break;
+			}
+		}
+		bench_result_free(&res);
+	}
+	free(runs);
+	bench_suite_free(&suite);
+	bench_output_end(&bo);
+	bench_budgets_free(&bud);
+	if (out != stdout && fclose(out) != 0) {
+		perror(out_path);
+		failed = 1;
+	}
+
+	/* Print some bytes of the final values, so that the compiler
+	   cannot optimize away the computations. */
+	unsigned x = 0;
+	for (int i = 0; i < 8; i ++) {
+		x ^= (unsigned)check;
+		check >>= 8;
+	}
+	fprintf(log, "(%u)\n", x & 0xFF);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/*
+ * Benchmark harness: structured (JSON, CSV) output of results.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+int
+bench_format_parse(const char *name)
+{
+	if (strcmp(name, "text") == 0) {
+		return BENCH_FMT_TEXT;
+	} else if (strcmp(name, "json") == 0) {
+		return BENCH_FMT_JSON;
+	} else if (strcmp(name, "csv") == 0) {
+		return BENCH_FMT_CSV;
+	} else {
+		return -1;
+	}
+}
+
+/*
+ * Check whether 'cpu' is in a CPU list file.
+ */
+static int
+cpu_in_list(const char *path, int cpu)
+{
+	unsigned char set[BENCH_MAX_CPUS];
+	return cpu < BENCH_MAX_CPUS
+		&& bench_cpu_list(path, set, BENCH_MAX_CPUS) > 0 && set[cpu];
+}
+
+void
+bench_core_type(int cpu, char *dst, size_t len)
+{
+	dst[0] = 0;
+	if (cpu < 0) {
+		return;
+	}
+	if (cpu_in_list("/sys/devices/cpu_core/cpus", cpu)) {
+		snprintf(dst, len, "core");
+		return;
+	}
+	if (cpu_in_list("/sys/devices/cpu_atom/cpus", cpu)) {
+		snprintf(dst, len, "atom");
+		return;
+	}
+	char path[96];
+	snprintf(path, sizeof path,
+		"/sys/devices/system/cpu/cpu%d/regs/identification/midr_el1",
+		cpu);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return;
+	}
+	char buf[64];
+	if (fgets(buf, sizeof buf, f) != NULL) {
+		/* Part number: bits 4 to 15 of MIDR_EL1. */
+		unsigned long midr = strtoul(buf, NULL, 16);
+		snprintf(dst, len, "0x%03lx", (midr >> 4) & 0xFFF);
+	}
+	fclose(f);
+}
+
+static void
+json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s != 0; s ++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			fputc('\\', out);
+			fputc(c, out);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/* CSV fields are quoted, with inner quotes doubled. */
+static void
+csv_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s != 0; s ++) {
+		if (*s == '"') {
+			fputc('"', out);
+		}
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+void
+bench_output_begin(bench_output *bo, FILE *out, int format, int raw)
+{
+	bo->out = out;
+	bo->format = format;
+	bo->raw = raw;
+	bo->count = 0;
+	cyc_cpu_model(bo->cpu_model, sizeof bo->cpu_model);
+	switch (format) {
+	case BENCH_FMT_JSON:
+		fprintf(out, "{\n  \"backend\": ");
+		json_string(out, CORE_CYCLES_BACKEND);
+		fprintf(out, ",\n  \"cpu_model\": ");
+		json_string(out, bo->cpu_model);
+		fprintf(out, ",\n  \"results\": [");
+		break;
+	case BENCH_FMT_CSV:
+		fprintf(out, "name,backend,cpu_model,cpu,core_type,"
+			"machine,cpu_id,smt,governor,kernel,microcode,"
+			"compiler,seed,iters,warmup,ops_per_iter,samples,"
+			"min,p10,p25,median,p75,p90,p99,max,mean,stddev,"
+			"ci_lo,ci_hi,migrations%s\n", raw ? ",raw" : "");
+		break;
+	}
+}
+
+void
+bench_output_result(bench_output *bo, const bench_result *res)
+{
+	FILE *out = bo->out;
+	const bench_stats *st = &res->stats;
+	const bench_opts *opt = &res->opt;
+	bench_fingerprint fp;
+	bench_fingerprint_get(&fp, res->cpu);
+	char machine[32];
+	bench_fingerprint_id(&fp, machine, sizeof machine);
+	const char *fp_names[] = {
+		"machine", "cpu_id", "smt", "governor",
+		"kernel", "microcode", "compiler"
+	};
+	const char *fp_values[] = {
+		machine, fp.cpu_id, fp.smt, fp.governor,
+		fp.kernel, fp.microcode, fp.compiler
+	};
+	switch (bo->format) {
+	case BENCH_FMT_JSON:
+		fprintf(out, "%s\n    {\n      \"name\": ",
+			bo->count > 0 ? "," : "");
+		json_string(out, res->desc->name);
+		fprintf(out, ",\n      \"params\": { \"seed\": %llu,"
+			" \"iters\": %llu, \"warmup\": %zu,"
+			" \"ops_per_iter\": %g },\n",
+			(unsigned long long)opt->seed,
+			(unsigned long long)opt->iters, opt->warmup,
+			res->desc->ops_per_iter);
+		fprintf(out, "      \"cpu\": %d,\n      \"core_type\": ",
+			res->cpu);
+		json_string(out, fp.core_type);
+		fprintf(out, ",\n      \"fingerprint\": {");
+		for (size_t i = 0; i < sizeof fp_names / sizeof *fp_names; i ++) {
+			fprintf(out, "%s\n        \"%s\": ",
+				i > 0 ? "," : "", fp_names[i]);
+			json_string(out, fp_values[i]);
+		}
+		fprintf(out, "\n      },\n      \"samples\": %zu,\n", st->n);
+		fprintf(out, "      \"stats\": { \"min\": %.4f, \"p10\": %.4f,"
+			" \"p25\": %.4f, \"median\": %.4f, \"p75\": %.4f,"
+			" \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f,"
+			" \"mean\": %.4f, \"stddev\": %.4f,"
+			" \"ci_lo\": %.4f, \"ci_hi\": %.4f }",
+			st->min, st->p10, st->p25, st->median, st->p75,
+			st->p90, st->p99, st->max, st->mean, st->stddev,
+			st->ci_lo, st->ci_hi);
+		fprintf(out, ",\n      \"migrations\": %zu", res->migrations);
+		if (bo->raw) {
+			fprintf(out, ",\n      \"raw\": [");
+			for (size_t i = 0; i < res->num_samples; i ++) {
+				fprintf(out, "%s%.4f", i > 0 ? ", " : "",
+					res->samples[i]);
+			}
+			fprintf(out, "]");
+		}
+		fprintf(out, "\n    }");
+		break;
+	case BENCH_FMT_CSV:
+		csv_string(out, res->desc->name);
+		fputc(',', out);
+		csv_string(out, CORE_CYCLES_BACKEND);
+		fputc(',', out);
+		csv_string(out, bo->cpu_model);
+		fprintf(out, ",%d,", res->cpu);
+		csv_string(out, fp.core_type);
+		for (size_t i = 0; i < sizeof fp_names / sizeof *fp_names; i ++) {
+			fputc(',', out);
+			csv_string(out, fp_values[i]);
+		}
+		fprintf(out, ",%llu,%llu,%zu,%g,%zu",
+			(unsigned long long)opt->seed,
+			(unsigned long long)opt->iters, opt->warmup,
+			res->desc->ops_per_iter, st->n);
+		fprintf(out, ",%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f"
+			",%.4f,%.4f,%.4f,%.4f",
+			st->min, st->p10, st->p25, st->median, st->p75,
+			st->p90, st->p99, st->max, st->mean, st->stddev,
+			st->ci_lo, st->ci_hi);
+		fprintf(out, ",%zu", res->migrations);
+		if (bo->raw) {
+			/* All samples in one field, separated by spaces. */
+			fprintf(out, ",\"");
+			for (size_t i = 0; i < res->num_samples; i ++) {
+				fprintf(out, "%s%.4f", i > 0 ? " " : "",
+					res->samples[i]);
+			}
+			fputc('"', out);
+		}
+		fputc('\n', out);
+		break;
+	default:
+		bench_print_result(out, res);
+		break;
+	}
+	bo->count ++;
+}
+
+void
+bench_output_end(bench_output *bo)
+{
+	if (bo->format == BENCH_FMT_JSON) {
+		fprintf(bo->out, "\n  ]\n}\n");
+	}
+	fflush(bo->out);
+}
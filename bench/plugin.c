@@ -0,0 +1,107 @@
+/*
+ * Benchmark harness: benchmark suites and plugins.
+ */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+void
+bench_suite_init(bench_suite *s)
+{
+	s->bench = NULL;
+	s->num_bench = 0;
+	s->ct = NULL;
+	s->num_ct = 0;
+}
+
+int
+bench_suite_add(bench_suite *s,
+	const bench_desc *const *bench, size_t num_bench,
+	const bench_ct_desc *const *ct, size_t num_ct)
+{
+	const bench_desc **nb = realloc(s->bench,
+		(s->num_bench + num_bench + 1) * sizeof *nb);
+	if (nb == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	s->bench = nb;
+	const bench_ct_desc **nc = realloc(s->ct,
+		(s->num_ct + num_ct + 1) * sizeof *nc);
+	if (nc == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	s->ct = nc;
+
+	/* Names are keys in budgets, stores and caches. */
+	for (size_t i = 0; i < num_bench; i ++) {
+		for (size_t k = 0; k < s->num_bench; k ++) {
+			if (strcmp(s->bench[k]->name, bench[i]->name) == 0) {
+				fprintf(stderr, "duplicate benchmark '%s'\n",
+					bench[i]->name);
+				return -1;
+			}
+		}
+		s->bench[s->num_bench ++] = bench[i];
+	}
+	for (size_t i = 0; i < num_ct; i ++) {
+		for (size_t k = 0; k < s->num_ct; k ++) {
+			if (strcmp(s->ct[k]->name, ct[i]->name) == 0) {
+				fprintf(stderr, "duplicate constant-time test"
+					" '%s'\n", ct[i]->name);
+				return -1;
+			}
+		}
+		if (ct[i]->num_classes < 2
+			|| ct[i]->num_classes > BENCH_CT_MAX_CLASSES)
+		{
+			fprintf(stderr, "%s: invalid number of classes\n",
+				ct[i]->name);
+			return -1;
+		}
+		s->ct[s->num_ct ++] = ct[i];
+	}
+	return 0;
+}
+
+int
+bench_suite_load(bench_suite *s, const char *path)
+{
+	/* dlopen() searches the library path for names without '/'. */
+	void *h = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (h == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+	const bench_plugin *pl = dlsym(h, BENCH_PLUGIN_SYMBOL);
+	if (pl == NULL) {
+		fprintf(stderr, "%s: no %s\n", path, BENCH_PLUGIN_SYMBOL);
+		dlclose(h);
+		return -1;
+	}
+	if (pl->abi != BENCH_PLUGIN_ABI) {
+		fprintf(stderr, "%s: plugin ABI %u, expected %u\n",
+			path, pl->abi, BENCH_PLUGIN_ABI);
+		dlclose(h);
+		return -1;
+	}
+	if (bench_suite_add(s, pl->bench, pl->num_bench,
+		pl->ct, pl->num_ct) < 0)
+	{
+		fprintf(stderr, "%s: cannot load plugin\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+void
+bench_suite_free(bench_suite *s)
+{
+	free(s->bench);
+	free(s->ct);
+	bench_suite_init(s);
+}
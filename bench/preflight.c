@@ -0,0 +1,349 @@
+/*
+ * Benchmark harness: preflight check of the measurement environment.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+/* Idle states with a larger exit latency (in microseconds) are "deep". */
+#define DEEP_IDLE_LATENCY   20
+
+/* Sibling load (in percent) above which the SMT check warns or fails. */
+#define SMT_LOAD_WARN   5
+#define SMT_LOAD_BAD    25
+
+typedef struct {
+	const char *root;
+	char path[256];
+} pf_ctx;
+
+static const char *
+pf_path(pf_ctx *pc, const char *fmt, int cpu)
+{
+	size_t n = strlen(pc->root);
+	if (n >= sizeof pc->path) {
+		n = sizeof pc->path - 1;
+	}
+	memcpy(pc->path, pc->root, n);
+	snprintf(pc->path + n, sizeof pc->path - n, fmt, cpu);
+	return pc->path;
+}
+
+static void
+pf_read(pf_ctx *pc, const char *fmt, int cpu, char *dst, size_t len)
+{
+	bench_read_line(pf_path(pc, fmt, cpu), dst, len);
+}
+
+static bench_pf_check *
+pf_add(bench_preflight *pf, const char *name, int weight)
+{
+	bench_pf_check *c = &pf->check[pf->num_checks ++];
+	c->name = name;
+	c->weight = weight;
+	c->status = BENCH_PF_NA;
+	c->detail[0] = 0;
+	return c;
+}
+
+static void
+check_governor(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "governor", 20);
+	char gov[32];
+	pf_read(pc, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+		pf->cpu, gov, sizeof gov);
+	if (gov[0] == 0) {
+		snprintf(c->detail, sizeof c->detail, "no cpufreq");
+		return;
+	}
+	c->status = strcmp(gov, "performance") == 0
+		? BENCH_PF_OK : BENCH_PF_BAD;
+	snprintf(c->detail, sizeof c->detail, "%s", gov);
+}
+
+static void
+check_boost(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "boost", 20);
+	char buf[8];
+	pf_read(pc, "/sys/devices/system/cpu/intel_pstate/no_turbo", 0,
+		buf, sizeof buf);
+	if (buf[0] != 0) {
+		int on = buf[0] == '0';
+		c->status = on ? BENCH_PF_BAD : BENCH_PF_OK;
+		snprintf(c->detail, sizeof c->detail, "turbo %s (no_turbo=%s)",
+			on ? "enabled" : "disabled", buf);
+		return;
+	}
+	pf_read(pc, "/sys/devices/system/cpu/cpufreq/boost", 0,
+		buf, sizeof buf);
+	if (buf[0] != 0) {
+		int on = buf[0] != '0';
+		c->status = on ? BENCH_PF_BAD : BENCH_PF_OK;
+		snprintf(c->detail, sizeof c->detail, "boost %s",
+			on ? "enabled" : "disabled");
+		return;
+	}
+	snprintf(c->detail, sizeof c->detail, "no boost control");
+}
+
+/*
+ * Sum the busy and total times (from /proc/stat) of the CPUs in 'set'.
+ * Returns -1 if the file cannot be read.
+ */
+static int
+cpu_times(pf_ctx *pc, const unsigned char *set,
+	unsigned long long *busy, unsigned long long *total)
+{
+	*busy = 0;
+	*total = 0;
+	FILE *f = fopen(pf_path(pc, "/proc/stat", 0), "r");
+	if (f == NULL) {
+		return -1;
+	}
+	char line[512];
+	while (fgets(line, sizeof line, f) != NULL) {
+		int cpu;
+		int off;
+		/* "%d" would skip the blanks after the aggregate "cpu". */
+		if (strncmp(line, "cpu", 3) != 0
+			|| !isdigit((unsigned char)line[3])
+			|| sscanf(line, "cpu%d%n", &cpu, &off) != 1
+			|| cpu < 0 || cpu >= BENCH_MAX_CPUS || !set[cpu])
+		{
+			continue;
+		}
+		/* user nice system idle iowait irq softirq steal */
+		unsigned long long v[8] = { 0 };
+		char *p = line + off;
+		for (int i = 0; i < 8; i ++) {
+			v[i] = strtoull(p, &p, 10);
+		}
+		for (int i = 0; i < 8; i ++) {
+			*total += v[i];
+		}
+		*busy += v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+	}
+	fclose(f);
+	return 0;
+}
+
+static void
+check_smt(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "smt", 20);
+	char ctl[16];
+	pf_read(pc, "/sys/devices/system/cpu/smt/control", 0, ctl, sizeof ctl);
+	if (strcmp(ctl, "off") == 0 || strcmp(ctl, "forceoff") == 0
+		|| strcmp(ctl, "notsupported") == 0)
+	{
+		c->status = BENCH_PF_OK;
+		snprintf(c->detail, sizeof c->detail, "SMT %s", ctl);
+		return;
+	}
+	unsigned char set[BENCH_MAX_CPUS];
+	int n = bench_cpu_list(pf_path(pc,
+		"/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		pf->cpu), set, BENCH_MAX_CPUS);
+	if (n < 0) {
+		snprintf(c->detail, sizeof c->detail, "no topology");
+		return;
+	}
+	if (pf->cpu < BENCH_MAX_CPUS) {
+		set[pf->cpu] = 0;
+	}
+	if (n <= 1) {
+		c->status = BENCH_PF_OK;
+		snprintf(c->detail, sizeof c->detail, "no sibling thread");
+		return;
+	}
+
+	unsigned long long b0, t0, b1, t1;
+	if (cpu_times(pc, set, &b0, &t0) < 0) {
+		snprintf(c->detail, sizeof c->detail, "no /proc/stat");
+		return;
+	}
+	struct timespec ts;
+	ts.tv_sec = BENCH_PF_LOAD_MS / 1000;
+	ts.tv_nsec = (long)(BENCH_PF_LOAD_MS % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+	cpu_times(pc, set, &b1, &t1);
+	if (t1 <= t0) {
+		snprintf(c->detail, sizeof c->detail,
+			"SMT on, sibling load unknown");
+		return;
+	}
+	unsigned load = (unsigned)(100 * (b1 - b0) / (t1 - t0));
+	if (load >= SMT_LOAD_BAD) {
+		c->status = BENCH_PF_BAD;
+	} else if (load >= SMT_LOAD_WARN) {
+		c->status = BENCH_PF_WARN;
+	} else {
+		c->status = BENCH_PF_OK;
+	}
+	snprintf(c->detail, sizeof c->detail, "SMT on, siblings %u%% busy",
+		load);
+}
+
+static void
+check_isolation(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "isolation", 15);
+	unsigned char set[BENCH_MAX_CPUS];
+	int cpu = pf->cpu;
+	int ni = bench_cpu_list(pf_path(pc,
+		"/sys/devices/system/cpu/isolated", 0), set, BENCH_MAX_CPUS);
+	int iso = ni > 0 && cpu < BENCH_MAX_CPUS && set[cpu];
+	int nn = bench_cpu_list(pf_path(pc,
+		"/sys/devices/system/cpu/nohz_full", 0), set, BENCH_MAX_CPUS);
+	int nohz = nn > 0 && cpu < BENCH_MAX_CPUS && set[cpu];
+	if (ni < 0 && nn < 0) {
+		snprintf(c->detail, sizeof c->detail, "no isolation info");
+		return;
+	}
+	if (iso && nohz) {
+		c->status = BENCH_PF_OK;
+	} else if (iso || nohz) {
+		c->status = BENCH_PF_WARN;
+	} else {
+		c->status = BENCH_PF_BAD;
+	}
+	snprintf(c->detail, sizeof c->detail, "cpu %d: %s, %s", cpu,
+		iso ? "isolated" : "not isolated",
+		nohz ? "nohz_full" : "ticking");
+}
+
+static void
+check_cpuidle(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "cpuidle", 10);
+	int states = 0;
+	long deepest = -1;
+	char deep_name[32] = "";
+	for (int i = 0;; i ++) {
+		char fmt[96], buf[32];
+		snprintf(fmt, sizeof fmt,
+			"/sys/devices/system/cpu/cpu%%d/cpuidle/state%d/latency",
+			i);
+		pf_read(pc, fmt, pf->cpu, buf, sizeof buf);
+		if (buf[0] == 0) {
+			break;
+		}
+		states ++;
+		long lat = strtol(buf, NULL, 10);
+		snprintf(fmt, sizeof fmt,
+			"/sys/devices/system/cpu/cpu%%d/cpuidle/state%d/disable",
+			i);
+		pf_read(pc, fmt, pf->cpu, buf, sizeof buf);
+		if (buf[0] == '1' || lat <= deepest) {
+			continue;
+		}
+		deepest = lat;
+		snprintf(fmt, sizeof fmt,
+			"/sys/devices/system/cpu/cpu%%d/cpuidle/state%d/name", i);
+		pf_read(pc, fmt, pf->cpu, deep_name, sizeof deep_name);
+	}
+	if (states == 0) {
+		snprintf(c->detail, sizeof c->detail, "no cpuidle states");
+		return;
+	}
+	if (deepest > DEEP_IDLE_LATENCY) {
+		c->status = BENCH_PF_WARN;
+		snprintf(c->detail, sizeof c->detail,
+			"%s enabled (exit latency %ld us)", deep_name, deepest);
+	} else {
+		c->status = BENCH_PF_OK;
+		snprintf(c->detail, sizeof c->detail,
+			"%d states, none deeper than %d us", states,
+			DEEP_IDLE_LATENCY);
+	}
+}
+
+static void
+check_backend(bench_preflight *pf, pf_ctx *pc)
+{
+	bench_pf_check *c = pf_add(pf, "backend", 15);
+	const char *be = CORE_CYCLES_BACKEND;
+	if (strcmp(be, "rdtsc") == 0 || strcmp(be, "cntvct_el0") == 0
+		|| strcmp(be, "rdtime") == 0)
+	{
+		c->status = BENCH_PF_WARN;
+		snprintf(c->detail, sizeof c->detail,
+			"%s is a fixed-frequency timer", be);
+		return;
+	}
+	c->status = BENCH_PF_OK;
+	snprintf(c->detail, sizeof c->detail, "%s reads core cycles", be);
+	if (strcmp(be, "rdpmc") == 0) {
+		char buf[8];
+		pf_read(pc, "/sys/bus/event_source/devices/cpu/rdpmc", 0,
+			buf, sizeof buf);
+		if (buf[0] != 0 && strcmp(buf, "2") != 0) {
+			c->status = BENCH_PF_BAD;
+			snprintf(c->detail, sizeof c->detail,
+				"rdpmc not enabled for user space (rdpmc=%s)",
+				buf);
+		}
+	}
+}
+
+void
+bench_preflight_run(bench_preflight *pf, int cpu, const char *root)
+{
+	memset(pf, 0, sizeof *pf);
+	if (cpu < 0) {
+		uint32_t c = cyc_current_cpu();
+		cpu = c == CYC_CPU_UNKNOWN ? 0 : (int)c;
+	}
+	pf->cpu = cpu;
+	pf_ctx pc;
+	pc.root = root != NULL ? root : "";
+
+	check_governor(pf, &pc);
+	check_boost(pf, &pc);
+	check_smt(pf, &pc);
+	check_isolation(pf, &pc);
+	check_cpuidle(pf, &pc);
+	check_backend(pf, &pc);
+
+	int got = 0, max = 0;
+	for (int i = 0; i < pf->num_checks; i ++) {
+		const bench_pf_check *c = &pf->check[i];
+		if (c->status == BENCH_PF_NA) {
+			continue;
+		}
+		max += 2 * c->weight;
+		if (c->status == BENCH_PF_OK) {
+			got += 2 * c->weight;
+		} else if (c->status == BENCH_PF_WARN) {
+			got += c->weight;
+		}
+	}
+	pf->score = max > 0 ? (100 * got + max / 2) / max : 100;
+}
+
+void
+bench_preflight_print(FILE *out, const bench_preflight *pf)
+{
+	static const char *const names[] = { "n/a", "ok", "WARN", "BAD" };
+	fprintf(out, "preflight (cpu %d):\n", pf->cpu);
+	int na = 0;
+	for (int i = 0; i < pf->num_checks; i ++) {
+		const bench_pf_check *c = &pf->check[i];
+		fprintf(out, "  %-10s %-4s  %s\n",
+			c->name, names[c->status], c->detail);
+		na += c->status == BENCH_PF_NA;
+	}
+	fprintf(out, "  score %d/100", pf->score);
+	if (na > 0) {
+		fprintf(out, " (%d of %d checks not applicable)",
+			na, pf->num_checks);
+	}
+	fputc('\n', out);
+}
@@ -0,0 +1,220 @@
+/*
+ * Benchmark harness: parallel scheduling of benchmarks across CPUs.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/*
+ * Read a CPU list from a per-CPU sysfs file (format with a "%s" for the
+ * root and a "%d" for the CPU). Returns -1 if it cannot be read.
+ */
+static int
+cpu_file_list(const char *root, const char *fmt, int cpu, unsigned char *set)
+{
+	char path[256];
+	snprintf(path, sizeof path, fmt, root, cpu);
+	return bench_cpu_list(path, set, BENCH_MAX_CPUS);
+}
+
+/*
+ * Mark as taken 'cpu' and all the CPUs listed in its given file. Returns
+ * the number of listed CPUs, or -1 if the file cannot be read.
+ */
+static int
+take_group(const char *root, const char *fmt, int cpu, unsigned char *taken)
+{
+	unsigned char set[BENCH_MAX_CPUS];
+	int n = cpu_file_list(root, fmt, cpu, set);
+	for (int i = 0; i < BENCH_MAX_CPUS && n > 0; i ++) {
+		taken[i] |= set[i];
+	}
+	taken[cpu] = 1;
+	return n;
+}
+
+int
+bench_cpu_pick(const char *root, const unsigned char *cand,
+	unsigned flags, int *cpus, int max)
+{
+	if (root == NULL) {
+		root = "";
+	}
+	unsigned char taken[BENCH_MAX_CPUS];
+	memset(taken, 0, sizeof taken);
+	int n = 0;
+	for (int cpu = 0; cpu < BENCH_MAX_CPUS && n < max; cpu ++) {
+		if (!cand[cpu] || taken[cpu]) {
+			continue;
+		}
+		cpus[n ++] = cpu;
+		take_group(root,
+			"%s/sys/devices/system/cpu/cpu%d/topology/"
+			"thread_siblings_list", cpu, taken);
+		if ((flags & BENCH_PICK_CLUSTER) && take_group(root,
+			"%s/sys/devices/system/cpu/cpu%d/topology/"
+			"cluster_cpus_list", cpu, taken) <= 0)
+		{
+			take_group(root,
+				"%s/sys/devices/system/cpu/cpu%d/cache/index2/"
+				"shared_cpu_list", cpu, taken);
+		}
+	}
+	return n;
+}
+
+int
+bench_cpu_allowed(unsigned char *set)
+{
+	cpu_set_t aff;
+	if (sched_getaffinity(0, sizeof aff, &aff) < 0) {
+		CPU_ZERO(&aff);
+	}
+	int n = 0;
+	for (int i = 0; i < BENCH_MAX_CPUS; i ++) {
+		set[i] = i < CPU_SETSIZE && CPU_ISSET(i, &aff);
+		n += set[i];
+	}
+	return n;
+}
+
+int
+bench_cpu_candidates(const char *root, unsigned char *cand)
+{
+	char path[256];
+	snprintf(path, sizeof path, "%s/sys/devices/system/cpu/isolated",
+		root != NULL ? root : "");
+	unsigned char iso[BENCH_MAX_CPUS];
+	int num_iso = bench_cpu_list(path, iso, BENCH_MAX_CPUS);
+	unsigned char allowed[BENCH_MAX_CPUS];
+	bench_cpu_allowed(allowed);
+	int n = 0;
+	for (int pass = 0; pass < 2 && n == 0; pass ++) {
+		/* First pass: isolated CPUs only. */
+		if (pass == 0 && num_iso <= 0) {
+			continue;
+		}
+		for (int i = 0; i < BENCH_MAX_CPUS; i ++) {
+			cand[i] = allowed[i] && (pass > 0 || iso[i]);
+			n += cand[i];
+		}
+	}
+	return n;
+}
+
+int
+bench_run_parallel(bench_job *jobs, size_t num_jobs,
+	const bench_opts *opt, const int *cpus, int num_cpus, unsigned flags)
+{
+	if (num_cpus <= 0) {
+		return -1;
+	}
+	bench_child *slot = calloc((size_t)num_cpus, sizeof *slot);
+	size_t *slot_job = calloc((size_t)num_cpus, sizeof *slot_job);
+	struct pollfd *pfd = calloc((size_t)num_cpus, sizeof *pfd);
+	int *pfd_slot = calloc((size_t)num_cpus, sizeof *pfd_slot);
+	if (slot == NULL || slot_job == NULL || pfd == NULL
+		|| pfd_slot == NULL)
+	{
+		free(slot);
+		free(slot_job);
+		free(pfd);
+		free(pfd_slot);
+		return -1;
+	}
+
+	/* Keep the parent off the benchmark CPUs, if it can run elsewhere;
+	   children inherit this affinity until they pin themselves. */
+	cpu_set_t orig, rest;
+	int moved = 0;
+	if (sched_getaffinity(0, sizeof orig, &orig) == 0) {
+		rest = orig;
+		for (int s = 0; s < num_cpus; s ++) {
+			if (cpus[s] >= 0 && cpus[s] < CPU_SETSIZE) {
+				CPU_CLR(cpus[s], &rest);
+			}
+		}
+		moved = CPU_COUNT(&rest) > 0
+			&& sched_setaffinity(0, sizeof rest, &rest) == 0;
+	}
+
+	for (size_t i = 0; i < num_jobs; i ++) {
+		jobs[i].err = 0;
+		jobs[i].status = 0;
+		memset(&jobs[i].res, 0, sizeof jobs[i].res);
+	}
+	for (int s = 0; s < num_cpus; s ++) {
+		slot_job[s] = (size_t)-1;
+	}
+	size_t next = 0;
+	int busy = 0;
+	while (next < num_jobs || busy > 0) {
+		/* Start a job on every free CPU. */
+		for (int s = 0; s < num_cpus && next < num_jobs; s ++) {
+			if (slot_job[s] != (size_t)-1) {
+				continue;
+			}
+			bench_job *j = &jobs[next];
+			if (bench_child_start(&slot[s], j->desc, opt,
+				cpus[s], flags) < 0)
+			{
+				j->err = 1;
+				next ++;
+				s --;
+				continue;
+			}
+			slot_job[s] = next ++;
+			busy ++;
+		}
+		if (busy == 0) {
+			continue;
+		}
+
+		/* A child's pipe becomes readable when it has finished
+		   measuring (or has died). */
+		int k = 0;
+		for (int s = 0; s < num_cpus; s ++) {
+			if (slot_job[s] != (size_t)-1) {
+				pfd[k].fd = slot[s].fd;
+				pfd[k].events = POLLIN;
+				pfd[k].revents = 0;
+				pfd_slot[k ++] = s;
+			}
+		}
+		if (poll(pfd, (nfds_t)k, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* Fall back to collecting the children in order. */
+			for (int i = 0; i < k; i ++) {
+				pfd[i].revents = POLLIN;
+			}
+		}
+		for (int i = 0; i < k; i ++) {
+			if (pfd[i].revents == 0) {
+				continue;
+			}
+			int s = pfd_slot[i];
+			bench_job *j = &jobs[slot_job[s]];
+			j->err = bench_child_finish(&slot[s], &j->res) < 0;
+			j->status = slot[s].status;
+			slot_job[s] = (size_t)-1;
+			busy --;
+		}
+	}
+
+	if (moved) {
+		sched_setaffinity(0, sizeof orig, &orig);
+	}
+	free(slot);
+	free(slot_job);
+	free(pfd);
+	free(pfd_slot);
+	return 0;
+}
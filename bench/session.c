@@ -0,0 +1,449 @@
+/*
+ * Benchmark harness: isolation session (CPU pinning, IRQ affinity,
+ * real-time priority, memory locking).
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+/* Affinity masks are comma-separated groups of 32 bits, in hexadecimal,
+   most significant first. */
+#define MASK_WORDS   (BENCH_MAX_CPUS / 32)
+#define MASK_LEN     (MASK_WORDS * 9 + 1)
+#define PATH_LEN     256
+
+/* Amount of stack prefaulted when memory is locked. */
+#define STACK_PREFAULT   (256 * 1024)
+
+struct bench_irq_saved_ {
+	char path[PATH_LEN];
+	char mask[MASK_LEN];
+};
+
+/* The active session, restored on exit or on a fatal signal. */
+static bench_session *active;
+static int atexit_done;
+static const int restore_signals[] = { SIGINT, SIGTERM, SIGHUP };
+#define NUM_RESTORE_SIGNALS \
+	(sizeof restore_signals / sizeof restore_signals[0])
+static struct sigaction old_action[NUM_RESTORE_SIGNALS];
+
+void
+bench_session_opts_init(bench_session_opts *opt)
+{
+	opt->cpu = -1;
+	opt->rt_priority = 50;
+	opt->lock_memory = 1;
+	opt->dry_run = 0;
+	opt->root = NULL;
+	opt->log = stderr;
+}
+
+/*
+ * Parse an affinity mask into words (least significant first). Returns
+ * the number of groups, or -1 on a malformed mask.
+ */
+static int
+parse_mask(const char *s, uint32_t *w)
+{
+	uint32_t g[MASK_WORDS];
+	int n = 0;
+	const char *p = s;
+	for (;;) {
+		char *end;
+		unsigned long v = strtoul(p, &end, 16);
+		if (end == p || n == MASK_WORDS) {
+			return -1;
+		}
+		g[n ++] = (uint32_t)v;
+		if (*end != ',') {
+			break;
+		}
+		p = end + 1;
+	}
+	memset(w, 0, MASK_WORDS * sizeof *w);
+	for (int i = 0; i < n; i ++) {
+		w[i] = g[n - 1 - i];
+	}
+	return n;
+}
+
+static void
+format_mask(const uint32_t *w, int groups, char *dst, size_t len)
+{
+	size_t n = 0;
+	dst[0] = 0;
+	for (int i = groups - 1; i >= 0 && n < len; i --) {
+		n += (size_t)snprintf(dst + n, len - n,
+			groups == 1 ? "%x" : i == groups - 1 ? "%08x" : ",%08x",
+			w[i]);
+	}
+}
+
+/*
+ * Write a string (and a newline) into a file, with plain system calls
+ * since this is also used from a signal handler. Returns 0 on success,
+ * -1 on error (with errno set).
+ */
+static int
+write_string(const char *path, const char *s)
+{
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0) {
+		return -1;
+	}
+	size_t len = strlen(s);
+	int ok = write(fd, s, len) == (ssize_t)len && write(fd, "\n", 1) == 1;
+	int err = errno;
+	if (close(fd) < 0 && ok) {
+		return -1;
+	}
+	errno = err;
+	return ok ? 0 : -1;
+}
+
+static void
+restore_irqs(bench_session *s)
+{
+	for (size_t i = 0; i < s->num_irqs; i ++) {
+		write_string(s->irq[i].path, s->irq[i].mask);
+	}
+}
+
+static void
+on_signal(int sig)
+{
+	if (active != NULL) {
+		restore_irqs(active);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void
+on_exit_restore(void)
+{
+	if (active != NULL) {
+		bench_session_end(active);
+	}
+}
+
+static int
+cmp_int(const void *v1, const void *v2)
+{
+	int x1 = *(const int *)v1;
+	int x2 = *(const int *)v2;
+	return x1 < x2 ? -1 : x1 > x2;
+}
+
+/*
+ * List the interrupt numbers in /proc/irq, in increasing order. Returns
+ * the count (with *irqs allocated), or -1 on error.
+ */
+static int
+list_irqs(const char *root, int **irqs)
+{
+	char path[PATH_LEN];
+	snprintf(path, sizeof path, "%s/proc/irq", root);
+	DIR *d = opendir(path);
+	if (d == NULL) {
+		return -1;
+	}
+	int *v = NULL;
+	int n = 0, cap = 0;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		char *end;
+		long irq = strtol(e->d_name, &end, 10);
+		if (end == e->d_name || *end != 0 || irq < 0) {
+			continue;
+		}
+		if (n == cap) {
+			cap = cap == 0 ? 64 : cap << 1;
+			int *nv = realloc(v, (size_t)cap * sizeof *v);
+			if (nv == NULL) {
+				free(v);
+				closedir(d);
+				return -1;
+			}
+			v = nv;
+		}
+		v[n ++] = (int)irq;
+	}
+	closedir(d);
+	qsort(v, (size_t)n, sizeof *v, &cmp_int);
+	*irqs = v;
+	return n;
+}
+
+/*
+ * Steer one interrupt away from the session CPU; 'path' is its
+ * smp_affinity file and 'others' the mask of the other online CPUs.
+ * Returns 1 if moved, 0 if nothing had to be done, -1 on failure.
+ */
+static int
+move_irq(bench_session *s, const char *name, const char *path,
+	const uint32_t *others)
+{
+	char old[MASK_LEN], new[MASK_LEN];
+	uint32_t w[MASK_WORDS];
+	bench_read_line(path, old, sizeof old);
+	int groups = old[0] != 0 ? parse_mask(old, w) : -1;
+	if (groups < 0) {
+		return -1;
+	}
+	int cpu = s->opt.cpu;
+	if (!(w[cpu >> 5] & ((uint32_t)1 << (cpu & 31)))) {
+		return 0;
+	}
+	w[cpu >> 5] &= ~((uint32_t)1 << (cpu & 31));
+	int empty = 1;
+	for (int i = 0; i < MASK_WORDS; i ++) {
+		empty &= w[i] == 0;
+	}
+	if (empty) {
+		/* Bound to this CPU only: allow any other one. */
+		memcpy(w, others, sizeof w);
+		if (groups < (cpu >> 5) + 1) {
+			groups = (cpu >> 5) + 1;
+		}
+		for (int i = groups; i < MASK_WORDS; i ++) {
+			if (w[i] != 0) {
+				groups = i + 1;
+			}
+		}
+	}
+	format_mask(w, groups, new, sizeof new);
+	if (s->opt.dry_run) {
+		fprintf(s->opt.log, "session: irq %s: %s -> %s\n",
+			name, old, new);
+		return 1;
+	}
+	bench_irq_saved *e = &s->irq[s->num_irqs];
+	snprintf(e->path, sizeof e->path, "%s", path);
+	snprintf(e->mask, sizeof e->mask, "%s", old);
+	/* Saved before writing, so that a signal in between restores it. */
+	s->num_irqs ++;
+	if (write_string(path, new) < 0) {
+		s->num_irqs --;
+		return -1;
+	}
+	return 1;
+}
+
+static void
+move_irqs(bench_session *s)
+{
+	const char *root = s->opt.root != NULL ? s->opt.root : "";
+	int *irqs;
+	int n = list_irqs(root, &irqs);
+	if (n < 0) {
+		fprintf(s->opt.log, "session: cannot list %s/proc/irq\n", root);
+		return;
+	}
+	s->irq = malloc(((size_t)n + 1) * sizeof *s->irq);
+	if (s->irq == NULL) {
+		free(irqs);
+		return;
+	}
+
+	/* Mask of the online CPUs other than the session CPU. */
+	uint32_t others[MASK_WORDS] = { 0 };
+	unsigned char set[BENCH_MAX_CPUS];
+	char path[PATH_LEN];
+	snprintf(path, sizeof path, "%s/sys/devices/system/cpu/online", root);
+	if (bench_cpu_list(path, set, BENCH_MAX_CPUS) > 0) {
+		for (int i = 0; i < BENCH_MAX_CPUS; i ++) {
+			if (set[i] && i != s->opt.cpu) {
+				others[i >> 5] |= (uint32_t)1 << (i & 31);
+			}
+		}
+	}
+
+	int moved = 0, failed = 0;
+	char name[16];
+	for (int i = 0; i <= n; i ++) {
+		if (i < n) {
+			snprintf(name, sizeof name, "%d", irqs[i]);
+			snprintf(path, sizeof path,
+				"%s/proc/irq/%d/smp_affinity", root, irqs[i]);
+		} else {
+			snprintf(name, sizeof name, "default");
+			snprintf(path, sizeof path,
+				"%s/proc/irq/default_smp_affinity", root);
+		}
+		int r = move_irq(s, name, path, others);
+		moved += r > 0;
+		failed += r < 0;
+	}
+	free(irqs);
+	fprintf(s->opt.log, "session: %s %d interrupts away from cpu %d",
+		s->opt.dry_run ? "would move" : "moved", moved, s->opt.cpu);
+	if (failed > 0) {
+		fprintf(s->opt.log, " (%d could not be moved)", failed);
+	}
+	fputc('\n', s->opt.log);
+}
+
+static void __attribute__((noinline))
+prefault_stack(void)
+{
+	volatile unsigned char buf[STACK_PREFAULT];
+	for (size_t i = 0; i < sizeof buf; i += 1024) {
+		buf[i] = 0;
+	}
+}
+
+int
+bench_session_begin(bench_session *s, const bench_session_opts *opt)
+{
+	memset(s, 0, sizeof *s);
+	s->opt = *opt;
+	FILE *log = s->opt.log;
+	if (s->opt.cpu < 0) {
+		uint32_t c = cyc_current_cpu();
+		s->opt.cpu = c == CYC_CPU_UNKNOWN ? sched_getcpu() : (int)c;
+	}
+	int cpu = s->opt.cpu;
+	if (cpu < 0 || cpu >= BENCH_MAX_CPUS) {
+		fprintf(log, "session: invalid cpu %d\n", cpu);
+		return -1;
+	}
+
+	if (s->opt.dry_run) {
+		fprintf(log, "session: would pin to cpu %d\n", cpu);
+	} else {
+		cpu_set_t old, one;
+		if (sched_getaffinity(0, sizeof old, &old) < 0) {
+			CPU_ZERO(&old);
+		}
+		for (int i = 0; i < BENCH_MAX_CPUS && i < CPU_SETSIZE; i ++) {
+			s->old_cpus[i] = CPU_ISSET(i, &old) != 0;
+		}
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		if (sched_setaffinity(0, sizeof one, &one) < 0) {
+			fprintf(log, "session: cannot pin to cpu %d: %s\n",
+				cpu, strerror(errno));
+			return -1;
+		}
+		s->pinned = 1;
+		active = s;
+		if (!atexit_done) {
+			atexit(&on_exit_restore);
+			atexit_done = 1;
+		}
+		struct sigaction sa;
+		memset(&sa, 0, sizeof sa);
+		sa.sa_handler = &on_signal;
+		sigemptyset(&sa.sa_mask);
+		for (size_t i = 0; i < NUM_RESTORE_SIGNALS; i ++) {
+			sigaction(restore_signals[i], &sa, &old_action[i]);
+		}
+	}
+
+	move_irqs(s);
+
+	if (s->opt.rt_priority > 0) {
+		int lo = sched_get_priority_min(SCHED_FIFO);
+		int hi = sched_get_priority_max(SCHED_FIFO);
+		int prio = s->opt.rt_priority;
+		prio = prio < lo ? lo : prio > hi ? hi : prio;
+		struct sched_param sp;
+		if (s->opt.dry_run) {
+			fprintf(log, "session: would set SCHED_FIFO priority"
+				" %d\n", prio);
+		} else if ((s->old_policy = sched_getscheduler(0)) < 0
+			|| sched_getparam(0, &sp) < 0)
+		{
+			fprintf(log, "session: cannot get scheduling policy:"
+				" %s\n", strerror(errno));
+		} else {
+			s->old_priority = sp.sched_priority;
+			sp.sched_priority = prio;
+			if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+				fprintf(log, "session: cannot set SCHED_FIFO:"
+					" %s\n", strerror(errno));
+			} else {
+				s->sched_set = 1;
+				fprintf(log, "session: SCHED_FIFO priority"
+					" %d\n", prio);
+			}
+		}
+	}
+
+	if (s->opt.lock_memory) {
+		if (s->opt.dry_run) {
+			fprintf(log, "session: would lock memory\n");
+		} else if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			fprintf(log, "session: cannot lock memory: %s\n",
+				strerror(errno));
+		} else {
+			s->locked = 1;
+			prefault_stack();
+			fprintf(log, "session: memory locked\n");
+		}
+	}
+	return 0;
+}
+
+void
+bench_session_end(bench_session *s)
+{
+	FILE *log = s->opt.log;
+	if (s->num_irqs > 0) {
+		size_t failed = 0;
+		for (size_t i = 0; i < s->num_irqs; i ++) {
+			if (write_string(s->irq[i].path, s->irq[i].mask) < 0) {
+				failed ++;
+			}
+		}
+		fprintf(log, "session: restored %zu interrupt masks",
+			s->num_irqs - failed);
+		if (failed > 0) {
+			fprintf(log, " (%zu failed)", failed);
+		}
+		fputc('\n', log);
+	}
+	free(s->irq);
+	s->irq = NULL;
+	s->num_irqs = 0;
+	if (s->sched_set) {
+		struct sched_param sp;
+		sp.sched_priority = s->old_priority;
+		sched_setscheduler(0, s->old_policy, &sp);
+		s->sched_set = 0;
+	}
+	if (s->locked) {
+		munlockall();
+		s->locked = 0;
+	}
+	if (s->pinned) {
+		cpu_set_t old;
+		CPU_ZERO(&old);
+		for (int i = 0; i < BENCH_MAX_CPUS && i < CPU_SETSIZE; i ++) {
+			if (s->old_cpus[i]) {
+				CPU_SET(i, &old);
+			}
+		}
+		sched_setaffinity(0, sizeof old, &old);
+		s->pinned = 0;
+	}
+	if (active == s) {
+		for (size_t i = 0; i < NUM_RESTORE_SIGNALS; i ++) {
+			sigaction(restore_signals[i], &old_action[i], NULL);
+		}
+		active = NULL;
+	}
+}
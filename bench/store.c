@@ -0,0 +1,213 @@
+/*
+ * Benchmark harness: local result store.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static int
+valid_key(const char *s)
+{
+	return s[0] != 0 && strpbrk(s, "\t\n") == NULL;
+}
+
+int
+bench_store_append(const char *path, const bench_result *res,
+	const char *machine, const char *build, const bench_fingerprint *fp)
+{
+	if (!valid_key(res->desc->name) || !valid_key(machine)
+		|| !valid_key(build))
+	{
+		return -1;
+	}
+	char env[512];
+	bench_fingerprint_env(fp, env, sizeof env);
+	FILE *f = fopen(path, "a");
+	if (f == NULL) {
+		return -1;
+	}
+	fprintf(f, "%s\t%s\t%s\t%lld\t%zu\t", res->desc->name, machine, build,
+		(long long)time(NULL), res->num_samples);
+	for (size_t i = 0; i < res->num_samples; i ++) {
+		fprintf(f, "%s%.4f", i > 0 ? " " : "", res->samples[i]);
+	}
+	fprintf(f, "\t%s\n", env);
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+int
+bench_store_describe(const char *path, const char *machine,
+	const bench_fingerprint *fp)
+{
+	FILE *f = fopen(path, "a");
+	if (f == NULL) {
+		return -1;
+	}
+	fprintf(f, "# machine %s\n", machine);
+	bench_fingerprint_print(f, "#   ", fp);
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+static char *
+xstrdup(const char *s)
+{
+	size_t n = strlen(s) + 1;
+	char *d = malloc(n);
+	if (d != NULL) {
+		memcpy(d, s, n);
+	}
+	return d;
+}
+
+/*
+ * Parse one store line (modified in place). Returns 0 on success, -1 on
+ * a malformed line or allocation failure.
+ */
+static int
+parse_record(char *line, bench_record *r)
+{
+	char *field[7];
+	char *p = line;
+	for (int i = 0; i < 6; i ++) {
+		field[i] = p;
+		if (i < 5) {
+			p = strchr(p, '\t');
+			if (p == NULL) {
+				return -1;
+			}
+			*p ++ = 0;
+		}
+	}
+	/* The environment field is optional. */
+	field[6] = strchr(field[5], '\t');
+	if (field[6] != NULL) {
+		*field[6] ++ = 0;
+	} else {
+		field[6] = "";
+	}
+	char *end;
+	long long t = strtoll(field[3], &end, 10);
+	if (*end != 0) {
+		return -1;
+	}
+	unsigned long long n = strtoull(field[4], &end, 10);
+	if (*end != 0 || n == 0 || n > ((size_t)-1 / sizeof(double))) {
+		return -1;
+	}
+	double *s = malloc((size_t)n * sizeof *s);
+	if (s == NULL) {
+		return -1;
+	}
+	p = field[5];
+	for (size_t i = 0; i < n; i ++) {
+		s[i] = strtod(p, &end);
+		if (end == p) {
+			free(s);
+			return -1;
+		}
+		p = end;
+	}
+	r->bench = xstrdup(field[0]);
+	r->machine = xstrdup(field[1]);
+	r->build = xstrdup(field[2]);
+	r->env = xstrdup(field[6]);
+	r->time = (int64_t)t;
+	r->samples = s;
+	r->num_samples = (size_t)n;
+	if (r->bench == NULL || r->machine == NULL || r->build == NULL
+		|| r->env == NULL)
+	{
+		free(r->bench);
+		free(r->machine);
+		free(r->build);
+		free(r->env);
+		free(s);
+		return -1;
+	}
+	return 0;
+}
+
+int
+bench_store_load(bench_store *st, const char *path)
+{
+	st->rec = NULL;
+	st->num = 0;
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	size_t cap = 0;
+	char *line = NULL;
+	size_t line_cap = 0;
+	unsigned ln = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_cap, f)) >= 0) {
+		ln ++;
+		if (len > 0 && line[len - 1] == '\n') {
+			line[-- len] = 0;
+		}
+		if (len == 0 || line[0] == '#') {
+			continue;
+		}
+		if (st->num == cap) {
+			cap = cap == 0 ? 64 : cap << 1;
+			bench_record *r = realloc(st->rec, cap * sizeof *r);
+			if (r == NULL) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				goto fail;
+			}
+			st->rec = r;
+		}
+		if (parse_record(line, &st->rec[st->num]) < 0) {
+			fprintf(stderr, "%s:%u: invalid record\n", path, ln);
+			goto fail;
+		}
+		st->num ++;
+	}
+	free(line);
+	fclose(f);
+	return 0;
+
+fail:
+	free(line);
+	fclose(f);
+	bench_store_free(st);
+	return -1;
+}
+
+void
+bench_store_free(bench_store *st)
+{
+	for (size_t i = 0; i < st->num; i ++) {
+		bench_record *r = &st->rec[i];
+		free(r->bench);
+		free(r->machine);
+		free(r->build);
+		free(r->env);
+		free(r->samples);
+	}
+	free(st->rec);
+	st->rec = NULL;
+	st->num = 0;
+}
+
+const bench_record *
+bench_store_find(const bench_store *st,
+	const char *bench, const char *machine, const char *build)
+{
+	/* Records are in append order; the last match is the latest. */
+	for (size_t i = st->num; i -- > 0;) {
+		const bench_record *r = &st->rec[i];
+		if (strcmp(r->bench, bench) == 0
+			&& strcmp(r->machine, machine) == 0
+			&& strcmp(r->build, build) == 0)
+		{
+			return r;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,353 @@
+/*
+ * Benchmark harness: parameter sweeps with a resumable checkpoint.
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../cycprof/cycprof.h"
+
+static const char *const axis_names[BENCH_SWEEP_NUM_AXES] = {
+	"bench", "cpu", "seed", "iters", "samples", "warmup"
+};
+
+static int
+axis_find(const char *name)
+{
+	for (int i = 0; i < BENCH_SWEEP_NUM_AXES; i ++) {
+		if (strcmp(name, axis_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int
+axis_add(bench_sweep *sw, int a, uint64_t v, size_t *cap)
+{
+	for (size_t i = 0; i < sw->num[a]; i ++) {
+		if (sw->val[a][i] == v) {
+			return 0;
+		}
+	}
+	if (sw->num[a] == *cap) {
+		*cap = *cap == 0 ? 8 : *cap << 1;
+		uint64_t *nv = realloc(sw->val[a], *cap * sizeof *nv);
+		if (nv == NULL) {
+			return -1;
+		}
+		sw->val[a] = nv;
+	}
+	sw->val[a][sw->num[a] ++] = v;
+	return 0;
+}
+
+/*
+ * Add the values of one token to an axis. Returns 0 on success, -1 on
+ * an invalid value, -2 on allocation failure.
+ */
+static int
+axis_parse(bench_sweep *sw, int a, const char *tok, size_t num_benches,
+	size_t *cap)
+{
+	if (a == BENCH_SWEEP_BENCH) {
+		int found = 0;
+		for (size_t i = 0; i < num_benches; i ++) {
+			if (fnmatch(tok, sw->benches[i]->name, 0) != 0) {
+				continue;
+			}
+			found = 1;
+			if (axis_add(sw, a, i, cap) < 0) {
+				return -2;
+			}
+		}
+		return found ? 0 : -1;
+	}
+	if (a == BENCH_SWEEP_CPU) {
+		unsigned char set[BENCH_MAX_CPUS];
+		if (strspn(tok, "0123456789,-") != strlen(tok)
+			|| bench_cpu_list_parse(tok, set, BENCH_MAX_CPUS) <= 0)
+		{
+			return -1;
+		}
+		for (int i = 0; i < BENCH_MAX_CPUS; i ++) {
+			if (set[i] && axis_add(sw, a, (uint64_t)i, cap) < 0) {
+				return -2;
+			}
+		}
+		return 0;
+	}
+	char *end;
+	errno = 0;
+	unsigned long long v = strtoull(tok, &end, 0);
+	if (end == tok || *end != 0 || errno != 0 || tok[0] == '-'
+		|| (v == 0 && (a == BENCH_SWEEP_ITERS
+		|| a == BENCH_SWEEP_SAMPLES)))
+	{
+		return -1;
+	}
+	return axis_add(sw, a, (uint64_t)v, cap) < 0 ? -2 : 0;
+}
+
+int
+bench_sweep_load(bench_sweep *sw, const char *path,
+	const bench_desc *const *benches, size_t num_benches,
+	const bench_opts *base)
+{
+	memset(sw, 0, sizeof *sw);
+	sw->benches = benches;
+	sw->base = *base;
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	char line[1024];
+	unsigned ln = 0;
+	while (fgets(line, sizeof line, f) != NULL) {
+		ln ++;
+		const char *sep = " \t\n";
+		char *p = line + strspn(line, sep);
+		if (*p == 0 || *p == '#') {
+			continue;
+		}
+		char *name = p;
+		p += strcspn(p, sep);
+		if (*p != 0) {
+			*p ++ = 0;
+		}
+		int a = axis_find(name);
+		if (a < 0 || sw->num[a] > 0) {
+			fprintf(stderr, "%s:%u: %s axis '%s'\n", path, ln,
+				a < 0 ? "unknown" : "duplicate", name);
+			goto fail;
+		}
+		size_t cap = 0;
+		for (;;) {
+			p += strspn(p, sep);
+			if (*p == 0 || *p == '#') {
+				break;
+			}
+			char *tok = p;
+			p += strcspn(p, sep);
+			if (*p != 0) {
+				*p ++ = 0;
+			}
+			int r = axis_parse(sw, a, tok, num_benches, &cap);
+			if (r == -2) {
+				fprintf(stderr, "%s: out of memory\n", path);
+				goto fail;
+			}
+			if (r < 0) {
+				fprintf(stderr, "%s:%u: invalid %s value '%s'\n",
+					path, ln, name, tok);
+				goto fail;
+			}
+		}
+		if (sw->num[a] == 0) {
+			fprintf(stderr, "%s:%u: no values for axis '%s'\n",
+				path, ln, name);
+			goto fail;
+		}
+		sw->order[sw->num_axes ++] = a;
+	}
+	fclose(f);
+	if (sw->num[BENCH_SWEEP_BENCH] == 0) {
+		fprintf(stderr, "%s: no bench axis\n", path);
+		bench_sweep_free(sw);
+		return -1;
+	}
+	sw->num_points = 1;
+	for (int i = 0; i < sw->num_axes; i ++) {
+		size_t n = sw->num[sw->order[i]];
+		if (sw->num_points > ((size_t)-1 >> 1) / n) {
+			fprintf(stderr, "%s: too many points\n", path);
+			bench_sweep_free(sw);
+			return -1;
+		}
+		sw->num_points *= n;
+	}
+	return 0;
+
+fail:
+	fclose(f);
+	bench_sweep_free(sw);
+	return -1;
+}
+
+void
+bench_sweep_free(bench_sweep *sw)
+{
+	for (int i = 0; i < BENCH_SWEEP_NUM_AXES; i ++) {
+		free(sw->val[i]);
+		sw->val[i] = NULL;
+		sw->num[i] = 0;
+	}
+	sw->num_axes = 0;
+	sw->num_points = 0;
+}
+
+void
+bench_sweep_point_get(const bench_sweep *sw, size_t index,
+	bench_sweep_point *pt)
+{
+	pt->opt = sw->base;
+	pt->cpu = -1;
+	uint64_t v[BENCH_SWEEP_NUM_AXES];
+	/* Mixed-radix decomposition, the last axis being the lowest digit. */
+	for (int i = sw->num_axes - 1; i >= 0; i --) {
+		int a = sw->order[i];
+		v[a] = sw->val[a][index % sw->num[a]];
+		index /= sw->num[a];
+	}
+	size_t n = 0;
+	pt->key[0] = 0;
+	for (int i = 0; i < sw->num_axes; i ++) {
+		int a = sw->order[i];
+		switch (a) {
+		case BENCH_SWEEP_BENCH:
+			pt->desc = sw->benches[v[a]];
+			break;
+		case BENCH_SWEEP_CPU:
+			pt->cpu = (int)v[a];
+			break;
+		case BENCH_SWEEP_SEED:
+			pt->opt.seed = v[a];
+			break;
+		case BENCH_SWEEP_ITERS:
+			pt->opt.iters = v[a];
+			break;
+		case BENCH_SWEEP_SAMPLES:
+			pt->opt.samples = (size_t)v[a];
+			break;
+		case BENCH_SWEEP_WARMUP:
+			pt->opt.warmup = (size_t)v[a];
+			break;
+		}
+		int r;
+		if (a == BENCH_SWEEP_BENCH) {
+			r = snprintf(pt->key + n, sizeof pt->key - n, "%s%s=%s",
+				i > 0 ? " " : "", axis_names[a], pt->desc->name);
+		} else {
+			r = snprintf(pt->key + n, sizeof pt->key - n,
+				"%s%s=%llu", i > 0 ? " " : "", axis_names[a],
+				(unsigned long long)v[a]);
+		}
+		if (r > 0) {
+			n += (size_t)r;
+			if (n >= sizeof pt->key) {
+				n = sizeof pt->key - 1;
+			}
+		}
+	}
+}
+
+/* Checkpoint key of a point: point key, then cache key. */
+#define CKPT_KEY_LEN   (sizeof ((bench_sweep_point *)0)->key + 160)
+
+int
+bench_sweep_run(const bench_sweep *sw, const char *ckpt,
+	bench_job *jobs, FILE *log)
+{
+	bench_cache cache;
+	/* Checkpoint key of each point, empty if the point is resumed or
+	   cannot be checkpointed; done[i] is set for resumed points. */
+	char (*keys)[CKPT_KEY_LEN] = calloc(sw->num_points, sizeof *keys);
+	unsigned char *done = calloc(sw->num_points, 1);
+	if (keys == NULL || done == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(keys);
+		free(done);
+		return -1;
+	}
+	if (ckpt != NULL && bench_cache_open(&cache, ckpt) < 0) {
+		free(keys);
+		free(done);
+		return -1;
+	}
+
+	uint32_t c = cyc_current_cpu();
+	int here = c == CYC_CPU_UNKNOWN ? -1 : (int)c;
+
+	/* Checkpoint lookups come first. The keys cover the code, the
+	   options and the fingerprint (see bench_cache_key()), so that
+	   results of another build or with other options are not
+	   resumed. */
+	size_t resumed = 0, no_key = 0;
+	int fp_cpu = -2;
+	bench_fingerprint fp;
+	for (size_t i = 0; i < sw->num_points; i ++) {
+		bench_sweep_point pt;
+		bench_sweep_point_get(sw, i, &pt);
+		bench_job *j = &jobs[i];
+		memset(j, 0, sizeof *j);
+		j->desc = pt.desc;
+		if (ckpt == NULL) {
+			continue;
+		}
+		int cpu = pt.cpu >= 0 ? pt.cpu : here;
+		if (cpu != fp_cpu) {
+			bench_fingerprint_get(&fp, cpu);
+			fp_cpu = cpu;
+		}
+		char ck[160];
+		if (bench_cache_key(pt.desc, &pt.opt, &fp, ck, sizeof ck) < 0) {
+			no_key ++;
+			continue;
+		}
+		snprintf(keys[i], sizeof keys[i], "%s %s", pt.key, ck);
+		if (bench_cache_get(&cache, keys[i], -1,
+			pt.desc, &pt.opt, &j->res) == 0)
+		{
+			keys[i][0] = 0;
+			done[i] = 1;
+			resumed ++;
+		}
+	}
+
+	/* No output until all points are done: they may run on this
+	   CPU. */
+	size_t measured = 0;
+	int put_failed = 0;
+	for (size_t i = 0; i < sw->num_points; i ++) {
+		if (done[i]) {
+			continue;
+		}
+		bench_sweep_point pt;
+		bench_sweep_point_get(sw, i, &pt);
+		bench_job *j = &jobs[i];
+		bench_child ch;
+		j->err = bench_child_start(&ch, pt.desc, &pt.opt,
+			pt.cpu >= 0 ? pt.cpu : here, 0) < 0
+			|| bench_child_finish(&ch, &j->res) < 0;
+		j->status = ch.status;
+		measured ++;
+		if (!j->err && keys[i][0] != 0
+			&& bench_cache_put(&cache, keys[i], &j->res) < 0)
+		{
+			put_failed = 1;
+		}
+	}
+	fprintf(log, "%zu of %zu points measured\n",
+		measured, sw->num_points);
+	if (resumed > 0) {
+		fprintf(log, "%zu of %zu points taken from %s\n",
+			resumed, sw->num_points, ckpt);
+	}
+	if (no_key > 0) {
+		fprintf(stderr, "%zu points not checkpointed (code not in the"
+			" symbol tables; stripped?)\n", no_key);
+	}
+	if (put_failed) {
+		fprintf(stderr, "%s: cannot write checkpoint\n", ckpt);
+	}
+	if (ckpt != NULL) {
+		bench_cache_close(&cache);
+	}
+	free(keys);
+	free(done);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Benchmark harness: time-budgeted runs.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/*
+ * Append the samples of 'r' (taken after those of 'res') to 'res'.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int
+merge_result(bench_result *res, const bench_result *r)
+{
+	size_t n = res->num_samples + r->num_samples;
+	double *s = realloc(res->samples, n * sizeof *s);
+	if (s == NULL) {
+		return -1;
+	}
+	memcpy(s + res->num_samples, r->samples,
+		r->num_samples * sizeof *s);
+	res->samples = s;
+	res->num_samples = n;
+	res->migrations += r->migrations;
+	res->cpu = r->cpu;
+	res->check = r->check;
+	bench_stats_compute(res->samples, res->num_samples, &res->stats);
+	return 0;
+}
+
+int
+bench_run_timed(bench_job *jobs, size_t num_jobs, const bench_opts *opt,
+	double seconds, FILE *log)
+{
+	double start = now();
+	double *cost = calloc(num_jobs + 1, sizeof *cost);
+	double *spread = calloc(num_jobs + 1, sizeof *spread);
+	size_t *extra = calloc(num_jobs + 1, sizeof *extra);
+	if (cost == NULL || spread == NULL || extra == NULL) {
+		free(cost);
+		free(spread);
+		free(extra);
+		return -1;
+	}
+	bench_opts po = *opt;
+	po.samples = BENCH_PILOT_SAMPLES;
+	po.adaptive = 0;
+
+	/* Pilot runs: cost per sample (warmup included) and spread. */
+	for (size_t i = 0; i < num_jobs; i ++) {
+		bench_job *j = &jobs[i];
+		j->err = 0;
+		j->status = 0;
+		double t0 = now();
+		j->err = bench_run(j->desc, &po, &j->res) < 0;
+		double t1 = now();
+		if (j->err) {
+			continue;
+		}
+		cost[i] = (t1 - t0) / (double)(po.warmup + po.samples);
+		if (cost[i] < 1e-9) {
+			cost[i] = 1e-9;
+		}
+		const bench_stats *st = &j->res.stats;
+		spread[i] = st->median > 0.0
+			? (st->p75 - st->p25) / st->median : 0.0;
+		/* A spread below the resolution of the pilot still gets
+		   some samples. */
+		if (spread[i] < 1e-3) {
+			spread[i] = 1e-3;
+		}
+	}
+
+	/* Neyman allocation of what is left, once the warmups of the
+	   second runs are paid for: the variance of the medians,
+	   sum(s_i^2 / n_i), is minimal under sum(n_i * t_i) = left for
+	   n_i proportional to s_i / sqrt(t_i). */
+	double left = seconds - (now() - start);
+	double sum = 0.0;
+	for (size_t i = 0; i < num_jobs; i ++) {
+		if (!jobs[i].err) {
+			left -= cost[i] * (double)po.warmup;
+			sum += spread[i] * sqrt(cost[i]);
+		}
+	}
+	for (size_t i = 0; i < num_jobs; i ++) {
+		extra[i] = 0;
+		if (jobs[i].err) {
+			continue;
+		}
+		double n = 0.0;
+		if (left > 0.0 && sum > 0.0) {
+			n = left * spread[i] / sqrt(cost[i]) / sum;
+		}
+		double max = (double)(BENCH_TIMED_MAX_SAMPLES - po.samples);
+		extra[i] = (size_t)(n < max ? n : max);
+	}
+	for (size_t i = 0; i < num_jobs; i ++) {
+		bench_job *j = &jobs[i];
+		if (j->err || extra[i] == 0) {
+			continue;
+		}
+		bench_opts eo = po;
+		eo.samples = extra[i];
+		bench_result r;
+		if (bench_run(j->desc, &eo, &r) < 0) {
+			/* Keep the pilot samples. */
+			continue;
+		}
+		merge_result(&j->res, &r);
+		bench_result_free(&r);
+	}
+	double used = now() - start;
+
+	/* The plan is printed only once all runs are done, so that no
+	   output comes between them. */
+	if (log != NULL) {
+		fprintf(log, "time budget %.1f s, %.1f s after pilot runs\n",
+			seconds, left > 0.0 ? left : 0.0);
+		for (size_t i = 0; i < num_jobs; i ++) {
+			bench_job *j = &jobs[i];
+			if (j->err) {
+				continue;
+			}
+			fprintf(log, "  %-16s spread %6.2f%%, %9.2f us/sample,"
+				" %zu samples\n", j->desc->name,
+				100.0 * spread[i], 1e6 * cost[i],
+				po.samples + extra[i]);
+		}
+		fprintf(log, "time used %.1f s\n", used);
+	}
+	free(cost);
+	free(spread);
+	free(extra);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * core_cycles() returns the current value of the in-CPU cycle counter.
+ * It is meant to be included by benchmark and instrumentation code; it
+ * should work on x86 (32-bit and 64-bit), aarch64 and riscv64, though in
+ * all three cases some superuser-level operations must first be done to
+ * allow access to the counter (see README.md).
+ *
+ * If CORE_CYCLES_TIMER is defined (to any value) before this file is
+ * included, then the fixed-frequency timer of the platform is used
+ * instead (rdtsc on x86, cntvct_el0 on aarch64, rdtime on riscv64). That
+ * timer does NOT count cycles, but it is readable from userland without
+ * any special setup, which makes it a convenient fallback for binaries
+ * that must run on machines where the cycle counter was not enabled.
+ *
+ * CORE_CYCLES_BACKEND is defined to a string literal that names the
+ * access method selected at compile time.
+ */
+
+#ifndef CORE_CYCLES_H__
+#define CORE_CYCLES_H__
+
+#include <stdint.h>
+
+#if defined __x86_64__ || defined _M_X64 || defined __i386__ || defined _M_IX86
+/*
+ * x86: the cycle counter is accessible with the rdpmc instruction. Access
+ * must first be allowed, which, on Linux, is done with:
+ *   echo 2 > /sys/bus/event_source/devices/cpu/rdpmc
+ * (only root can perform this write; the setting is "volatile" in that
+ * it lasts only until next reboot).
+ */
+#include <immintrin.h>
+#ifdef _MSC_VER
+/* On Windows, the intrinsic is called __readpmc(), not __rdpmc(). But it
+   will usually imply a crash, since Windows does no enable access to the
+   performance counters. */
+#ifndef __rdpmc
+#define __rdpmc   __readpmc
+#endif
+#else
+#include <x86intrin.h>
+#endif
+#if defined __GNUC__ || defined __clang__
+__attribute__((target("sse2")))
+#endif
+static inline uint64_t
+core_cycles(void)
+{
+	_mm_lfence();
+#ifdef CORE_CYCLES_TIMER
+	return __rdtsc();
+#else
+	return __rdpmc(0x40000001);
+#endif
+}
+#ifdef CORE_CYCLES_TIMER
+#define CORE_CYCLES_BACKEND   "rdtsc"
+#else
+#define CORE_CYCLES_BACKEND   "rdpmc"
+#endif
+
+#elif defined __aarch64__ && (defined __GNUC__ || defined __clang__)
+/*
+ * ARMv8, 64-bit (aarch64): the cycle counter is pmccntr_el0; it must be
+ * enabled through dedicated kernel code. The generic timer (cntvct_el0)
+ * is normally readable from userland.
+ */
+static inline uint64_t
+core_cycles(void)
+{
+	uint64_t x;
+#ifdef CORE_CYCLES_TIMER
+	__asm__ __volatile__ ("isb\n\tmrs %0, cntvct_el0" : "=r" (x) : : );
+#else
+	__asm__ __volatile__ ("dsb sy\n\tmrs %0, pmccntr_el0" : "=r" (x) : : );
+#endif
+	return x;
+}
+#ifdef CORE_CYCLES_TIMER
+#define CORE_CYCLES_BACKEND   "cntvct_el0"
+#else
+#define CORE_CYCLES_BACKEND   "pmccntr_el0"
+#endif
+
+#elif defined __riscv && defined __riscv_xlen && __riscv_xlen >= 64
+/*
+ * RISC-V, 64-bit (rv64gc): the cycle counter is read with the
+ * pseudo-instruction rdcycle (which is just an alias for csrrs with
+ * the appropriate register identifier). The cycle counter must be enabled
+ * and its userland access allowed, which requires machine-level actions
+ * that can be triggered from dedicated kernel code.
+ */
+static inline uint64_t
+core_cycles(void)
+{
+	/* We don't use a memory fence here because the RISC-V ISA
+	   already requires the CPU to enforce appropriate ordering for
+	   this access. */
+	uint64_t x;
+#ifdef CORE_CYCLES_TIMER
+	__asm__ __volatile__ ("rdtime %0" : "=r" (x));
+#else
+	__asm__ __volatile__ ("rdcycle %0" : "=r" (x));
+#endif
+	return x;
+}
+#ifdef CORE_CYCLES_TIMER
+#define CORE_CYCLES_BACKEND   "rdtime"
+#else
+#define CORE_CYCLES_BACKEND   "rdcycle"
+#endif
+
+#else
+#error Architecture is not supported.
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * cycprof: draining of the per-thread rings, background collector
+ * thread, and basic sinks (memory, raw file).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cycprof.h"
+
+size_t
+cyc_drain(const cyc_sink *sink)
+{
+	size_t total = 0;
+	size_t nt = cyc_thread_count();
+	for (size_t i = 0; i < nt; i ++) {
+		cyc_thread *t = cyc_thread_get(i);
+		uint64_t tail = t->tail;
+		uint64_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			/* Ring contents may wrap around; we send them as
+			   up to two contiguous batches. */
+			size_t off = (size_t)(tail & (CYCPROF_THREAD_EVENTS - 1));
+			size_t num = (size_t)(head - tail);
+			if (num > CYCPROF_THREAD_EVENTS - off) {
+				num = CYCPROF_THREAD_EVENTS - off;
+			}
+			sink->write(sink->ctx, t, &t->ev[off], num);
+			tail += num;
+			total += num;
+		}
+		__atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
+	}
+	if (sink->flush != NULL) {
+		sink->flush(sink->ctx);
+	}
+	return total;
+}
+
+static struct {
+	pthread_t thread;
+	const cyc_sink *sink;
+	unsigned period_us;
+	int running;
+	int stop;
+} collector;
+
+static void *
+collector_main(void *arg)
+{
+	(void)arg;
+	struct timespec ts;
+	ts.tv_sec = collector.period_us / 1000000;
+	ts.tv_nsec = (long)(collector.period_us % 1000000) * 1000;
+	while (!__atomic_load_n(&collector.stop, __ATOMIC_ACQUIRE)) {
+		cyc_drain(collector.sink);
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+		ts.tv_sec = collector.period_us / 1000000;
+		ts.tv_nsec = (long)(collector.period_us % 1000000) * 1000;
+	}
+	cyc_drain(collector.sink);
+	return NULL;
+}
+
+int
+cyc_collector_start(const cyc_sink *sink, unsigned period_us)
+{
+	if (collector.running) {
+		return -1;
+	}
+	collector.sink = sink;
+	collector.period_us = period_us;
+	collector.stop = 0;
+	if (pthread_create(&collector.thread, NULL, &collector_main, NULL) != 0) {
+		return -1;
+	}
+	collector.running = 1;
+	return 0;
+}
+
+void
+cyc_collector_stop(void)
+{
+	if (!collector.running) {
+		return;
+	}
+	__atomic_store_n(&collector.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(collector.thread, NULL);
+	collector.running = 0;
+}
+
+static void
+mem_sink_write(void *ctx, const cyc_thread *t, const cyc_event *ev, size_t num)
+{
+	cyc_mem_sink *ms = ctx;
+	if (num > ms->cap - ms->len) {
+		size_t ncap = ms->cap < 4096 ? 4096 : ms->cap;
+		while (num > ncap - ms->len) {
+			ncap <<= 1;
+		}
+		cyc_event *nev = realloc(ms->ev, ncap * sizeof *nev);
+		if (nev == NULL) {
+			ms->lost += num;
+			return;
+		}
+		ms->ev = nev;
+		uint32_t *nth = realloc(ms->thread, ncap * sizeof *nth);
+		if (nth == NULL) {
+			ms->lost += num;
+			return;
+		}
+		ms->thread = nth;
+		ms->cap = ncap;
+	}
+	memcpy(ms->ev + ms->len, ev, num * sizeof *ev);
+	for (size_t i = 0; i < num; i ++) {
+		ms->thread[ms->len + i] = t->index;
+	}
+	ms->len += num;
+}
+
+void
+cyc_mem_sink_init(cyc_sink *sink, cyc_mem_sink *ms)
+{
+	memset(ms, 0, sizeof *ms);
+	sink->write = &mem_sink_write;
+	sink->flush = NULL;
+	sink->ctx = ms;
+}
+
+void
+cyc_mem_sink_free(cyc_mem_sink *ms)
+{
+	free(ms->ev);
+	free(ms->thread);
+	memset(ms, 0, sizeof *ms);
+}
+
+static void
+file_sink_write(void *ctx, const cyc_thread *t, const cyc_event *ev, size_t num)
+{
+	FILE *f = ctx;
+	for (size_t i = 0; i < num; i ++) {
+		unsigned char buf[24];
+		uint32_t x32;
+		x32 = t->index;
+		memcpy(buf, &x32, 4);
+		memcpy(buf + 4, &ev[i].site, 4);
+		memcpy(buf + 8, &ev[i].start, 8);
+		memcpy(buf + 16, &ev[i].end, 8);
+		fwrite(buf, 1, sizeof buf, f);
+	}
+}
+
+void
+cyc_file_sink_init(cyc_sink *sink, FILE *f)
+{
+	sink->write = &file_sink_write;
+	sink->flush = NULL;
+	sink->ctx = f;
+}
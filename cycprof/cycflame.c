@@ -0,0 +1,324 @@
+/*
+ * cycflame: render folded stacks (as written by cyc_func_folded(), or by
+ * any other tool that emits that format) into an SVG flame graph.
+ *
+ * Usage: cycflame [ -t title ] [ -w width ] [ -o out.svg ] [ folded ]
+ *
+ * Each input line is a call path (function names separated by ';'),
+ * then a space and a weight (here, exclusive cycles). The input is read
+ * from standard input if no file is given. In the output, each box is a
+ * call path; its width is proportional to the inclusive weight of that
+ * path (its own weight plus that of all paths that extend it), and
+ * callees are stacked above their callers. Siblings are sorted by name,
+ * so the horizontal order has no meaning beyond grouping. Hovering a box
+ * shows the function name, cycles and percentage of the total.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	char *name;
+	uint64_t total;
+	size_t parent;
+	size_t child;
+	size_t sibling;
+} node;
+
+static node *nodes;
+static size_t num_nodes, cap_nodes;
+
+static void *
+xrealloc(void *p, size_t len)
+{
+	p = realloc(p, len);
+	if (p == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/*
+ * Find or create the child of 'parent' with the provided name (of
+ * length 'len', not NUL-terminated). Node 0 is the root.
+ */
+static size_t
+get_child(size_t parent, const char *name, size_t len)
+{
+	for (size_t c = nodes[parent].child; c != 0; c = nodes[c].sibling) {
+		if (strlen(nodes[c].name) == len
+			&& memcmp(nodes[c].name, name, len) == 0)
+		{
+			return c;
+		}
+	}
+	if (num_nodes == cap_nodes) {
+		cap_nodes = cap_nodes == 0 ? 1024 : cap_nodes << 1;
+		nodes = xrealloc(nodes, cap_nodes * sizeof *nodes);
+	}
+	size_t c = num_nodes ++;
+	node *n = &nodes[c];
+	n->name = xrealloc(NULL, len + 1);
+	memcpy(n->name, name, len);
+	n->name[len] = 0;
+	n->total = 0;
+	n->parent = parent;
+	n->child = 0;
+	n->sibling = nodes[parent].child;
+	nodes[parent].child = c;
+	return c;
+}
+
+static void
+add_line(char *line)
+{
+	size_t len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		line[-- len] = 0;
+	}
+	char *sp = strrchr(line, ' ');
+	if (sp == NULL) {
+		return;
+	}
+	char *end;
+	unsigned long long w = strtoull(sp + 1, &end, 10);
+	if (end == sp + 1 || *end != 0 || w == 0) {
+		return;
+	}
+	*sp = 0;
+	size_t cur = 0;
+	nodes[0].total += w;
+	const char *p = line;
+	for (;;) {
+		const char *q = strchr(p, ';');
+		size_t n = q != NULL ? (size_t)(q - p) : strlen(p);
+		if (n > 0) {
+			cur = get_child(cur, p, n);
+			nodes[cur].total += w;
+		}
+		if (q == NULL) {
+			break;
+		}
+		p = q + 1;
+	}
+}
+
+static int
+cmp_name(const void *v1, const void *v2)
+{
+	size_t c1 = *(const size_t *)v1;
+	size_t c2 = *(const size_t *)v2;
+	return strcmp(nodes[c1].name, nodes[c2].name);
+}
+
+/* Reorder the children of every node by name (recursively). */
+static void
+sort_children(size_t id)
+{
+	size_t n = 0;
+	for (size_t c = nodes[id].child; c != 0; c = nodes[c].sibling) {
+		n ++;
+	}
+	if (n == 0) {
+		return;
+	}
+	size_t *tmp = xrealloc(NULL, n * sizeof *tmp);
+	n = 0;
+	for (size_t c = nodes[id].child; c != 0; c = nodes[c].sibling) {
+		tmp[n ++] = c;
+	}
+	qsort(tmp, n, sizeof *tmp, &cmp_name);
+	nodes[id].child = tmp[0];
+	for (size_t i = 0; i < n; i ++) {
+		nodes[tmp[i]].sibling = i + 1 < n ? tmp[i + 1] : 0;
+	}
+	free(tmp);
+	for (size_t c = nodes[id].child; c != 0; c = nodes[c].sibling) {
+		sort_children(c);
+	}
+}
+
+static size_t
+max_depth(size_t id)
+{
+	size_t d = 0;
+	for (size_t c = nodes[id].child; c != 0; c = nodes[c].sibling) {
+		size_t e = 1 + max_depth(c);
+		if (e > d) {
+			d = e;
+		}
+	}
+	return d;
+}
+
+static void
+xml_text(FILE *out, const char *s, size_t max)
+{
+	for (size_t i = 0; s[i] != 0 && i < max; i ++) {
+		switch (s[i]) {
+		case '<':  fputs("&lt;", out); break;
+		case '>':  fputs("&gt;", out); break;
+		case '&':  fputs("&amp;", out); break;
+		case '"':  fputs("&quot;", out); break;
+		default:   fputc(s[i], out); break;
+		}
+	}
+}
+
+#define FRAME_H    16
+#define PAD_TOP    32
+#define PAD_SIDE   10
+#define CHAR_W     7.0
+#define MIN_W      0.1
+
+/* Warm colour derived from the name, so that it is stable across runs. */
+static void
+name_color(const char *name, unsigned *r, unsigned *g, unsigned *b)
+{
+	uint32_t h = 2166136261u;
+	for (const char *p = name; *p != 0; p ++) {
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	}
+	*r = 205 + (h % 50);
+	*g = (h >> 8) % 230;
+	*b = (h >> 16) % 55;
+}
+
+static void
+draw(FILE *out, size_t id, double x, size_t depth, double scale,
+	size_t height)
+{
+	const node *n = &nodes[id];
+	double w = (double)n->total * scale;
+	if (w < MIN_W) {
+		return;
+	}
+	if (id != 0) {
+		double y = (double)(height - depth) * FRAME_H + PAD_TOP;
+		unsigned r, g, b;
+		name_color(n->name, &r, &g, &b);
+		fprintf(out, "<g><title>");
+		xml_text(out, n->name, (size_t)-1);
+		fprintf(out, " (%llu cycles, %.2f%%)</title>",
+			(unsigned long long)n->total,
+			100.0 * (double)n->total / (double)nodes[0].total);
+		fprintf(out, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\""
+			" height=\"%d\" fill=\"rgb(%u,%u,%u)\" rx=\"2\"/>",
+			x, y, w, FRAME_H - 1, r, g, b);
+		size_t chars = (size_t)((w - 6.0) / CHAR_W);
+		if (chars >= 3) {
+			fprintf(out, "<text x=\"%.1f\" y=\"%.1f\">",
+				x + 3.0, y + FRAME_H - 5);
+			if (strlen(n->name) <= chars) {
+				xml_text(out, n->name, chars);
+			} else {
+				xml_text(out, n->name, chars - 2);
+				fputs("..", out);
+			}
+			fputs("</text>", out);
+		}
+		fprintf(out, "</g>\n");
+	}
+	for (size_t c = n->child; c != 0; c = nodes[c].sibling) {
+		draw(out, c, x, depth + 1, scale, height);
+		x += (double)nodes[c].total * scale;
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: cycflame [ -t title ] [ -w width ] [ -o out.svg ] [ folded ]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *title = "Flame graph (exclusive cycles)";
+	const char *out_name = NULL;
+	unsigned width = 1200;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:w:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			title = optarg;
+			break;
+		case 'w':
+			width = (unsigned)atoi(optarg);
+			break;
+		case 'o':
+			out_name = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc - 1 || width < 100) {
+		usage();
+	}
+	FILE *in = stdin;
+	if (optind == argc - 1) {
+		in = fopen(argv[optind], "r");
+		if (in == NULL) {
+			perror(argv[optind]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Root node. */
+	cap_nodes = 1024;
+	nodes = xrealloc(NULL, cap_nodes * sizeof *nodes);
+	memset(&nodes[0], 0, sizeof nodes[0]);
+	nodes[0].name = "all";
+	num_nodes = 1;
+
+	char *line = NULL;
+	size_t line_cap = 0;
+	while (getline(&line, &line_cap, in) >= 0) {
+		add_line(line);
+	}
+	free(line);
+	if (in != stdin) {
+		fclose(in);
+	}
+	sort_children(0);
+
+	FILE *out = stdout;
+	if (out_name != NULL) {
+		out = fopen(out_name, "w");
+		if (out == NULL) {
+			perror(out_name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t height = max_depth(0);
+	unsigned img_h = (unsigned)(height * FRAME_H + PAD_TOP + FRAME_H);
+	fprintf(out, "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+		"<svg version=\"1.1\" width=\"%u\" height=\"%u\""
+		" xmlns=\"http://www.w3.org/2000/svg\">\n"
+		"<style>text { font-family: monospace; font-size: 12px; }"
+		"</style>\n"
+		"<rect width=\"100%%\" height=\"100%%\" fill=\"#f8f8f0\"/>\n"
+		"<text x=\"%u\" y=\"20\" text-anchor=\"middle\""
+		" style=\"font-size: 16px\">", width, img_h, width / 2);
+	xml_text(out, title, (size_t)-1);
+	fprintf(out, " (%llu cycles)</text>\n",
+		(unsigned long long)nodes[0].total);
+	if (nodes[0].total > 0) {
+		double scale = (double)(width - 2 * PAD_SIDE)
+			/ (double)nodes[0].total;
+		draw(out, 0, PAD_SIDE, 0, scale, height);
+	}
+	fprintf(out, "</svg>\n");
+	if (out != stdout && fclose(out) != 0) {
+		perror(out_name);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
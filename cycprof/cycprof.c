@@ -0,0 +1,217 @@
+/*
+ * cycprof: thread and site registries, and summary output. The hot path
+ * (event recording) is inline in cycprof.h; draining of the rings is in
+ * collect.c.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cycprof.h"
+
+__thread cyc_thread *cyc_self;
+
+unsigned cyc_record_mode = CYC_RECORD_EVENTS;
+
+/*
+ * Thread buffers are preallocated as a static array: this keeps the
+ * memory alive after thread exit, and the untouched parts of it are
+ * never mapped in RAM by the OS.
+ */
+static cyc_thread threads[CYCPROF_MAX_THREADS];
+static uint32_t num_threads;
+
+/* The dummy buffer is marked as full when first handed out; it only
+   counts dropped events. */
+static cyc_thread overflow_thread;
+
+/* Registered sites; index 0 is unused. Identifiers lost to a
+   concurrent registration point to unused_site. */
+static cyc_site *sites[CYCPROF_MAX_SITES];
+static uint32_t num_sites;
+static cyc_site unused_site;
+
+cyc_thread *
+cyc_thread_attach(void)
+{
+	cyc_thread *t = cyc_self;
+	if (t != NULL) {
+		return t;
+	}
+	uint32_t n = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+	if (n >= CYCPROF_MAX_THREADS) {
+		t = &overflow_thread;
+		__atomic_store_n(&t->head, CYCPROF_THREAD_EVENTS,
+			__ATOMIC_RELAXED);
+		t->index = (uint32_t)-1;
+		t->tid = -1;
+		t->rng = 1;
+	} else {
+		t = &threads[n];
+		t->index = n;
+		t->tid = (int32_t)syscall(SYS_gettid);
+		/* PRNG seed for random sampling; it must not be zero. */
+		t->rng = (core_cycles() ^ ((uint64_t)t->tid << 32)) | 1;
+	}
+	cyc_self = t;
+	return t;
+}
+
+uint32_t
+cyc_current_cpu(void)
+{
+	int cpu = sched_getcpu();
+	return cpu < 0 ? CYC_CPU_UNKNOWN : (uint32_t)cpu;
+}
+
+uint32_t
+cyc_site_register(cyc_site *site)
+{
+	uint32_t id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+	if (id != 0) {
+		return id;
+	}
+	if (site->period == 0) {
+		site->period = __atomic_load_n(
+			&cyc_default_period, __ATOMIC_RELAXED);
+	}
+	uint32_t n = __atomic_add_fetch(&num_sites, 1, __ATOMIC_RELAXED);
+	if (n >= CYCPROF_MAX_SITES - 1) {
+		/* Table is full: all extra sites are merged into the
+		   last identifier, which is reserved for them and never
+		   gets a name (sites[] keeps NULL there). */
+		n = CYCPROF_MAX_SITES - 1;
+		__atomic_store_n(&num_sites, n, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->id, n, __ATOMIC_RELEASE);
+		return n;
+	}
+	uint32_t expected = 0;
+	if (__atomic_compare_exchange_n(&site->id, &expected, n, 0,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&sites[n], site, __ATOMIC_RELEASE);
+		return n;
+	}
+	/* Another thread registered the site concurrently; identifier
+	   n remains unused (and unnamed). It is marked as such so that
+	   it is not mistaken for a site still being published. */
+	__atomic_store_n(&sites[n], &unused_site, __ATOMIC_RELEASE);
+	return expected;
+}
+
+size_t
+cyc_thread_count(void)
+{
+	uint32_t n = __atomic_load_n(&num_threads, __ATOMIC_ACQUIRE);
+	return n < CYCPROF_MAX_THREADS ? n : CYCPROF_MAX_THREADS;
+}
+
+cyc_thread *
+cyc_thread_get(size_t index)
+{
+	if (index >= cyc_thread_count()) {
+		return NULL;
+	}
+	return &threads[index];
+}
+
+uint32_t
+cyc_site_count(void)
+{
+	uint32_t n = __atomic_load_n(&num_sites, __ATOMIC_ACQUIRE);
+	return n < CYCPROF_MAX_SITES ? n : CYCPROF_MAX_SITES - 1;
+}
+
+const cyc_site *
+cyc_site_get(uint32_t id)
+{
+	if (id == 0 || id >= CYCPROF_MAX_SITES) {
+		return NULL;
+	}
+	const cyc_site *s = __atomic_load_n(&sites[id], __ATOMIC_ACQUIRE);
+	return s == &unused_site ? NULL : s;
+}
+
+int
+cyc_site_pending(uint32_t id)
+{
+	if (id == 0 || id >= CYCPROF_MAX_SITES - 1 || id > cyc_site_count()) {
+		return 0;
+	}
+	return __atomic_load_n(&sites[id], __ATOMIC_ACQUIRE) == NULL;
+}
+
+typedef struct {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} site_summary;
+
+void
+cyc_region_summary(FILE *out)
+{
+	uint32_t ns = cyc_site_count();
+	site_summary *ss = calloc(ns + 1, sizeof *ss);
+	if (ss == NULL) {
+		return;
+	}
+	uint64_t dropped = overflow_thread.dropped;
+	size_t nt = cyc_thread_count();
+	for (size_t i = 0; i < nt; i ++) {
+		cyc_thread *t = &threads[i];
+		uint64_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+		dropped += __atomic_load_n(&t->dropped, __ATOMIC_RELAXED);
+		for (uint64_t j = t->tail; j != head; j ++) {
+			const cyc_event *e =
+				&t->ev[j & (CYCPROF_THREAD_EVENTS - 1)];
+			if (e->site > ns) {
+				continue;
+			}
+			site_summary *s = &ss[e->site];
+			uint64_t d = e->end - e->start;
+			if (s->count == 0 || d < s->min) {
+				s->min = d;
+			}
+			if (d > s->max) {
+				s->max = d;
+			}
+			s->count ++;
+			s->total += d;
+		}
+	}
+	fprintf(out, "%-24s %10s %14s %10s %10s %10s\n",
+		"site", "count", "total", "mean", "min", "max");
+	for (uint32_t id = 1; id <= ns; id ++) {
+		site_summary *s = &ss[id];
+		if (s->count == 0) {
+			continue;
+		}
+		const cyc_site *site = cyc_site_get(id);
+		fprintf(out, "%-24s %10llu %14llu %10.1f %10llu %10llu\n",
+			site != NULL ? site->name : "?",
+			(unsigned long long)s->count,
+			(unsigned long long)s->total,
+			(double)s->total / (double)s->count,
+			(unsigned long long)s->min,
+			(unsigned long long)s->max);
+	}
+	fprintf(out, "dropped events: %llu\n", (unsigned long long)dropped);
+	free(ss);
+}
+
+uint64_t
+cyc_dropped_total(void)
+{
+	uint64_t dropped = __atomic_load_n(
+		&overflow_thread.dropped, __ATOMIC_RELAXED);
+	size_t nt = cyc_thread_count();
+	for (size_t i = 0; i < nt; i ++) {
+		dropped += __atomic_load_n(&threads[i].dropped, __ATOMIC_RELAXED);
+	}
+	return dropped;
+}
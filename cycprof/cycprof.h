@@ -0,0 +1,704 @@
+/*
+ * cycprof: low-overhead cycle-level instrumentation of code regions.
+ *
+ * A "region" is a piece of code delimited by CYC_REGION_BEGIN() and
+ * CYC_REGION_END() (in C) or by the scope of a CYC_REGION() guard (in
+ * C++). Each execution of a region records an event (site id, start
+ * cycle, end cycle) into a preallocated buffer owned by the current
+ * thread. The recording path uses no lock, no memory allocation and no
+ * system call: it reads the cycle counter twice (with core_cycles()),
+ * then performs a handful of stores into the thread's buffer. Buffers
+ * are rings that a background collector thread may drain into a sink
+ * (memory, file...); when a ring is full, because it is not drained or
+ * because the producer outruns the collector, further events are
+ * dropped and counted, but the producer never blocks.
+ *
+ * Each thread gets its buffer from a static pool on first use; the pool
+ * has room for CYCPROF_MAX_THREADS threads over the lifetime of the
+ * process (slots are not reused when threads exit, so that events of
+ * finished threads can still be read). Sites are declared statically by
+ * the macros and receive a numerical identifier when first executed.
+ *
+ * If CYCPROF_DISABLE is defined before this header is included, then
+ * all region macros expand to nothing, and the instrumentation has no
+ * cost at all.
+ */
+
+#ifndef CYCPROF_H__
+#define CYCPROF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../core_cycles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sizing parameters. The library and all code that uses the region
+ * macros MUST be compiled with the same values.
+ */
+#ifndef CYCPROF_MAX_SITES
+#define CYCPROF_MAX_SITES       1024
+#endif
+#ifndef CYCPROF_MAX_THREADS
+#define CYCPROF_MAX_THREADS     64
+#endif
+#ifndef CYCPROF_THREAD_EVENTS
+#define CYCPROF_THREAD_EVENTS   16384
+#endif
+#if (CYCPROF_THREAD_EVENTS & (CYCPROF_THREAD_EVENTS - 1)) != 0
+#error CYCPROF_THREAD_EVENTS must be a power of two.
+#endif
+#ifndef CYCPROF_MAX_HISTS
+#define CYCPROF_MAX_HISTS       2048
+#endif
+#ifndef CYCPROF_MAX_FUNCS
+#define CYCPROF_MAX_FUNCS       4096
+#endif
+#if (CYCPROF_MAX_FUNCS & (CYCPROF_MAX_FUNCS - 1)) != 0
+#error CYCPROF_MAX_FUNCS must be a power of two.
+#endif
+#ifndef CYCPROF_FUNC_DEPTH
+#define CYCPROF_FUNC_DEPTH      256
+#endif
+#ifndef CYCPROF_CCT_NODES
+#define CYCPROF_CCT_NODES       4096
+#endif
+
+/*
+ * A static call site. Sites are defined by the region macros; the 'id'
+ * field is zero until the site is first executed, at which point it is
+ * registered and receives an identifier in the 1..CYCPROF_MAX_SITES-2
+ * range; when the table is full, further sites all share the reserved
+ * identifier CYCPROF_MAX_SITES-1, which is reported without a name.
+ * 'period' is the sampling period: if greater than 1, only about
+ * one execution out of 'period' is measured (see cyc_set_sampling());
+ * sites sharing the reserved identifier keep the default period they
+ * got at registration.
+ */
+typedef struct {
+	const char *name;
+	const char *file;
+	int line;
+	uint32_t id;
+	uint32_t period;
+} cyc_site;
+
+/*
+ * A recorded event: execution of a region from cycle 'start' to cycle
+ * 'end' (both read with core_cycles()). 'cpu' is the CPU on which the
+ * region ended, or CYC_CPU_UNKNOWN. Since cycle counters are per-core,
+ * exporters use it to correct for per-CPU counter offsets.
+ */
+typedef struct {
+	uint32_t site;
+	uint32_t cpu;
+	uint64_t start;
+	uint64_t end;
+} cyc_event;
+
+#define CYC_CPU_UNKNOWN   ((uint32_t)-1)
+
+/*
+ * Log-bucketed histogram of region lengths (in cycles), in the style of
+ * HdrHistogram: values below 2^CYC_HIST_SUB_BITS have their own bucket;
+ * above that, each power-of-two range is split into 2^CYC_HIST_SUB_BITS
+ * equal sub-buckets, so that the relative error on any reported value
+ * is below 2^-CYC_HIST_SUB_BITS (about 6%).
+ */
+#define CYC_HIST_SUB_BITS   4
+#define CYC_HIST_BUCKETS    ((65 - CYC_HIST_SUB_BITS) << CYC_HIST_SUB_BITS)
+
+/*
+ * 'count' and 'sum' are over measured executions; 'wcount' and 'wsum'
+ * are the same values scaled by the sampling weights, i.e. unbiased
+ * estimates of the number of executions and of their total cycles. The
+ * buckets count measured executions; since sampling does not depend on
+ * the region length, quantiles need no scaling.
+ */
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t wcount;
+	uint64_t wsum;
+	uint64_t max;
+	uint64_t bucket[CYC_HIST_BUCKETS];
+} cyc_hist;
+
+static inline unsigned
+cyc_hist_bucket(uint64_t x)
+{
+	if (x < ((uint64_t)1 << CYC_HIST_SUB_BITS)) {
+		return (unsigned)x;
+	}
+	unsigned msb = 63 - (unsigned)__builtin_clzll(x);
+	return ((msb - CYC_HIST_SUB_BITS + 1) << CYC_HIST_SUB_BITS)
+		| (unsigned)((x >> (msb - CYC_HIST_SUB_BITS))
+		& (((uint64_t)1 << CYC_HIST_SUB_BITS) - 1));
+}
+
+/*
+ * Per-site sampling state of a thread: 'countdown' is the number of
+ * executions until the next measured one; 'interval' is the number of
+ * executions between the previous measured one and the next; 'weight'
+ * is the number of executions represented by the current measurement
+ * (0 once it has been recorded).
+ */
+typedef struct {
+	uint32_t countdown;
+	uint32_t interval;
+	uint32_t weight;
+} cyc_sampler;
+
+/*
+ * Per-thread state. Events go into a single-producer single-consumer
+ * ring; per-site histograms (allocated from a static pool when a site
+ * is first recorded by the thread) are in 'hist[]'; per-site sampling
+ * state is in 'sampler[]', with a per-thread PRNG state in 'rng'.
+ *
+ * Ring: only the owning thread writes events and advances 'head' (with
+ * release semantics); a single consumer (normally the collector thread,
+ * see cyc_collector_start()) reads events between 'tail' and 'head',
+ * then advances 'tail'. Counters are free-running; the ring index is
+ * the counter modulo CYCPROF_THREAD_EVENTS (a power of two). The
+ * producer keeps a cached copy of 'tail' so that it reads the
+ * consumer's cache line only when the ring looks full. When the ring is
+ * really full, the event is dropped and 'dropped' is incremented.
+ */
+typedef struct {
+	uint64_t head;
+	uint64_t tail_cache;
+	uint64_t dropped;
+	uint32_t index;
+	int32_t tid;
+	uint64_t rng;
+	cyc_hist *hist[CYCPROF_MAX_SITES];
+	cyc_sampler sampler[CYCPROF_MAX_SITES];
+	uint64_t tail __attribute__((aligned(64)));
+	cyc_event ev[CYCPROF_THREAD_EVENTS] __attribute__((aligned(64)));
+} cyc_thread;
+
+/* Buffer of the current thread (NULL until first use). */
+extern __thread cyc_thread *cyc_self;
+
+/*
+ * Get the buffer for the current thread, allocating a slot from the
+ * static pool if needed. This is called automatically on the first
+ * recorded event in each thread, but may be called explicitly at thread
+ * start to keep that (small) cost out of the first measured region. If
+ * the pool is exhausted, a shared dummy buffer is returned, which drops
+ * all events.
+ */
+cyc_thread *cyc_thread_attach(void);
+
+/*
+ * Register a site and return its identifier. This is called
+ * automatically on the first execution of each site.
+ */
+uint32_t cyc_site_register(cyc_site *site);
+
+/*
+ * Get the current CPU number (or CYC_CPU_UNKNOWN). This uses
+ * sched_getcpu(), which does not enter the kernel on Linux (recent glibc
+ * versions read it from the rseq area, older ones go through the vDSO).
+ * If CYCPROF_NO_CPU is defined, the CPU is not recorded in events.
+ */
+uint32_t cyc_current_cpu(void);
+
+/*
+ * What cyc_region_record() does with each region execution: append an
+ * event to the thread's ring (CYC_RECORD_EVENTS, the default), and/or
+ * add its length to the per-thread, per-site histogram (CYC_RECORD_HIST).
+ */
+#define CYC_RECORD_EVENTS   0x01
+#define CYC_RECORD_HIST     0x02
+
+extern unsigned cyc_record_mode;
+
+static inline void
+cyc_set_record_mode(unsigned mode)
+{
+	__atomic_store_n(&cyc_record_mode, mode, __ATOMIC_RELAXED);
+}
+
+/*
+ * Get the histogram for the given site in the given thread, claiming it
+ * from the static pool. Returns NULL if the pool is exhausted, or for
+ * the shared overflow thread.
+ */
+cyc_hist *cyc_hist_attach(cyc_thread *t, uint32_t site);
+
+/*
+ * Add a value to a histogram. The histogram is written only by its
+ * owning thread; relaxed atomic accesses make concurrent reads (for
+ * merging) well-defined, at the cost of plain loads and stores.
+ */
+static inline void
+cyc_hist_add(cyc_hist *h, uint64_t x, uint32_t weight)
+{
+	uint64_t *b = &h->bucket[cyc_hist_bucket(x)];
+	__atomic_store_n(b, __atomic_load_n(b, __ATOMIC_RELAXED) + 1,
+		__ATOMIC_RELAXED);
+	__atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + x, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->wcount, h->wcount + weight, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->wsum, h->wsum + x * weight, __ATOMIC_RELAXED);
+	if (x > h->max) {
+		__atomic_store_n(&h->max, x, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void
+cyc_ring_push(cyc_thread *t, uint32_t id, uint64_t start, uint64_t end)
+{
+	uint64_t h = t->head;
+	if (h - t->tail_cache >= CYCPROF_THREAD_EVENTS) {
+		t->tail_cache = __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE);
+		if (h - t->tail_cache >= CYCPROF_THREAD_EVENTS) {
+			__atomic_fetch_add(&t->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	cyc_event *e = &t->ev[h & (CYCPROF_THREAD_EVENTS - 1)];
+	e->site = id;
+#ifdef CYCPROF_NO_CPU
+	e->cpu = CYC_CPU_UNKNOWN;
+#else
+	e->cpu = cyc_current_cpu();
+#endif
+	e->start = start;
+	e->end = end;
+	__atomic_store_n(&t->head, h + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Record an execution of the provided site, which represents 'weight'
+ * executions (for sampled sites). This is the hot path; it is normally
+ * invoked through the region macros.
+ */
+static inline void
+cyc_region_record_weighted(cyc_site *site,
+	uint64_t start, uint64_t end, uint32_t weight)
+{
+	cyc_thread *t = cyc_self;
+	if (t == NULL) {
+		t = cyc_thread_attach();
+	}
+	uint32_t id = site->id;
+	if (id == 0) {
+		id = cyc_site_register(site);
+	}
+	unsigned mode = cyc_record_mode;
+	if (mode & CYC_RECORD_HIST) {
+		cyc_hist *h = t->hist[id];
+		if (h == NULL) {
+			h = cyc_hist_attach(t, id);
+		}
+		if (h != NULL) {
+			cyc_hist_add(h, end - start, weight);
+		}
+	}
+	if (mode & CYC_RECORD_EVENTS) {
+		cyc_ring_push(t, id, start, end);
+	}
+}
+
+static inline void
+cyc_region_record(cyc_site *site, uint64_t start, uint64_t end)
+{
+	cyc_region_record_weighted(site, start, end, 1);
+}
+
+/*
+ * Sampling. A site with a period P > 1 is measured only on some of its
+ * executions: in fixed mode, exactly one out of P; in random mode, the
+ * interval between two measured executions is drawn uniformly in
+ * 1..2P-1 (mean P) from a per-thread PRNG, which avoids aliasing with
+ * periodic behaviour of the application. Each measurement is weighted
+ * by the number of executions since the previous one, so that scaled
+ * counts and sums in histograms are unbiased. Note that ring events
+ * carry no weight: for sampled sites, traces contain only the measured
+ * executions.
+ */
+extern unsigned cyc_sample_random;
+extern uint32_t cyc_default_period;
+
+/* Value returned by cyc_region_begin() for executions not measured. */
+#define CYC_NOT_SAMPLED   ((uint64_t)-1)
+
+static inline uint32_t
+cyc_random_interval(cyc_thread *t, uint32_t period)
+{
+	/* xorshift64* */
+	uint64_t x = t->rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	t->rng = x;
+	uint64_t r = (x * 0x2545F4914F6CDD1Dull) >> 32;
+	return 1 + (uint32_t)((r * (2 * (uint64_t)period - 1)) >> 32);
+}
+
+static inline uint64_t
+cyc_region_begin(cyc_site *site)
+{
+	uint32_t period = site->period;
+	if (period > 1) {
+		cyc_thread *t = cyc_self;
+		if (t == NULL) {
+			t = cyc_thread_attach();
+		}
+		/* Threads beyond CYCPROF_MAX_THREADS share one slot, which
+		   records nothing: they skip the (unsynchronized) sampling
+		   state altogether. */
+		if (t->index == (uint32_t)-1) {
+			return CYC_NOT_SAMPLED;
+		}
+		uint32_t id = site->id;
+		if (id == 0) {
+			id = cyc_site_register(site);
+		}
+		cyc_sampler *sp = &t->sampler[id];
+		if (sp->countdown > 1) {
+			sp->countdown --;
+			return CYC_NOT_SAMPLED;
+		}
+		sp->weight = sp->interval != 0 ? sp->interval : 1;
+		sp->interval = cyc_sample_random
+			? cyc_random_interval(t, period) : period;
+		sp->countdown = sp->interval;
+	}
+	return core_cycles();
+}
+
+/*
+ * Weight of the current measurement of a site, i.e. the number of
+ * executions it stands for, to be called once between cyc_region_begin()
+ * (when it did not return CYC_NOT_SAMPLED) and the recording of the
+ * measurement. The weight is the one set by cyc_region_begin() (and
+ * cleared here), not derived from the current period, which may have
+ * changed in between (see cyc_site_set_period()); it is 1 if that
+ * execution was not subject to sampling.
+ */
+static inline uint32_t
+cyc_region_weight(const cyc_site *site)
+{
+	cyc_thread *t = cyc_self;
+	uint32_t id = site->id;
+	if (t != NULL && id != 0) {
+		cyc_sampler *sp = &t->sampler[id];
+		uint32_t w = sp->weight;
+		if (w != 0) {
+			sp->weight = 0;
+			return w;
+		}
+	}
+	return 1;
+}
+
+static inline void
+cyc_region_end(cyc_site *site, uint64_t start)
+{
+	if (start == CYC_NOT_SAMPLED) {
+		return;
+	}
+	uint64_t end = core_cycles();
+	cyc_region_record_weighted(site, start, end, cyc_region_weight(site));
+}
+
+/*
+ * Set the sampling period for all sites (including those not registered
+ * yet), and select fixed (random = 0) or random intervals. A period of
+ * 0 or 1 measures every execution.
+ */
+void cyc_set_sampling(uint32_t period, int random);
+
+/*
+ * Set the sampling period of a single (registered) site.
+ */
+void cyc_site_set_period(uint32_t id, uint32_t period);
+
+/*
+ * Measurement overhead, in cycles: the median cost of two back-to-back
+ * core_cycles() reads (computed once, then cached).
+ */
+uint64_t cyc_overhead_cycles(void);
+
+/*
+ * Adjust the sampling period of every site which has histogram data, so
+ * that the measurement overhead stays below 'budget' (a fraction, e.g.
+ * 0.01 for 1%) of the cycles spent in the site: the period becomes
+ * ceil(overhead / (budget * mean length)). Returns the number of
+ * adjusted sites. Histograms must be enabled (CYC_RECORD_HIST); this
+ * can be called periodically, e.g. from the thread that reads them.
+ */
+size_t cyc_sampling_autotune(double budget);
+
+/*
+ * Inspection functions (not for the hot path). Thread slots are
+ * numbered from 0 to cyc_thread_count()-1; site identifiers range from
+ * 1 to cyc_site_count(); cyc_site_get() returns NULL for identifiers
+ * that are not (or not yet) assigned.
+ */
+size_t cyc_thread_count(void);
+cyc_thread *cyc_thread_get(size_t index);
+uint32_t cyc_site_count(void);
+const cyc_site *cyc_site_get(uint32_t id);
+
+/*
+ * Returns 1 if site 'id' has been handed out but its definition is not
+ * published yet (cyc_site_get() still returns NULL but will not once
+ * the registering thread is done), 0 otherwise. Identifiers that stay
+ * unnamed (lost to a concurrent registration, or the reserved overflow
+ * identifier) are never pending.
+ */
+int cyc_site_pending(uint32_t id);
+
+/*
+ * Write a per-site summary (count, total, mean, min and max cycles) of
+ * all events currently held in thread buffers (i.e. not yet drained),
+ * and the number of dropped events. This must not be called while a
+ * collector is running.
+ */
+void cyc_region_summary(FILE *out);
+
+/*
+ * Merge the histograms of all threads for the given site into 'dst'
+ * (which is first cleared). Returns 0 if at least one thread recorded
+ * values for that site, -1 otherwise. This may be called at any time,
+ * from any thread; concurrent updates may be partially included.
+ */
+int cyc_hist_merge(uint32_t site, cyc_hist *dst);
+
+/*
+ * Get an approximation of the value at quantile 'q' (0 to 1) of a
+ * histogram: the midpoint of the bucket that contains it (the exact
+ * maximum for q = 1). Returns 0 on an empty histogram.
+ */
+uint64_t cyc_hist_quantile(const cyc_hist *h, double q);
+
+/*
+ * Write a percentile table (estimated calls, measured calls, mean, p50,
+ * p90, p99, p99.9, max) of the merged histograms of all sites.
+ */
+void cyc_hist_dump(FILE *out);
+
+/*
+ * Shared-memory export of the histograms, for live monitoring by an
+ * external process (e.g. the cycview tool). cyc_shm_open() creates the
+ * named POSIX shared-memory segment (the name must start with '/');
+ * cyc_shm_publish() merges the histograms of all sites and copies them
+ * into the segment, under a sequence lock (see cycshm.h);
+ * cyc_shm_start() starts a thread that publishes every 'period_ms'
+ * milliseconds; cyc_shm_close() stops that thread (if started), then
+ * unmaps and removes the segment. cyc_shm_open() and cyc_shm_start()
+ * return 0 on success, -1 on error.
+ */
+int cyc_shm_open(const char *name);
+void cyc_shm_publish(void);
+int cyc_shm_start(unsigned period_ms);
+void cyc_shm_close(void);
+
+/*
+ * Total number of dropped events, over all threads.
+ */
+uint64_t cyc_dropped_total(void);
+
+/*
+ * A sink receives batches of drained events. write() is called with a
+ * contiguous batch of events from a given thread; flush() (which may be
+ * NULL) is called at the end of each drain pass.
+ */
+typedef struct {
+	void (*write)(void *ctx, const cyc_thread *t,
+		const cyc_event *ev, size_t num);
+	void (*flush)(void *ctx);
+	void *ctx;
+} cyc_sink;
+
+/*
+ * Perform one drain pass: all events currently in all thread rings are
+ * passed to the sink, and removed from the rings. The number of drained
+ * events is returned. There must be a single consumer at any time: do
+ * not call this function while a collector thread is running.
+ */
+size_t cyc_drain(const cyc_sink *sink);
+
+/*
+ * Start the background collector thread, which calls cyc_drain() on the
+ * provided sink every 'period_us' microseconds. Returns 0 on success, -1
+ * on error (collector already running, or thread creation failure).
+ * cyc_collector_stop() stops the thread, after a final drain pass. The
+ * sink structure must remain valid until the collector is stopped.
+ */
+int cyc_collector_start(const cyc_sink *sink, unsigned period_us);
+void cyc_collector_stop(void);
+
+/*
+ * Memory sink: drained events are appended to a growable array, with
+ * the slot index of the source thread in a parallel array. Memory is
+ * allocated by the collector, never by the instrumented threads. On
+ * allocation failure, events are discarded and counted in 'lost'.
+ */
+typedef struct {
+	cyc_event *ev;
+	uint32_t *thread;
+	size_t len;
+	size_t cap;
+	uint64_t lost;
+} cyc_mem_sink;
+
+void cyc_mem_sink_init(cyc_sink *sink, cyc_mem_sink *ms);
+void cyc_mem_sink_free(cyc_mem_sink *ms);
+
+/*
+ * Raw file sink: drained events are written to the provided stdio stream
+ * as fixed-size records (thread slot index, site id, start, end; 32, 32,
+ * 64 and 64 bits, native byte order). A large stdio buffer should be set
+ * on the stream (setvbuf()) to keep write() calls infrequent; the stream
+ * is not flushed by the sink.
+ */
+void cyc_file_sink_init(cyc_sink *sink, FILE *f);
+
+/*
+ * Trace file sink: drained events are written in the compact binary
+ * trace format (see tracefmt.h), which can be decoded with the cyctrace
+ * tool. cyc_trace_open() creates (or truncates) the file and initializes
+ * the sink; it returns 0 on success, -1 on error. cyc_trace_close() must
+ * be called after the last drain (i.e. after cyc_collector_stop()); it
+ * writes the per-thread drop counters, then closes the file. It returns
+ * -1 if any write error occurred, 0 otherwise.
+ *
+ * Both functions also record, for each CPU on which the calling thread
+ * is allowed to run, a pair (cycle counter, CLOCK_MONOTONIC time); the
+ * calling thread is briefly migrated to each CPU in turn. The decoder
+ * uses these pairs to convert cycle stamps into times.
+ */
+int cyc_trace_open(cyc_sink *sink, const char *path);
+int cyc_trace_close(cyc_sink *sink);
+
+/*
+ * Get the CPU model string (from /proc/cpuinfo: "model name" on x86,
+ * "Model", "uarch" or "CPU part" elsewhere). The string is truncated to
+ * fit into 'len' bytes; it is empty if no model could be found.
+ */
+void cyc_cpu_model(char *dst, size_t len);
+
+/*
+ * Whole-program function accounting. When code is compiled with
+ * -finstrument-functions, the compiler inserts calls to
+ * __cyg_profile_func_enter() and __cyg_profile_func_exit() around each
+ * function body; this library provides both hooks. They maintain a
+ * per-thread shadow stack (CYCPROF_FUNC_DEPTH entries) and a per-thread
+ * table of functions (CYCPROF_MAX_FUNCS entries), taken from a static
+ * pool: no lock, no allocation and no system call. For each function,
+ * the number of calls, the inclusive cycles (the function and its
+ * callees; recursive activations are counted once) and the exclusive
+ * cycles (callees excluded) are accumulated. Functions that do not fit
+ * in the table, and calls deeper than the shadow stack, are ignored.
+ *
+ * A report, sorted by exclusive cycles, is written at process exit to
+ * standard error, or to the file named by the CYCPROF_FUNC_REPORT
+ * environment variable. cyc_func_report() writes the same report
+ * explicitly. The report uses cyc_sym_lookup() for function names.
+ */
+void cyc_func_report(FILE *out);
+
+/*
+ * The hooks also build, per thread, a calling-context tree (up to
+ * CYCPROF_CCT_NODES nodes per thread): one node per distinct call path,
+ * with its number of calls and exclusive cycles. When the tree is full,
+ * calls on new paths are charged to the deepest known caller.
+ * cyc_func_folded() writes the tree in the "folded stacks" format used
+ * by flame graph tools: one line per call path, with the function names
+ * from the outermost to the innermost separated by ';', then a space
+ * and the exclusive cycles. If the CYCPROF_FOLDED environment variable
+ * names a file, the folded stacks are also written there at exit. The
+ * cycflame tool renders folded stacks into an SVG flame graph.
+ */
+void cyc_func_folded(FILE *out);
+
+/*
+ * Resolve a code address into a symbol name, using the symbol tables of
+ * the main executable and of the loaded shared objects (read from their
+ * files, including non-exported static functions), then dladdr(). On
+ * success, the name (followed by "+0x<offset>" if the address is not
+ * the symbol start) is written into 'buf' and 0 is returned; otherwise,
+ * the address in hexadecimal is written and -1 is returned.
+ */
+int cyc_sym_lookup(const void *addr, char *buf, size_t len);
+
+/*
+ * Get the start address and size of the function containing a code
+ * address, from the same symbol tables as cyc_sym_lookup() (the code
+ * itself can then be read in memory, e.g. to hash it). Returns 0 on
+ * success, -1 if no symbol with a known size contains the address.
+ */
+int cyc_sym_range(const void *addr, const void **start, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CYCPROF_DISABLE
+
+#define CYC_REGION_BEGIN(name)   ((void)0)
+#define CYC_REGION_END(name)     ((void)0)
+#ifdef __cplusplus
+#define CYC_REGION(name)         ((void)0)
+#endif
+
+#else
+
+/*
+ * CYC_REGION_BEGIN(name) starts a region in C code; it must be used at a
+ * place where a declaration is allowed, and be matched by a
+ * CYC_REGION_END(name) with the same name in the same scope. The name
+ * must be a valid identifier; it is also used as the site name in
+ * reports.
+ */
+#define CYC_REGION_BEGIN(name) \
+	static cyc_site cyc_site_ ## name = { #name, __FILE__, __LINE__, 0, 0 }; \
+	uint64_t cyc_start_ ## name = cyc_region_begin(&cyc_site_ ## name)
+#define CYC_REGION_END(name) \
+	cyc_region_end(&cyc_site_ ## name, cyc_start_ ## name)
+
+#ifdef __cplusplus
+
+/*
+ * C++ guard: the region extends from the guard construction to its
+ * destruction (normally the end of the enclosing scope).
+ */
+class cyc_region_guard {
+public:
+	explicit cyc_region_guard(cyc_site *site)
+		: site_(site), start_(cyc_region_begin(site))
+	{
+	}
+
+	~cyc_region_guard()
+	{
+		cyc_region_end(site_, start_);
+	}
+
+private:
+	cyc_region_guard(const cyc_region_guard &);
+	cyc_region_guard &operator=(const cyc_region_guard &);
+
+	cyc_site *site_;
+	uint64_t start_;
+};
+
+#define CYC_REGION(name) \
+	static cyc_site cyc_site_ ## name = { #name, __FILE__, __LINE__, 0, 0 }; \
+	cyc_region_guard cyc_guard_ ## name(&cyc_site_ ## name)
+
+#endif
+
+#endif
+
+#endif
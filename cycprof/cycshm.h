@@ -0,0 +1,54 @@
+/*
+ * cycprof: layout of the shared-memory segment in which per-site
+ * histograms are published for external monitors (see cyc_shm_open()
+ * in cycprof.h, and the cycview tool).
+ *
+ * The segment starts with a header, followed by 'max_sites' site
+ * records of 'site_size' bytes each; record i describes site id i
+ * (record 0 is unused). A reader must check 'magic' and 'version', and
+ * that the sizes match its own definitions.
+ *
+ * Consistency uses a sequence lock: the writer increments 'seq' (which
+ * becomes odd) before updating the contents, and increments it again
+ * (back to even) afterwards. A reader reads 'seq', copies what it needs,
+ * then reads 'seq' again; the copy is consistent only if both values are
+ * equal and even. The writer never waits for readers, and readers map
+ * the segment read-only.
+ */
+
+#ifndef CYCPROF_CYCSHM_H__
+#define CYCPROF_CYCSHM_H__
+
+#include <stdint.h>
+
+#include "cycprof.h"
+
+#define CYC_SHM_MAGIC     0x314D485343594343ull   /* "CCYCSHM1" */
+#define CYC_SHM_VERSION   1
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t site_size;
+	uint32_t max_sites;
+	uint32_t hist_buckets;
+	uint32_t hist_sub_bits;
+	uint64_t seq;
+	uint64_t pid;
+	/* Time of the last publication (CLOCK_REALTIME, nanoseconds). */
+	uint64_t update_ns;
+	/* Highest site id in use. */
+	uint32_t num_sites;
+	uint32_t reserved;
+	/* Measurement overhead (cycles), see cyc_overhead_cycles(). */
+	uint64_t overhead;
+	char backend[32];
+} cyc_shm_header;
+
+typedef struct {
+	char name[64];
+	cyc_hist hist;
+} cyc_shm_site;
+
+#endif
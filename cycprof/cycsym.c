@@ -0,0 +1,338 @@
+/*
+ * cycprof: symbolization of code addresses. The symbol table of each
+ * loaded object (the main executable, read from /proc/self/exe, and the
+ * shared objects, read from their paths) is loaded on the first lookup:
+ * the full .symtab if present, so that static functions are found, and
+ * .dynsym otherwise. Symbols are relocated with the load bias reported
+ * by dl_iterate_phdr() (non-zero for shared objects and for position-
+ * independent executables). Objects loaded later with dlopen() are read
+ * when a lookup misses. Addresses not covered by these tables (e.g. in
+ * objects that cannot be opened) are resolved with dladdr(), which only
+ * sees exported symbols.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cycprof.h"
+
+typedef struct {
+	uintptr_t addr;
+	uintptr_t size;
+	const char *name;
+} sym_entry;
+
+/* Symbols of one loaded object; 'num' is 0 if none could be read. */
+typedef struct {
+	char *path;
+	uintptr_t bias;
+	sym_entry *sym;
+	size_t num;
+	uintptr_t lo, hi;
+} sym_object;
+
+static struct {
+	pthread_mutex_t lock;
+	sym_object *obj;
+	size_t num, cap;
+	int scanned;
+	unsigned long long adds;
+} syms = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0 };
+
+static int
+cmp_sym(const void *v1, const void *v2)
+{
+	const sym_entry *s1 = v1;
+	const sym_entry *s2 = v2;
+	if (s1->addr < s2->addr) {
+		return -1;
+	} else if (s1->addr == s2->addr) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+/*
+ * Find the section of type 'type' and return it, or NULL. The section
+ * contents must lie within the file.
+ */
+static const ElfW(Shdr) *
+find_section(const unsigned char *img, size_t len, unsigned type)
+{
+	const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)img;
+	if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(ElfW(Shdr))
+		|| eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) > len)
+	{
+		return NULL;
+	}
+	const ElfW(Shdr) *sh = (const ElfW(Shdr) *)(img + eh->e_shoff);
+	for (unsigned i = 0; i < eh->e_shnum; i ++) {
+		if (sh[i].sh_type == type
+			&& sh[i].sh_offset + sh[i].sh_size <= len
+			&& sh[i].sh_link < eh->e_shnum)
+		{
+			return &sh[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read the function symbols of the ELF file at 'path', relocated by
+ * 'bias', into 'o'. On failure, 'o' is left without symbols.
+ */
+static void
+load_object(sym_object *o, const char *path, uintptr_t bias)
+{
+	o->sym = NULL;
+	o->num = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+		close(fd);
+		return;
+	}
+	size_t len = (size_t)st.st_size;
+	const unsigned char *img = mmap(NULL, len,
+		PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED) {
+		return;
+	}
+	const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)img;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) {
+		munmap((void *)img, len);
+		return;
+	}
+	const ElfW(Shdr) *symtab = find_section(img, len, SHT_SYMTAB);
+	if (symtab == NULL) {
+		symtab = find_section(img, len, SHT_DYNSYM);
+	}
+	if (symtab == NULL) {
+		munmap((void *)img, len);
+		return;
+	}
+	const ElfW(Shdr) *strtab = (const ElfW(Shdr) *)(img + eh->e_shoff)
+		+ symtab->sh_link;
+	if (strtab->sh_offset + strtab->sh_size > len) {
+		munmap((void *)img, len);
+		return;
+	}
+	const ElfW(Sym) *st_sym = (const ElfW(Sym) *)(img + symtab->sh_offset);
+	size_t n = symtab->sh_size / sizeof(ElfW(Sym));
+	const char *str = (const char *)(img + strtab->sh_offset);
+
+	sym_entry *tab = malloc(n * sizeof *tab);
+	if (tab == NULL) {
+		munmap((void *)img, len);
+		return;
+	}
+	size_t k = 0;
+	for (size_t i = 0; i < n; i ++) {
+		if (ELF64_ST_TYPE(st_sym[i].st_info) != STT_FUNC
+			|| st_sym[i].st_value == 0
+			|| st_sym[i].st_name >= strtab->sh_size)
+		{
+			continue;
+		}
+		tab[k].addr = (uintptr_t)st_sym[i].st_value + bias;
+		tab[k].size = (uintptr_t)st_sym[i].st_size;
+		tab[k].name = str + st_sym[i].st_name;
+		k ++;
+	}
+	if (k == 0) {
+		free(tab);
+		munmap((void *)img, len);
+		return;
+	}
+	qsort(tab, k, sizeof *tab, &cmp_sym);
+
+	/* The image stays mapped: names point into its string table. */
+	o->sym = tab;
+	o->num = k;
+	o->lo = tab[0].addr;
+	o->hi = tab[k - 1].addr + tab[k - 1].size;
+}
+
+static int
+add_object(struct dl_phdr_info *info, size_t size, void *data)
+{
+	int *first = data;
+	/* The first object is the main program, which has no path. */
+	const char *path = *first ? "/proc/self/exe" : info->dlpi_name;
+	*first = 0;
+	if (size >= offsetof(struct dl_phdr_info, dlpi_adds)
+		+ sizeof info->dlpi_adds)
+	{
+		syms.adds = info->dlpi_adds;
+	}
+	if (path == NULL || path[0] == 0) {
+		return 0;
+	}
+	uintptr_t bias = (uintptr_t)info->dlpi_addr;
+	for (size_t i = 0; i < syms.num; i ++) {
+		if (syms.obj[i].bias == bias
+			&& strcmp(syms.obj[i].path, path) == 0)
+		{
+			return 0;
+		}
+	}
+	if (syms.num == syms.cap) {
+		size_t cap = syms.cap == 0 ? 16 : syms.cap << 1;
+		sym_object *no = realloc(syms.obj, cap * sizeof *no);
+		if (no == NULL) {
+			return 1;
+		}
+		syms.obj = no;
+		syms.cap = cap;
+	}
+	sym_object *o = &syms.obj[syms.num];
+	size_t plen = strlen(path) + 1;
+	o->path = malloc(plen);
+	if (o->path == NULL) {
+		return 1;
+	}
+	memcpy(o->path, path, plen);
+	o->bias = bias;
+	load_object(o, path, bias);
+	syms.num ++;
+	return 0;
+}
+
+static int
+get_adds(struct dl_phdr_info *info, size_t size, void *data)
+{
+	if (size >= offsetof(struct dl_phdr_info, dlpi_adds)
+		+ sizeof info->dlpi_adds)
+	{
+		*(unsigned long long *)data = info->dlpi_adds;
+	}
+	return 1;
+}
+
+/*
+ * Read the symbols of the objects loaded since the last scan (syms.lock
+ * held). Returns 1 if new objects may have been read, 0 otherwise.
+ */
+static int
+scan_objects(void)
+{
+	if (syms.scanned) {
+		unsigned long long adds = syms.adds;
+		dl_iterate_phdr(&get_adds, &adds);
+		if (adds == syms.adds) {
+			return 0;
+		}
+	}
+	syms.scanned = 1;
+	int first = 1;
+	dl_iterate_phdr(&add_object, &first);
+	return 1;
+}
+
+/* Look up 'a' in the loaded symbol tables (syms.lock held). */
+static const sym_entry *
+find_loaded(uintptr_t a)
+{
+	for (size_t i = 0; i < syms.num; i ++) {
+		const sym_object *o = &syms.obj[i];
+		if (o->num == 0 || a < o->lo || a >= o->hi) {
+			continue;
+		}
+		/* Last symbol with addr <= a. */
+		size_t lo = 0, hi = o->num;
+		while (hi - lo > 1) {
+			size_t mid = (lo + hi) >> 1;
+			if (o->sym[mid].addr <= a) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		const sym_entry *s = &o->sym[lo];
+		if (a >= s->addr && (s->size == 0 || a < s->addr + s->size)) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find the symbol containing an address; 'size' is 0 if unknown.
+ * Returns 0 on success, -1 if no symbol is found.
+ */
+static int
+find_sym(const void *addr, const char **name, uintptr_t *base,
+	size_t *size)
+{
+	uintptr_t a = (uintptr_t)addr;
+	pthread_mutex_lock(&syms.lock);
+	const sym_entry *s = find_loaded(a);
+	if (s == NULL && scan_objects()) {
+		s = find_loaded(a);
+	}
+	if (s != NULL) {
+		*name = s->name;
+		*base = s->addr;
+		*size = (size_t)s->size;
+	}
+	pthread_mutex_unlock(&syms.lock);
+	if (s != NULL) {
+		return 0;
+	}
+	Dl_info info;
+	const ElfW(Sym) *sym = NULL;
+	if (dladdr1(addr, &info, (void **)&sym, RTLD_DL_SYMENT) != 0
+		&& info.dli_sname != NULL)
+	{
+		*name = info.dli_sname;
+		*base = (uintptr_t)info.dli_saddr;
+		*size = sym != NULL ? (size_t)sym->st_size : 0;
+		return 0;
+	}
+	return -1;
+}
+
+int
+cyc_sym_lookup(const void *addr, char *buf, size_t len)
+{
+	uintptr_t a = (uintptr_t)addr;
+	const char *name;
+	uintptr_t base;
+	size_t size;
+	if (find_sym(addr, &name, &base, &size) < 0) {
+		snprintf(buf, len, "%p", addr);
+		return -1;
+	}
+	if (a == base) {
+		snprintf(buf, len, "%s", name);
+	} else {
+		snprintf(buf, len, "%s+0x%lx", name, (unsigned long)(a - base));
+	}
+	return 0;
+}
+
+int
+cyc_sym_range(const void *addr, const void **start, size_t *size)
+{
+	const char *name;
+	uintptr_t base;
+	if (find_sym(addr, &name, &base, size) < 0 || *size == 0) {
+		return -1;
+	}
+	*start = (const void *)base;
+	return 0;
+}
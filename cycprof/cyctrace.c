@@ -0,0 +1,517 @@
+/*
+ * cyctrace: decoder for cycprof binary trace files (see tracefmt.h).
+ * By default it reconstructs per-site statistics (count, total, mean,
+ * min, median, 99th percentile and max cycles per region execution) and
+ * prints them as a table. It can also convert the trace into a timeline
+ * for the Chrome trace viewer (JSON) or Perfetto (protobuf), see
+ * export.c.
+ *
+ * Usage: cyctrace [ -f summary | chrome | perfetto ] [ -o out ] trace.bin
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracefmt.h"
+#include "cyctrace.h"
+
+static int
+get_string(const unsigned char *buf, size_t len, size_t *off,
+	char *dst, size_t dst_len)
+{
+	uint64_t n;
+	if (cyc_get_varint(buf, len, off, &n) < 0 || n > len - *off) {
+		return -1;
+	}
+	if (dst != NULL) {
+		size_t k = n < dst_len - 1 ? (size_t)n : dst_len - 1;
+		memcpy(dst, buf + *off, k);
+		dst[k] = 0;
+	}
+	*off += (size_t)n;
+	return 0;
+}
+
+static char *
+dup_string(const unsigned char *buf, size_t len, size_t *off)
+{
+	uint64_t n;
+	if (cyc_get_varint(buf, len, off, &n) < 0 || n > len - *off) {
+		return NULL;
+	}
+	char *s = malloc((size_t)n + 1);
+	if (s == NULL) {
+		return NULL;
+	}
+	memcpy(s, buf + *off, (size_t)n);
+	s[n] = 0;
+	*off += (size_t)n;
+	return s;
+}
+
+/*
+ * Grow an array of elements of size 'esize' so that index 'idx' is
+ * valid; new elements are zeroed. Returns 0 on success, -1 on error.
+ */
+static int
+grow(void **arr, size_t *num, size_t esize, uint64_t idx)
+{
+	if (idx > 0xFFFFFF) {
+		return -1;
+	}
+	if (idx < *num) {
+		return 0;
+	}
+	size_t n = (size_t)idx + 1;
+	unsigned char *na = realloc(*arr, n * esize);
+	if (na == NULL) {
+		return -1;
+	}
+	memset(na + *num * esize, 0, (n - *num) * esize);
+	*arr = na;
+	*num = n;
+	return 0;
+}
+
+static int
+parse_sites(trace *tr, const unsigned char *p, size_t len)
+{
+	size_t off = 0;
+	uint64_t count;
+	if (cyc_get_varint(p, len, &off, &count) < 0) {
+		return -1;
+	}
+	while (count -- > 0) {
+		uint64_t id, line;
+		if (cyc_get_varint(p, len, &off, &id) < 0
+			|| grow((void **)&tr->sites, &tr->num_sites,
+			sizeof *tr->sites, id) < 0)
+		{
+			return -1;
+		}
+		tr_site *s = &tr->sites[id];
+		free(s->name);
+		free(s->file);
+		s->name = dup_string(p, len, &off);
+		s->file = dup_string(p, len, &off);
+		if (s->name == NULL || s->file == NULL
+			|| cyc_get_varint(p, len, &off, &line) < 0)
+		{
+			return -1;
+		}
+		s->line = line;
+	}
+	return 0;
+}
+
+static int
+parse_events(trace *tr, const unsigned char *p, size_t len)
+{
+	size_t off = 0;
+	uint64_t thread, tid, count;
+	if (cyc_get_varint(p, len, &off, &thread) < 0
+		|| cyc_get_varint(p, len, &off, &tid) < 0
+		|| cyc_get_varint(p, len, &off, &count) < 0
+		|| grow((void **)&tr->threads, &tr->num_threads,
+		sizeof *tr->threads, thread) < 0)
+	{
+		return -1;
+	}
+	tr->threads[thread].tid = tid;
+	tr->threads[thread].seen = 1;
+	uint64_t start = 0;
+	while (count -- > 0) {
+		uint64_t id, cpu, d;
+		int64_t delta;
+		if (cyc_get_varint(p, len, &off, &id) < 0
+			|| cyc_get_varint(p, len, &off, &cpu) < 0
+			|| cyc_get_svarint(p, len, &off, &delta) < 0
+			|| cyc_get_varint(p, len, &off, &d) < 0)
+		{
+			return -1;
+		}
+		start += (uint64_t)delta;
+		if (tr->num_ev == tr->cap_ev) {
+			size_t nc = tr->cap_ev == 0 ? 65536 : tr->cap_ev << 1;
+			tr_event *ne = realloc(tr->ev, nc * sizeof *ne);
+			if (ne == NULL) {
+				return -1;
+			}
+			tr->ev = ne;
+			tr->cap_ev = nc;
+		}
+		tr_event *e = &tr->ev[tr->num_ev ++];
+		e->site = (uint32_t)id;
+		e->cpu = (uint32_t)cpu - 1;
+		e->thread = (uint32_t)thread;
+		e->start = start;
+		e->len = d;
+	}
+	return 0;
+}
+
+static int
+parse_drops(trace *tr, const unsigned char *p, size_t len)
+{
+	size_t off = 0;
+	uint64_t thread, dropped;
+	if (cyc_get_varint(p, len, &off, &thread) < 0
+		|| cyc_get_varint(p, len, &off, &dropped) < 0
+		|| grow((void **)&tr->threads, &tr->num_threads,
+		sizeof *tr->threads, thread) < 0)
+	{
+		return -1;
+	}
+	tr->threads[thread].dropped = dropped;
+	tr->dropped += dropped;
+	return 0;
+}
+
+static int
+parse_calib(trace *tr, const unsigned char *p, size_t len)
+{
+	size_t off = 0;
+	uint64_t count;
+	if (cyc_get_varint(p, len, &off, &count) < 0) {
+		return -1;
+	}
+	while (count -- > 0) {
+		uint64_t cpu, cc, ns;
+		if (cyc_get_varint(p, len, &off, &cpu) < 0
+			|| cyc_get_varint(p, len, &off, &cc) < 0
+			|| cyc_get_varint(p, len, &off, &ns) < 0
+			|| grow((void **)&tr->calib, &tr->num_calib,
+			sizeof *tr->calib, cpu) < 0)
+		{
+			return -1;
+		}
+		tr_calib *c = &tr->calib[cpu];
+		if (c->num == 0) {
+			c->cc0 = cc;
+			c->ns0 = ns;
+		} else {
+			c->cc1 = cc;
+			c->ns1 = ns;
+		}
+		c->num ++;
+	}
+	return 0;
+}
+
+static int
+parse_trace(trace *tr, const unsigned char *buf, size_t len)
+{
+	if (len < 12 || memcmp(buf, CYC_TRACE_MAGIC, 8) != 0) {
+		fprintf(stderr, "not a cycprof trace file\n");
+		return -1;
+	}
+	uint32_t version = cyc_get_u32le(buf + 8);
+	if (version != CYC_TRACE_VERSION) {
+		fprintf(stderr, "unsupported trace version: %u\n",
+			(unsigned)version);
+		return -1;
+	}
+	size_t off = 12;
+	if (get_string(buf, len, &off, tr->backend, sizeof tr->backend) < 0
+		|| get_string(buf, len, &off, tr->cpu, sizeof tr->cpu) < 0
+		|| cyc_get_varint(buf, len, &off, &tr->pid) < 0)
+	{
+		fprintf(stderr, "truncated trace header\n");
+		return -1;
+	}
+	while (off < len) {
+		if (len - off < 5) {
+			fprintf(stderr, "warning: truncated chunk at end\n");
+			break;
+		}
+		int type = buf[off];
+		size_t clen = cyc_get_u32le(buf + off + 1);
+		off += 5;
+		if (clen > len - off) {
+			fprintf(stderr, "warning: truncated chunk at end\n");
+			break;
+		}
+		const unsigned char *p = buf + off;
+		int r = 0;
+		switch (type) {
+		case CYC_CHUNK_SITES:
+			r = parse_sites(tr, p, clen);
+			break;
+		case CYC_CHUNK_EVENTS:
+			r = parse_events(tr, p, clen);
+			break;
+		case CYC_CHUNK_DROPS:
+			r = parse_drops(tr, p, clen);
+			break;
+		case CYC_CHUNK_CALIB:
+			r = parse_calib(tr, p, clen);
+			break;
+		default:
+			break;
+		}
+		if (r < 0) {
+			fprintf(stderr, "invalid chunk (type %d) at offset %zu\n",
+				type, off - 5);
+			return -1;
+		}
+		off += clen;
+	}
+	return 0;
+}
+
+/*
+ * Compute the time reference once all chunks have been parsed.
+ */
+static void
+tr_finish(trace *tr)
+{
+	tr->ref_calib = -1;
+	tr->base_ns = 0;
+	for (size_t i = 0; i < tr->num_calib; i ++) {
+		tr_calib *c = &tr->calib[i];
+		if (c->num < 2 || c->ns1 <= c->ns0 || c->cc1 <= c->cc0) {
+			continue;
+		}
+		if (tr->ref_calib < 0 || c->ns0 < tr->base_ns) {
+			tr->base_ns = c->ns0;
+		}
+		if (tr->ref_calib < 0) {
+			tr->ref_calib = (long)i;
+		}
+	}
+	tr->min_start = (uint64_t)-1;
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		if (tr->ev[i].start < tr->min_start) {
+			tr->min_start = tr->ev[i].start;
+		}
+	}
+}
+
+static const tr_calib *
+get_calib(const trace *tr, uint32_t cpu)
+{
+	if (cpu < tr->num_calib) {
+		const tr_calib *c = &tr->calib[cpu];
+		if (c->num >= 2 && c->ns1 > c->ns0 && c->cc1 > c->cc0) {
+			return c;
+		}
+	}
+	if (tr->ref_calib >= 0) {
+		return &tr->calib[tr->ref_calib];
+	}
+	return NULL;
+}
+
+const char *
+tr_site_name(const trace *tr, uint32_t site)
+{
+	if (site < tr->num_sites && tr->sites[site].name != NULL) {
+		return tr->sites[site].name;
+	}
+	return "?";
+}
+
+double
+tr_time_ns(const trace *tr, uint32_t cpu, uint64_t cycles)
+{
+	const tr_calib *c = get_calib(tr, cpu);
+	if (c == NULL) {
+		return (double)(cycles - tr->min_start);
+	}
+	double f = (double)(c->ns1 - c->ns0) / (double)(c->cc1 - c->cc0);
+	return (double)(int64_t)(c->ns0 - tr->base_ns)
+		+ (double)(int64_t)(cycles - c->cc0) * f;
+}
+
+double
+tr_duration_ns(const trace *tr, uint32_t cpu, uint64_t cycles)
+{
+	const tr_calib *c = get_calib(tr, cpu);
+	if (c == NULL) {
+		return (double)cycles;
+	}
+	return (double)cycles
+		* (double)(c->ns1 - c->ns0) / (double)(c->cc1 - c->cc0);
+}
+
+static int
+cmp_u64(const void *v1, const void *v2)
+{
+	uint64_t x1 = *(const uint64_t *)v1;
+	uint64_t x2 = *(const uint64_t *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+static int
+print_stats(const trace *tr, FILE *out)
+{
+	fprintf(out, "backend: %s\n", tr->backend);
+	fprintf(out, "cpu:     %s\n",
+		tr->cpu[0] != 0 ? tr->cpu : "(unknown)");
+	fprintf(out, "pid:     %llu\n", (unsigned long long)tr->pid);
+	size_t nt = 0;
+	for (size_t i = 0; i < tr->num_threads; i ++) {
+		nt += tr->threads[i].seen;
+	}
+	fprintf(out, "events:  %zu (%zu threads, %llu dropped)\n",
+		tr->num_ev, nt, (unsigned long long)tr->dropped);
+	const tr_calib *c = get_calib(tr, (uint32_t)-1);
+	if (c != NULL) {
+		fprintf(out, "counter: %.3f MHz (CPU %ld)\n",
+			1000.0 * (double)(c->cc1 - c->cc0)
+			/ (double)(c->ns1 - c->ns0), tr->ref_calib);
+	}
+	fprintf(out, "\n%-24s %10s %14s %10s %8s %8s %8s %10s\n",
+		"site", "count", "total", "mean", "min", "p50", "p99", "max");
+
+	/* Group durations by site. */
+	size_t *cnt = calloc(tr->num_sites + 1, sizeof *cnt);
+	uint64_t *len = malloc((tr->num_ev + 1) * sizeof *len);
+	if (cnt == NULL || len == NULL) {
+		free(cnt);
+		free(len);
+		return -1;
+	}
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		uint32_t s = tr->ev[i].site;
+		cnt[s < tr->num_sites ? s + 1 : 0] ++;
+	}
+	size_t *pos = calloc(tr->num_sites + 1, sizeof *pos);
+	if (pos == NULL) {
+		free(cnt);
+		free(len);
+		return -1;
+	}
+	for (size_t s = 1; s <= tr->num_sites; s ++) {
+		pos[s] = pos[s - 1] + cnt[s - 1];
+	}
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		uint32_t s = tr->ev[i].site;
+		size_t k = s < tr->num_sites ? s + 1 : 0;
+		len[pos[k] ++] = tr->ev[i].len;
+	}
+	for (size_t k = 0; k <= tr->num_sites; k ++) {
+		size_t n = cnt[k];
+		if (n == 0) {
+			continue;
+		}
+		uint64_t *v = len + pos[k] - n;
+		qsort(v, n, sizeof(uint64_t), &cmp_u64);
+		uint64_t total = 0;
+		for (size_t i = 0; i < n; i ++) {
+			total += v[i];
+		}
+		fprintf(out,
+			"%-24s %10zu %14llu %10.1f %8llu %8llu %8llu %10llu\n",
+			k == 0 ? "?" : tr_site_name(tr, (uint32_t)(k - 1)), n,
+			(unsigned long long)total,
+			(double)total / (double)n,
+			(unsigned long long)v[0],
+			(unsigned long long)v[n / 2],
+			(unsigned long long)v[(n * 99) / 100],
+			(unsigned long long)v[n - 1]);
+	}
+	free(cnt);
+	free(pos);
+	free(len);
+	return ferror(out) ? -1 : 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: cyctrace [ -f summary | chrome | perfetto ] [ -o out ] trace.bin\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *format = "summary";
+	const char *out_name = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:o:")) != -1) {
+		switch (opt) {
+		case 'f':
+			format = optarg;
+			break;
+		case 'o':
+			out_name = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+	}
+	int (*fmt)(const trace *, FILE *);
+	if (strcmp(format, "summary") == 0) {
+		fmt = &print_stats;
+	} else if (strcmp(format, "chrome") == 0) {
+		fmt = &tr_export_chrome;
+	} else if (strcmp(format, "perfetto") == 0) {
+		fmt = &tr_export_perfetto;
+	} else {
+		usage();
+	}
+
+	const char *in_name = argv[optind];
+	int fd = open(in_name, O_RDONLY);
+	if (fd < 0) {
+		perror(in_name);
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		exit(EXIT_FAILURE);
+	}
+	size_t len = (size_t)st.st_size;
+	if (len == 0) {
+		fprintf(stderr, "empty file\n");
+		exit(EXIT_FAILURE);
+	}
+	void *m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	trace tr;
+	memset(&tr, 0, sizeof tr);
+	if (parse_trace(&tr, m, len) < 0) {
+		exit(EXIT_FAILURE);
+	}
+	tr_finish(&tr);
+
+	FILE *out = stdout;
+	if (out_name != NULL) {
+		out = fopen(out_name, "wb");
+		if (out == NULL) {
+			perror(out_name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (fmt(&tr, out) < 0 || fflush(out) != 0) {
+		fprintf(stderr, "write error\n");
+		exit(EXIT_FAILURE);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * cyctrace: in-memory representation of a decoded trace file, shared by
+ * the decoder (cyctrace.c) and the exporters (export.c).
+ */
+
+#ifndef CYCPROF_CYCTRACE_H__
+#define CYCPROF_CYCTRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+	char *name;
+	char *file;
+	uint64_t line;
+} tr_site;
+
+typedef struct {
+	uint32_t site;
+	uint32_t cpu;
+	uint32_t thread;
+	uint64_t start;
+	uint64_t len;
+} tr_event;
+
+typedef struct {
+	uint64_t tid;
+	uint64_t dropped;
+	int seen;
+} tr_thread;
+
+/*
+ * Calibration for one CPU: first and last (cycles, ns) points. The
+ * frequency is known only if at least two distinct points were seen.
+ */
+typedef struct {
+	int num;
+	uint64_t cc0, ns0;
+	uint64_t cc1, ns1;
+} tr_calib;
+
+typedef struct {
+	char backend[64];
+	char cpu[128];
+	uint64_t pid;
+	tr_site *sites;
+	size_t num_sites;
+	tr_event *ev;
+	size_t num_ev;
+	size_t cap_ev;
+	tr_thread *threads;
+	size_t num_threads;
+	tr_calib *calib;
+	size_t num_calib;
+	uint64_t dropped;
+	/* Set by tr_finish(): reference calibration (index into calib[],
+	   or -1 if none), time origin, and smallest cycle stamp. */
+	long ref_calib;
+	uint64_t base_ns;
+	uint64_t min_start;
+} trace;
+
+/* Site name, or "?" for unknown sites. */
+const char *tr_site_name(const trace *tr, uint32_t site);
+
+/*
+ * Convert a cycle stamp read on the given CPU into a time in
+ * nanoseconds, relative to the first calibration point of the trace.
+ * If the CPU has no calibration, the calibration of the first
+ * calibrated CPU is used; if the trace has no usable calibration at all,
+ * then one cycle is counted as one nanosecond (relative to the smallest
+ * cycle stamp).
+ */
+double tr_time_ns(const trace *tr, uint32_t cpu, uint64_t cycles);
+
+/* Convert a duration in cycles on the given CPU into nanoseconds. */
+double tr_duration_ns(const trace *tr, uint32_t cpu, uint64_t cycles);
+
+/*
+ * Exporters (export.c). They return 0 on success, -1 on write error.
+ */
+int tr_export_chrome(const trace *tr, FILE *out);
+int tr_export_perfetto(const trace *tr, FILE *out);
+
+#endif
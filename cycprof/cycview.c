@@ -0,0 +1,174 @@
+/*
+ * cycview: live viewer for the per-site histograms that an instrumented
+ * process publishes in shared memory (see cyc_shm_open()). The segment
+ * is mapped read-only; the viewer never writes into it and the
+ * instrumented process never waits for the viewer.
+ *
+ * Usage: cycview [ -i seconds ] [ -n count ] /name
+ *
+ * Every interval (default: 1 second), a table is printed with, for each
+ * site, the estimated number of calls per second over the last interval,
+ * the mean cycles per call over the last interval, and the lifetime
+ * percentiles. With -n, the viewer exits after that many tables.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cycshm.h"
+
+/*
+ * Take a consistent snapshot of the segment into 'dst'. Returns 0 on
+ * success, -1 if no consistent copy could be obtained (writer too busy).
+ */
+static int
+snapshot(const unsigned char *seg, unsigned char *dst, size_t len)
+{
+	const cyc_shm_header *hdr = (const cyc_shm_header *)seg;
+	for (int attempt = 0; attempt < 1000; attempt ++) {
+		uint64_t s1 = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if (s1 & 1) {
+			usleep(100);
+			continue;
+		}
+		memcpy(dst, seg, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t s2 = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+		if (s1 == s2) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: cycview [ -i seconds ] [ -n count ] /name\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double interval = 1.0;
+	long count = -1;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !(interval > 0.0)) {
+		usage();
+	}
+	const char *name = argv[optind];
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(cyc_shm_header)) {
+		fprintf(stderr, "%s: not a cycprof segment\n", name);
+		exit(EXIT_FAILURE);
+	}
+	size_t len = (size_t)st.st_size;
+	const unsigned char *seg = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	const cyc_shm_header *h = (const cyc_shm_header *)seg;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != CYC_SHM_MAGIC
+		|| h->version != CYC_SHM_VERSION
+		|| h->header_size != sizeof(cyc_shm_header)
+		|| h->site_size != sizeof(cyc_shm_site)
+		|| h->hist_buckets != CYC_HIST_BUCKETS
+		|| h->hist_sub_bits != CYC_HIST_SUB_BITS
+		|| len < sizeof(cyc_shm_header)
+		+ (size_t)h->max_sites * sizeof(cyc_shm_site))
+	{
+		fprintf(stderr, "%s: unsupported segment layout\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Two snapshot buffers: current and previous (for rates). */
+	unsigned char *cur = malloc(len);
+	unsigned char *prev = calloc(1, len);
+	if (cur == NULL || prev == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (long n = 0; count < 0 || n < count; n ++) {
+		if (n > 0) {
+			struct timespec ts;
+			ts.tv_sec = (time_t)interval;
+			ts.tv_nsec = (long)((interval - (double)ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+		if (snapshot(seg, cur, len) < 0) {
+			fprintf(stderr, "could not get a consistent snapshot\n");
+			continue;
+		}
+		const cyc_shm_header *ch = (const cyc_shm_header *)cur;
+		const cyc_shm_header *ph = (const cyc_shm_header *)prev;
+		double dt = ph->update_ns != 0 && ch->update_ns > ph->update_ns
+			? (double)(ch->update_ns - ph->update_ns) * 1e-9 : 0.0;
+		printf("pid %llu, backend %s, overhead %llu cycles\n",
+			(unsigned long long)ch->pid, ch->backend,
+			(unsigned long long)ch->overhead);
+		printf("%-24s %12s %10s %8s %8s %8s %10s\n",
+			"site", "calls/s", "cyc/call", "p50", "p99", "p99.9",
+			"calls");
+		uint32_t ns = ch->num_sites < ch->max_sites
+			? ch->num_sites : ch->max_sites - 1;
+		for (uint32_t id = 1; id <= ns; id ++) {
+			const cyc_shm_site *cs = (const cyc_shm_site *)(cur
+				+ sizeof(cyc_shm_header)
+				+ (size_t)id * sizeof(cyc_shm_site));
+			const cyc_shm_site *ps = (const cyc_shm_site *)(prev
+				+ sizeof(cyc_shm_header)
+				+ (size_t)id * sizeof(cyc_shm_site));
+			const cyc_hist *hc = &cs->hist;
+			if (hc->count == 0) {
+				continue;
+			}
+			uint64_t dcalls = hc->wcount - ps->hist.wcount;
+			uint64_t dsum = hc->wsum - ps->hist.wsum;
+			double rate = dt > 0.0 ? (double)dcalls / dt : 0.0;
+			double cpc = dcalls > 0 ? (double)dsum / (double)dcalls
+				: (double)hc->wsum / (double)hc->wcount;
+			char nm[sizeof cs->name + 1];
+			memcpy(nm, cs->name, sizeof cs->name);
+			nm[sizeof cs->name] = 0;
+			printf("%-24s %12.0f %10.1f %8llu %8llu %8llu %10llu\n",
+				nm[0] != 0 ? nm : "?", rate, cpc,
+				(unsigned long long)cyc_hist_quantile(hc, 0.5),
+				(unsigned long long)cyc_hist_quantile(hc, 0.99),
+				(unsigned long long)cyc_hist_quantile(hc, 0.999),
+				(unsigned long long)hc->wcount);
+		}
+		printf("\n");
+		fflush(stdout);
+		unsigned char *t = prev;
+		prev = cur;
+		cur = t;
+	}
+	return 0;
+}
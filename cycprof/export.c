@@ -0,0 +1,457 @@
+/*
+ * cyctrace: timeline exporters.
+ *
+ * Regions are converted to time slices: cycle stamps are converted to
+ * nanoseconds with the per-CPU calibration points found in the trace
+ * (see tr_time_ns()), which corrects for counters that run at different
+ * offsets on different cores. Each region appears twice: on the track of
+ * the thread that executed it, and on the track of the CPU on which it
+ * ended.
+ *
+ * Chrome trace format (JSON): complete ("X") events; times are in
+ * microseconds. The CPU tracks are shown as threads of a pseudo-process
+ * with pid 0 ("CPUs"). The file can be opened in chrome://tracing or in
+ * the Perfetto UI.
+ *
+ * Perfetto format (protobuf): a Trace message containing TracePacket
+ * entries, with TrackDescriptor packets for the process, each thread and
+ * each CPU, then TrackEvent slice begin/end packets, sorted by time. On
+ * a CPU, the regions are put on one child track per thread, since the
+ * regions of different threads need not nest.
+ * Field numbers are from the public perfetto protos
+ * (protos/perfetto/trace/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cyctrace.h"
+
+/* Pseudo-pid for the CPU tracks in the Chrome format. */
+#define CPU_PID   0
+
+static void
+json_string(FILE *out, const char *s)
+{
+	putc('"', out);
+	for (; *s != 0; s ++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			putc('\\', out);
+			putc(c, out);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			putc(c, out);
+		}
+	}
+	putc('"', out);
+}
+
+/*
+ * Return an array of flags (one per CPU, up to the largest CPU number
+ * found in events) telling which CPUs appear in the trace; *num is set
+ * to the array length.
+ */
+static unsigned char *
+cpus_seen(const trace *tr, size_t *num)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		uint32_t cpu = tr->ev[i].cpu;
+		if (cpu != (uint32_t)-1 && cpu >= n) {
+			n = (size_t)cpu + 1;
+		}
+	}
+	unsigned char *seen = calloc(n + 1, 1);
+	if (seen == NULL) {
+		*num = 0;
+		return NULL;
+	}
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		uint32_t cpu = tr->ev[i].cpu;
+		if (cpu != (uint32_t)-1) {
+			seen[cpu] = 1;
+		}
+	}
+	*num = n;
+	return seen;
+}
+
+int
+tr_export_chrome(const trace *tr, FILE *out)
+{
+	unsigned long long pid = (unsigned long long)tr->pid;
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%llu,"
+		"\"args\":{\"name\":\"pid %llu\"}}", pid, pid);
+	for (size_t i = 0; i < tr->num_threads; i ++) {
+		if (!tr->threads[i].seen) {
+			continue;
+		}
+		unsigned long long tid = (unsigned long long)tr->threads[i].tid;
+		fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\","
+			"\"pid\":%llu,\"tid\":%llu,"
+			"\"args\":{\"name\":\"thread %zu (tid %llu)\"}}",
+			pid, tid, i, tid);
+	}
+	size_t ncpu;
+	unsigned char *seen = cpus_seen(tr, &ncpu);
+	if (seen == NULL) {
+		return -1;
+	}
+	fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+		"\"args\":{\"name\":\"CPUs\"}}", CPU_PID);
+	for (size_t i = 0; i < ncpu; i ++) {
+		if (seen[i]) {
+			fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\","
+				"\"pid\":%d,\"tid\":%zu,"
+				"\"args\":{\"name\":\"CPU %zu\"}}",
+				CPU_PID, i, i);
+		}
+	}
+	free(seen);
+
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		const tr_event *e = &tr->ev[i];
+		double ts = tr_time_ns(tr, e->cpu, e->start) / 1000.0;
+		double dur = tr_duration_ns(tr, e->cpu, e->len) / 1000.0;
+		unsigned long long tid =
+			(unsigned long long)tr->threads[e->thread].tid;
+		for (int k = 0; k < 2; k ++) {
+			if (k == 1 && e->cpu == (uint32_t)-1) {
+				break;
+			}
+			fprintf(out, ",\n{\"ph\":\"X\",\"cat\":\"cycprof\","
+				"\"name\":");
+			json_string(out, tr_site_name(tr, e->site));
+			if (k == 0) {
+				fprintf(out, ",\"pid\":%llu,\"tid\":%llu",
+					pid, tid);
+			} else {
+				fprintf(out, ",\"pid\":%d,\"tid\":%u",
+					CPU_PID, (unsigned)e->cpu);
+			}
+			fprintf(out, ",\"ts\":%.3f,\"dur\":%.3f,"
+				"\"args\":{\"cycles\":%llu,\"cpu\":%d}}",
+				ts, dur, (unsigned long long)e->len,
+				e->cpu == (uint32_t)-1 ? -1 : (int)e->cpu);
+		}
+	}
+	fprintf(out, "\n]}\n");
+	return ferror(out) ? -1 : 0;
+}
+
+/* ===================================================================== */
+/*
+ * Minimal protobuf encoder.
+ */
+
+typedef struct {
+	unsigned char *buf;
+	size_t len;
+	size_t cap;
+	int err;
+} pbuf;
+
+static void
+pb_raw(pbuf *pb, const void *data, size_t len)
+{
+	if (pb->err || len == 0) {
+		return;
+	}
+	if (len > pb->cap - pb->len) {
+		size_t nc = pb->cap == 0 ? 256 : pb->cap;
+		while (len > nc - pb->len) {
+			nc <<= 1;
+		}
+		unsigned char *nb = realloc(pb->buf, nc);
+		if (nb == NULL) {
+			pb->err = 1;
+			return;
+		}
+		pb->buf = nb;
+		pb->cap = nc;
+	}
+	memcpy(pb->buf + pb->len, data, len);
+	pb->len += len;
+}
+
+static void
+pb_varint(pbuf *pb, uint64_t x)
+{
+	unsigned char tmp[10];
+	size_t n = 0;
+	while (x >= 0x80) {
+		tmp[n ++] = (unsigned char)(x | 0x80);
+		x >>= 7;
+	}
+	tmp[n ++] = (unsigned char)x;
+	pb_raw(pb, tmp, n);
+}
+
+static void
+pb_uint(pbuf *pb, unsigned field, uint64_t x)
+{
+	pb_varint(pb, (uint64_t)field << 3);
+	pb_varint(pb, x);
+}
+
+static void
+pb_bytes(pbuf *pb, unsigned field, const void *data, size_t len)
+{
+	pb_varint(pb, ((uint64_t)field << 3) | 2);
+	pb_varint(pb, len);
+	pb_raw(pb, data, len);
+}
+
+static void
+pb_string(pbuf *pb, unsigned field, const char *s)
+{
+	pb_bytes(pb, field, s, strlen(s));
+}
+
+/* Append sub-message 'sub' as field 'field', then reset 'sub'. */
+static void
+pb_msg(pbuf *pb, unsigned field, pbuf *sub)
+{
+	if (sub->err) {
+		pb->err = 1;
+	}
+	pb_bytes(pb, field, sub->buf, sub->len);
+	sub->len = 0;
+}
+
+/* Perfetto field numbers. */
+#define TRACE_PACKET                1
+#define PACKET_TIMESTAMP            8
+#define PACKET_SEQUENCE_ID          10
+#define PACKET_TRACK_EVENT          11
+#define PACKET_TRACK_DESCRIPTOR     60
+#define TRACK_EVENT_TYPE            9
+#define TRACK_EVENT_TRACK_UUID      11
+#define TRACK_EVENT_NAME            23
+#define TRACK_EVENT_SLICE_BEGIN     1
+#define TRACK_EVENT_SLICE_END       2
+#define TRACK_DESC_UUID             1
+#define TRACK_DESC_NAME             2
+#define TRACK_DESC_PROCESS          3
+#define TRACK_DESC_THREAD           4
+#define TRACK_DESC_PARENT_UUID      5
+#define PROCESS_DESC_PID            1
+#define PROCESS_DESC_NAME           6
+#define THREAD_DESC_PID             1
+#define THREAD_DESC_TID             2
+#define THREAD_DESC_NAME            5
+
+#define SEQUENCE_ID                 1
+#define UUID_PROCESS                1
+#define UUID_THREAD(i)              (0x100000000ull + (uint64_t)(i))
+#define UUID_CPU(i)                 (0x200000000ull + (uint64_t)(i))
+#define UUID_CPU_THREAD(c, t)       ((3ull << 56) | ((uint64_t)(c) << 32) \
+                                    | (uint64_t)(t))
+
+/* Write a finished packet as a Trace.packet field, then reset it. */
+static void
+write_packet(FILE *out, pbuf *tmp, pbuf *pkt)
+{
+	pb_uint(pkt, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+	tmp->len = 0;
+	pb_msg(tmp, TRACE_PACKET, pkt);
+	if (!tmp->err) {
+		fwrite(tmp->buf, 1, tmp->len, out);
+	}
+}
+
+/*
+ * A slice boundary on a track. 'kind' orders boundaries that have the
+ * same timestamp: ends of non-empty slices first, then begins, then ends
+ * of empty slices (begin and end at the same nanosecond); among begins, longer slices come first, and among
+ * ends, shorter slices come first, so that nesting is preserved.
+ */
+typedef struct {
+	uint64_t ts;
+	uint64_t len;
+	uint64_t track;
+	uint32_t site;
+	int kind;
+} boundary;
+
+static int
+cmp_boundary(const void *v1, const void *v2)
+{
+	const boundary *b1 = v1;
+	const boundary *b2 = v2;
+	if (b1->ts != b2->ts) {
+		return b1->ts < b2->ts ? -1 : 1;
+	}
+	if (b1->kind != b2->kind) {
+		return b1->kind < b2->kind ? -1 : 1;
+	}
+	if (b1->len != b2->len) {
+		int r = b1->len < b2->len ? -1 : 1;
+		return b1->kind == 1 ? -r : r;
+	}
+	return 0;
+}
+
+static int
+cmp_u64(const void *v1, const void *v2)
+{
+	uint64_t x1 = *(const uint64_t *)v1;
+	uint64_t x2 = *(const uint64_t *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+int
+tr_export_perfetto(const trace *tr, FILE *out)
+{
+	pbuf pkt = { NULL, 0, 0, 0 };
+	pbuf sub = { NULL, 0, 0, 0 };
+	pbuf sub2 = { NULL, 0, 0, 0 };
+	pbuf tmp = { NULL, 0, 0, 0 };
+	char name[64];
+
+	/* Process track. */
+	pb_uint(&sub, TRACK_DESC_UUID, UUID_PROCESS);
+	pb_uint(&sub2, PROCESS_DESC_PID, tr->pid);
+	snprintf(name, sizeof name, "pid %llu", (unsigned long long)tr->pid);
+	pb_string(&sub2, PROCESS_DESC_NAME, name);
+	pb_msg(&sub, TRACK_DESC_PROCESS, &sub2);
+	pb_msg(&pkt, PACKET_TRACK_DESCRIPTOR, &sub);
+	write_packet(out, &tmp, &pkt);
+
+	/* Thread tracks. */
+	for (size_t i = 0; i < tr->num_threads; i ++) {
+		if (!tr->threads[i].seen) {
+			continue;
+		}
+		pb_uint(&sub, TRACK_DESC_UUID, UUID_THREAD(i));
+		pb_uint(&sub2, THREAD_DESC_PID, tr->pid);
+		pb_uint(&sub2, THREAD_DESC_TID, tr->threads[i].tid);
+		snprintf(name, sizeof name, "thread %zu", i);
+		pb_string(&sub2, THREAD_DESC_NAME, name);
+		pb_msg(&sub, TRACK_DESC_THREAD, &sub2);
+		pb_msg(&pkt, PACKET_TRACK_DESCRIPTOR, &sub);
+		write_packet(out, &tmp, &pkt);
+	}
+
+	/* CPU tracks. Regions of threads time-sliced on a CPU may cross
+	   each other, which begin/end pairs on a single track cannot
+	   represent: each CPU track has a child track per thread, on
+	   which the regions of that thread nest. */
+	int err = 0;
+	uint64_t *pairs = NULL;
+	boundary *bb = NULL;
+	size_t ncpu;
+	unsigned char *seen = cpus_seen(tr, &ncpu);
+	if (seen == NULL) {
+		err = 1;
+		goto done;
+	}
+	for (size_t i = 0; i < ncpu; i ++) {
+		if (!seen[i]) {
+			continue;
+		}
+		pb_uint(&sub, TRACK_DESC_UUID, UUID_CPU(i));
+		snprintf(name, sizeof name, "CPU %zu", i);
+		pb_string(&sub, TRACK_DESC_NAME, name);
+		pb_msg(&pkt, PACKET_TRACK_DESCRIPTOR, &sub);
+		write_packet(out, &tmp, &pkt);
+	}
+	free(seen);
+	pairs = malloc((tr->num_ev + 1) * sizeof *pairs);
+	if (pairs == NULL) {
+		err = 1;
+		goto done;
+	}
+	size_t np = 0;
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		const tr_event *e = &tr->ev[i];
+		if (e->cpu != (uint32_t)-1) {
+			pairs[np ++] = ((uint64_t)e->cpu << 32) | e->thread;
+		}
+	}
+	qsort(pairs, np, sizeof *pairs, &cmp_u64);
+	for (size_t i = 0; i < np; i ++) {
+		if (i > 0 && pairs[i] == pairs[i - 1]) {
+			continue;
+		}
+		uint32_t cpu = (uint32_t)(pairs[i] >> 32);
+		uint32_t thread = (uint32_t)pairs[i];
+		pb_uint(&sub, TRACK_DESC_UUID, UUID_CPU_THREAD(cpu, thread));
+		pb_uint(&sub, TRACK_DESC_PARENT_UUID, UUID_CPU(cpu));
+		snprintf(name, sizeof name, "thread %u", thread);
+		pb_string(&sub, TRACK_DESC_NAME, name);
+		pb_msg(&pkt, PACKET_TRACK_DESCRIPTOR, &sub);
+		write_packet(out, &tmp, &pkt);
+	}
+
+	/* Slices: collect all boundaries, sort them by time. Timestamps
+	   are absolute CLOCK_MONOTONIC values. */
+	bb = malloc((tr->num_ev * 4 + 1) * sizeof *bb);
+	if (bb == NULL) {
+		err = 1;
+		goto done;
+	}
+	size_t nb = 0;
+	for (size_t i = 0; i < tr->num_ev; i ++) {
+		const tr_event *e = &tr->ev[i];
+		double t0 = tr_time_ns(tr, e->cpu, e->start);
+		double t1 = tr_time_ns(tr, e->cpu, e->start + e->len);
+		uint64_t ts0 = tr->base_ns + (uint64_t)(t0 < 0 ? 0 : t0);
+		uint64_t ts1 = tr->base_ns + (uint64_t)(t1 < 0 ? 0 : t1);
+		for (int k = 0; k < 2; k ++) {
+			uint64_t track;
+			if (k == 0) {
+				track = UUID_THREAD(e->thread);
+			} else if (e->cpu != (uint32_t)-1) {
+				track = UUID_CPU_THREAD(e->cpu, e->thread);
+			} else {
+				break;
+			}
+			boundary *b = &bb[nb ++];
+			b->ts = ts0;
+			b->len = e->len;
+			b->track = track;
+			b->site = e->site;
+			b->kind = 1;
+			b = &bb[nb ++];
+			b->ts = ts1;
+			b->len = e->len;
+			b->track = track;
+			b->site = e->site;
+			b->kind = ts1 == ts0 ? 2 : 0;
+		}
+	}
+	qsort(bb, nb, sizeof *bb, &cmp_boundary);
+	for (size_t i = 0; i < nb; i ++) {
+		const boundary *b = &bb[i];
+		pb_uint(&pkt, PACKET_TIMESTAMP, b->ts);
+		pb_uint(&sub, TRACK_EVENT_TYPE, b->kind == 1
+			? TRACK_EVENT_SLICE_BEGIN : TRACK_EVENT_SLICE_END);
+		pb_uint(&sub, TRACK_EVENT_TRACK_UUID, b->track);
+		if (b->kind == 1) {
+			pb_string(&sub, TRACK_EVENT_NAME,
+				tr_site_name(tr, b->site));
+		}
+		pb_msg(&pkt, PACKET_TRACK_EVENT, &sub);
+		write_packet(out, &tmp, &pkt);
+	}
+
+done:
+	free(pairs);
+	free(bb);
+	err |= pkt.err | sub.err | sub2.err | tmp.err;
+	free(pkt.buf);
+	free(sub.buf);
+	free(sub2.buf);
+	free(tmp.buf);
+	return (err || ferror(out)) ? -1 : 0;
+}
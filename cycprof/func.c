@@ -0,0 +1,400 @@
+/*
+ * cycprof: per-function cycle accounting through the -finstrument-functions
+ * hooks. Each thread has a shadow stack of active calls and an
+ * open-addressing table of functions, keyed by address; both come from
+ * a static pool, claimed on the first call made by the thread. Tables
+ * are updated only by their owning thread, and merged for the report.
+ *
+ * The hooks themselves must not be instrumented (they would recurse),
+ * and neither must anything they call; core_cycles() is inline.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycprof.h"
+
+#define NOINST   __attribute__((no_instrument_function))
+
+typedef struct {
+	void *fn;
+	uint64_t calls;
+	uint64_t incl;
+	uint64_t excl;
+	/* Number of activations currently on the shadow stack. */
+	uint32_t active;
+} func_entry;
+
+/*
+ * A node of the calling-context tree. Node 0 is the root (no function).
+ * Children are linked through 'child' and 'sibling' (0 ends the list).
+ */
+typedef struct {
+	void *fn;
+	uint32_t parent;
+	uint32_t child;
+	uint32_t sibling;
+	uint64_t calls;
+	uint64_t excl;
+} cct_node;
+
+typedef struct {
+	func_entry *fe;
+	uint32_t node;
+	uint64_t start;
+	/* Inclusive cycles of the callees. */
+	uint64_t child;
+} frame;
+
+typedef struct {
+	uint32_t depth;
+	/* Calls beyond the shadow stack, or to functions not in the table. */
+	uint32_t lost_depth;
+	uint64_t lost;
+	frame stack[CYCPROF_FUNC_DEPTH];
+	func_entry func[CYCPROF_MAX_FUNCS];
+	uint32_t cct_used;
+	cct_node cct[CYCPROF_CCT_NODES];
+} func_thread;
+
+static func_thread pool[CYCPROF_MAX_THREADS];
+static uint32_t pool_used;
+static __thread func_thread *func_self;
+static __thread int func_none;
+static int report_registered;
+
+static void report_at_exit(void) NOINST;
+
+static NOINST func_thread *
+func_attach(void)
+{
+	if (func_none) {
+		return NULL;
+	}
+	uint32_t n = __atomic_fetch_add(&pool_used, 1, __ATOMIC_RELAXED);
+	if (n >= CYCPROF_MAX_THREADS) {
+		__atomic_store_n(&pool_used, CYCPROF_MAX_THREADS,
+			__ATOMIC_RELAXED);
+		func_none = 1;
+		return NULL;
+	}
+	if (!__atomic_exchange_n(&report_registered, 1, __ATOMIC_RELAXED)) {
+		atexit(&report_at_exit);
+	}
+	func_self = &pool[n];
+	func_self->cct_used = 1;
+	return func_self;
+}
+
+/*
+ * Find (or create) the table entry for a function. Returns NULL if the
+ * table is full.
+ */
+static inline NOINST func_entry *
+func_lookup(func_thread *ft, void *fn)
+{
+	uintptr_t a = (uintptr_t)fn;
+	size_t mask = CYCPROF_MAX_FUNCS - 1;
+	size_t i = (size_t)((a >> 4) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+	for (size_t k = 0; k < CYCPROF_MAX_FUNCS; k ++) {
+		func_entry *fe = &ft->func[i];
+		if (fe->fn == fn) {
+			return fe;
+		}
+		if (fe->fn == NULL) {
+			__atomic_store_n(&fe->fn, fn, __ATOMIC_RELEASE);
+			return fe;
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+/*
+ * Find (or create) the child of node 'parent' for function 'fn'. If the
+ * tree is full, 'parent' is returned.
+ */
+static inline NOINST uint32_t
+cct_child(func_thread *ft, uint32_t parent, void *fn)
+{
+	for (uint32_t c = ft->cct[parent].child; c != 0;
+		c = ft->cct[c].sibling)
+	{
+		if (ft->cct[c].fn == fn) {
+			return c;
+		}
+	}
+	uint32_t c = ft->cct_used;
+	if (c >= CYCPROF_CCT_NODES) {
+		return parent;
+	}
+	cct_node *cn = &ft->cct[c];
+	cn->fn = fn;
+	cn->parent = parent;
+	cn->sibling = ft->cct[parent].child;
+	/* Published last, for a concurrent cyc_func_folded(). */
+	__atomic_store_n(&ft->cct_used, c + 1, __ATOMIC_RELEASE);
+	ft->cct[parent].child = c;
+	return c;
+}
+
+NOINST void
+__cyg_profile_func_enter(void *fn, void *call_site)
+{
+	(void)call_site;
+	func_thread *ft = func_self;
+	if (ft == NULL) {
+		ft = func_attach();
+		if (ft == NULL) {
+			return;
+		}
+	}
+	if (ft->lost_depth > 0 || ft->depth >= CYCPROF_FUNC_DEPTH) {
+		ft->lost_depth ++;
+		ft->lost ++;
+		return;
+	}
+	func_entry *fe = func_lookup(ft, fn);
+	if (fe == NULL) {
+		ft->lost_depth ++;
+		ft->lost ++;
+		return;
+	}
+	fe->active ++;
+	uint32_t parent = ft->depth > 0 ? ft->stack[ft->depth - 1].node : 0;
+	frame *f = &ft->stack[ft->depth ++];
+	f->fe = fe;
+	f->node = cct_child(ft, parent, fn);
+	f->child = 0;
+	/* Read last, so that the hook cost is mostly outside the call. */
+	f->start = core_cycles();
+}
+
+NOINST void
+__cyg_profile_func_exit(void *fn, void *call_site)
+{
+	uint64_t end = core_cycles();
+	(void)call_site;
+	func_thread *ft = func_self;
+	if (ft == NULL) {
+		return;
+	}
+	if (ft->lost_depth > 0) {
+		ft->lost_depth --;
+		return;
+	}
+	/* Frames left by a longjmp() or an exception are unwound up to
+	   the matching one; an exit without a matching frame is ignored. */
+	uint32_t d = ft->depth;
+	while (d > 0 && ft->stack[d - 1].fe->fn != fn) {
+		d --;
+	}
+	if (d == 0) {
+		return;
+	}
+	while (ft->depth >= d) {
+		frame *f = &ft->stack[-- ft->depth];
+		func_entry *fe = f->fe;
+		uint64_t len = end - f->start;
+		uint64_t excl = len > f->child ? len - f->child : 0;
+		fe->active --;
+		__atomic_store_n(&fe->calls, fe->calls + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&fe->excl, fe->excl + excl, __ATOMIC_RELAXED);
+		if (fe->active == 0) {
+			__atomic_store_n(&fe->incl, fe->incl + len,
+				__ATOMIC_RELAXED);
+		}
+		cct_node *cn = &ft->cct[f->node];
+		__atomic_store_n(&cn->calls, cn->calls + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&cn->excl, cn->excl + excl, __ATOMIC_RELAXED);
+		if (ft->depth > 0) {
+			ft->stack[ft->depth - 1].child += len;
+		}
+	}
+}
+
+static NOINST int
+cmp_fn(const void *v1, const void *v2)
+{
+	uintptr_t a1 = (uintptr_t)((const func_entry *)v1)->fn;
+	uintptr_t a2 = (uintptr_t)((const func_entry *)v2)->fn;
+	if (a1 < a2) {
+		return -1;
+	} else if (a1 == a2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+static NOINST int
+cmp_excl(const void *v1, const void *v2)
+{
+	uint64_t x1 = ((const func_entry *)v1)->excl;
+	uint64_t x2 = ((const func_entry *)v2)->excl;
+	if (x1 > x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+NOINST void
+cyc_func_report(FILE *out)
+{
+	uint32_t nt = __atomic_load_n(&pool_used, __ATOMIC_RELAXED);
+	if (nt > CYCPROF_MAX_THREADS) {
+		nt = CYCPROF_MAX_THREADS;
+	}
+
+	/* Gather all entries of all threads, then merge by address. */
+	size_t n = 0;
+	for (uint32_t t = 0; t < nt; t ++) {
+		for (size_t i = 0; i < CYCPROF_MAX_FUNCS; i ++) {
+			if (__atomic_load_n(&pool[t].func[i].fn,
+				__ATOMIC_ACQUIRE) != NULL)
+			{
+				n ++;
+			}
+		}
+	}
+	func_entry *all = malloc((n > 0 ? n : 1) * sizeof *all);
+	if (all == NULL) {
+		return;
+	}
+	size_t k = 0;
+	uint64_t lost = 0;
+	for (uint32_t t = 0; t < nt && k < n; t ++) {
+		const func_thread *ft = &pool[t];
+		lost += ft->lost;
+		for (size_t i = 0; i < CYCPROF_MAX_FUNCS && k < n; i ++) {
+			const func_entry *fe = &ft->func[i];
+			void *fn = __atomic_load_n(&fe->fn, __ATOMIC_ACQUIRE);
+			if (fn == NULL) {
+				continue;
+			}
+			all[k].fn = fn;
+			all[k].calls = __atomic_load_n(&fe->calls,
+				__ATOMIC_RELAXED);
+			all[k].incl = __atomic_load_n(&fe->incl,
+				__ATOMIC_RELAXED);
+			all[k].excl = __atomic_load_n(&fe->excl,
+				__ATOMIC_RELAXED);
+			k ++;
+		}
+	}
+	n = k;
+	qsort(all, n, sizeof *all, &cmp_fn);
+	k = 0;
+	uint64_t total = 0;
+	for (size_t i = 0; i < n; i ++) {
+		total += all[i].excl;
+		if (k > 0 && all[k - 1].fn == all[i].fn) {
+			all[k - 1].calls += all[i].calls;
+			all[k - 1].incl += all[i].incl;
+			all[k - 1].excl += all[i].excl;
+		} else {
+			all[k ++] = all[i];
+		}
+	}
+	n = k;
+	qsort(all, n, sizeof *all, &cmp_excl);
+
+	fprintf(out, "%-40s %10s %14s %14s %6s %12s\n",
+		"function", "calls", "inclusive", "exclusive", "excl%",
+		"incl/call");
+	for (size_t i = 0; i < n; i ++) {
+		const func_entry *fe = &all[i];
+		if (fe->calls == 0) {
+			continue;
+		}
+		char name[256];
+		cyc_sym_lookup(fe->fn, name, sizeof name);
+		fprintf(out, "%-40s %10llu %14llu %14llu %6.2f %12.1f\n",
+			name, (unsigned long long)fe->calls,
+			(unsigned long long)fe->incl,
+			(unsigned long long)fe->excl,
+			total > 0 ? 100.0 * (double)fe->excl / (double)total
+				: 0.0,
+			(double)fe->incl / (double)fe->calls);
+	}
+	if (lost > 0) {
+		fprintf(out, "(%llu calls not accounted: shadow stack"
+			" or function table full)\n", (unsigned long long)lost);
+	}
+	free(all);
+}
+
+NOINST void
+cyc_func_folded(FILE *out)
+{
+	uint32_t nt = __atomic_load_n(&pool_used, __ATOMIC_RELAXED);
+	if (nt > CYCPROF_MAX_THREADS) {
+		nt = CYCPROF_MAX_THREADS;
+	}
+	/* Identical paths in distinct threads yield distinct lines; flame
+	   graph tools add them up. */
+	for (uint32_t t = 0; t < nt; t ++) {
+		const func_thread *ft = &pool[t];
+		uint32_t used = __atomic_load_n(&ft->cct_used, __ATOMIC_ACQUIRE);
+		for (uint32_t i = 1; i < used; i ++) {
+			const cct_node *cn = &ft->cct[i];
+			uint64_t excl = __atomic_load_n(&cn->excl,
+				__ATOMIC_RELAXED);
+			if (excl == 0) {
+				continue;
+			}
+			/* The path is collected innermost first; a node
+			   is always deeper than its parent by exactly one
+			   level of the shadow stack. */
+			uint32_t path[CYCPROF_FUNC_DEPTH];
+			size_t len = 0;
+			for (uint32_t j = i; j != 0 && len < CYCPROF_FUNC_DEPTH;
+				j = ft->cct[j].parent)
+			{
+				path[len ++] = j;
+			}
+			while (len -- > 0) {
+				char name[256];
+				cyc_sym_lookup(ft->cct[path[len]].fn,
+					name, sizeof name);
+				fputs(name, out);
+				fputc(len > 0 ? ';' : ' ', out);
+			}
+			fprintf(out, "%llu\n", (unsigned long long)excl);
+		}
+	}
+}
+
+static NOINST void
+write_to(const char *var, void (*report)(FILE *))
+{
+	const char *path = getenv(var);
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		return;
+	}
+	report(out);
+	fclose(out);
+}
+
+static NOINST void
+report_at_exit(void)
+{
+	/* Calls made from here on (destructors...) are not accounted. */
+	func_none = 1;
+	func_self = NULL;
+	const char *path = getenv("CYCPROF_FUNC_REPORT");
+	if (path != NULL && path[0] != 0) {
+		write_to("CYCPROF_FUNC_REPORT", &cyc_func_report);
+	} else {
+		cyc_func_report(stderr);
+	}
+	path = getenv("CYCPROF_FOLDED");
+	if (path != NULL && path[0] != 0) {
+		write_to("CYCPROF_FOLDED", &cyc_func_folded);
+	}
+}
@@ -0,0 +1,142 @@
+/*
+ * cycprof: per-thread, per-site histograms of region lengths. Histograms
+ * are claimed from a static pool (no allocation on the recording path),
+ * updated only by their owning thread, and merged on demand.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cycprof.h"
+
+static cyc_hist pool[CYCPROF_MAX_HISTS];
+static uint32_t pool_used;
+
+cyc_hist *
+cyc_hist_attach(cyc_thread *t, uint32_t site)
+{
+	if (t->index == (uint32_t)-1 || site >= CYCPROF_MAX_SITES) {
+		return NULL;
+	}
+	cyc_hist *h = t->hist[site];
+	if (h != NULL) {
+		return h;
+	}
+	uint32_t n = __atomic_fetch_add(&pool_used, 1, __ATOMIC_RELAXED);
+	if (n >= CYCPROF_MAX_HISTS) {
+		__atomic_store_n(&pool_used, CYCPROF_MAX_HISTS, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	h = &pool[n];
+	__atomic_store_n(&t->hist[site], h, __ATOMIC_RELEASE);
+	return h;
+}
+
+int
+cyc_hist_merge(uint32_t site, cyc_hist *dst)
+{
+	memset(dst, 0, sizeof *dst);
+	if (site >= CYCPROF_MAX_SITES) {
+		return -1;
+	}
+	int found = 0;
+	size_t nt = cyc_thread_count();
+	for (size_t i = 0; i < nt; i ++) {
+		cyc_thread *t = cyc_thread_get(i);
+		const cyc_hist *h = __atomic_load_n(
+			&t->hist[site], __ATOMIC_ACQUIRE);
+		if (h == NULL) {
+			continue;
+		}
+		found = 1;
+		dst->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+		dst->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+		dst->wcount += __atomic_load_n(&h->wcount, __ATOMIC_RELAXED);
+		dst->wsum += __atomic_load_n(&h->wsum, __ATOMIC_RELAXED);
+		uint64_t m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+		if (m > dst->max) {
+			dst->max = m;
+		}
+		for (size_t j = 0; j < CYC_HIST_BUCKETS; j ++) {
+			dst->bucket[j] += __atomic_load_n(
+				&h->bucket[j], __ATOMIC_RELAXED);
+		}
+	}
+	return found ? 0 : -1;
+}
+
+/* Lowest value that falls into bucket b. */
+static uint64_t
+bucket_low(unsigned b)
+{
+	if (b < (1u << CYC_HIST_SUB_BITS)) {
+		return b;
+	}
+	unsigned g = b >> CYC_HIST_SUB_BITS;
+	uint64_t m = b & ((1u << CYC_HIST_SUB_BITS) - 1);
+	return (((uint64_t)1 << CYC_HIST_SUB_BITS) | m) << (g - 1);
+}
+
+uint64_t
+cyc_hist_quantile(const cyc_hist *h, double q)
+{
+	/* The count is recomputed from the buckets, since a concurrent
+	   merge may see 'count' and 'bucket[]' out of sync. */
+	uint64_t total = 0;
+	for (size_t j = 0; j < CYC_HIST_BUCKETS; j ++) {
+		total += h->bucket[j];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	if (q >= 1.0) {
+		return h->max;
+	}
+	if (q < 0.0) {
+		q = 0.0;
+	}
+	uint64_t rank = (uint64_t)(q * (double)total);
+	uint64_t acc = 0;
+	for (unsigned j = 0; j < CYC_HIST_BUCKETS; j ++) {
+		acc += h->bucket[j];
+		if (acc > rank) {
+			uint64_t lo = bucket_low(j);
+			uint64_t hi = j + 1 < CYC_HIST_BUCKETS
+				? bucket_low(j + 1) - 1 : (uint64_t)-1;
+			uint64_t v = lo + ((hi - lo) >> 1);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+void
+cyc_hist_dump(FILE *out)
+{
+	cyc_hist *h = malloc(sizeof *h);
+	if (h == NULL) {
+		return;
+	}
+	fprintf(out, "%-24s %12s %12s %10s %8s %8s %8s %8s %10s\n",
+		"site", "calls", "measured", "mean",
+		"p50", "p90", "p99", "p99.9", "max");
+	uint32_t ns = cyc_site_count();
+	for (uint32_t id = 1; id <= ns; id ++) {
+		if (cyc_hist_merge(id, h) < 0 || h->count == 0) {
+			continue;
+		}
+		const cyc_site *site = cyc_site_get(id);
+		fprintf(out, "%-24s %12llu %12llu %10.1f"
+			" %8llu %8llu %8llu %8llu %10llu\n",
+			site != NULL ? site->name : "?",
+			(unsigned long long)h->wcount,
+			(unsigned long long)h->count,
+			(double)h->sum / (double)h->count,
+			(unsigned long long)cyc_hist_quantile(h, 0.5),
+			(unsigned long long)cyc_hist_quantile(h, 0.9),
+			(unsigned long long)cyc_hist_quantile(h, 0.99),
+			(unsigned long long)cyc_hist_quantile(h, 0.999),
+			(unsigned long long)h->max);
+	}
+	free(h);
+}
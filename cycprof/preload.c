@@ -0,0 +1,322 @@
+/*
+ * cycprof LD_PRELOAD shim: measure selected libc functions (memcpy,
+ * memset, malloc, calloc, realloc, free) in unmodified binaries.
+ *
+ *    LD_PRELOAD=./cycprof/libcycpreload.so ./program
+ *
+ * Each wrapper brackets the real function (found with dlsym(RTLD_NEXT))
+ * with core_cycles() reads, and records the length into the histogram
+ * of a per-function site and of a per-size-class site (e.g.
+ * "memcpy[65-256]"). The percentile table (see cyc_hist_dump()) is
+ * written at exit to standard error (as it was when the program started,
+ * even if the program closes it), or to the file named by the
+ * CYCPROF_PRELOAD_REPORT environment variable. If CYCPROF_PRELOAD_PERIOD
+ * is set to a value greater than 1, calls are sampled with random
+ * intervals of that mean (see cyc_set_sampling()).
+ *
+ * Only calls that go through the dynamic linker are seen: the compiler
+ * often inlines small memcpy() and memset() calls, and calls made by
+ * libc to itself are internal.
+ *
+ * This file is compiled with -fno-builtin, so that the definitions below
+ * are not recognized (and rewritten) as the builtins they replace.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cycprof.h"
+
+#define EXPORT   __attribute__((visibility("default")))
+
+/*
+ * Size classes: 0-16, 17-64, 65-256, 257-1K, 1K-4K, 4K-16K, 16K-64K,
+ * more than 64K (upper bounds inclusive).
+ */
+#define NUM_CLASSES   8
+
+static inline unsigned
+size_class(size_t n)
+{
+	unsigned c = 0;
+	while (c < NUM_CLASSES - 1 && n > ((size_t)16 << (2 * c))) {
+		c ++;
+	}
+	return c;
+}
+
+#define SITE(name)   { name, __FILE__, __LINE__, 0, 0 }
+#define CLASS_SITES(f) { \
+		SITE(f "[0-16]"), SITE(f "[17-64]"), \
+		SITE(f "[65-256]"), SITE(f "[257-1K]"), \
+		SITE(f "[1K-4K]"), SITE(f "[4K-16K]"), \
+		SITE(f "[16K-64K]"), SITE(f "[>64K]") }
+
+enum { F_MEMCPY, F_MEMSET, F_MALLOC, F_CALLOC, F_REALLOC, F_FREE, NUM_F };
+
+static cyc_site func_site[NUM_F] = {
+	SITE("memcpy"), SITE("memset"), SITE("malloc"),
+	SITE("calloc"), SITE("realloc"), SITE("free")
+};
+
+/* free() has no size, hence no size classes. */
+static cyc_site class_site[NUM_F - 1][NUM_CLASSES] = {
+	CLASS_SITES("memcpy"), CLASS_SITES("memset"),
+	CLASS_SITES("malloc"), CLASS_SITES("calloc"),
+	CLASS_SITES("realloc")
+};
+
+static struct {
+	void *(*memcpy)(void *, const void *, size_t);
+	void *(*memset)(void *, int, size_t);
+	void *(*malloc)(size_t);
+	void *(*calloc)(size_t, size_t);
+	void *(*realloc)(void *, size_t);
+	void (*free)(void *);
+} real;
+
+/*
+ * Set while the shim does its own work (recording, resolving, reporting)
+ * in the current thread: calls made meanwhile are passed through
+ * without being measured.
+ */
+static __thread int in_shim;
+static int resolving;
+
+/*
+ * dlsym() may allocate memory before the real allocator is known; such
+ * requests are served from this buffer, and never freed. Each block is
+ * preceded by its size.
+ */
+static unsigned char boot_buf[16384] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static void *
+boot_alloc(size_t n)
+{
+	size_t len = ((n + 15) & ~(size_t)15) + 16;
+	size_t off = __atomic_fetch_add(&boot_used, len, __ATOMIC_RELAXED);
+	if (off + len > sizeof boot_buf) {
+		return NULL;
+	}
+	*(size_t *)(boot_buf + off) = n;
+	return boot_buf + off + 16;
+}
+
+static inline int
+is_boot(const void *p)
+{
+	return (const unsigned char *)p >= boot_buf
+		&& (const unsigned char *)p < boot_buf + sizeof boot_buf;
+}
+
+static void
+resolve(void)
+{
+	if (__atomic_exchange_n(&resolving, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	in_shim ++;
+	real.malloc = dlsym(RTLD_NEXT, "malloc");
+	real.calloc = dlsym(RTLD_NEXT, "calloc");
+	real.realloc = dlsym(RTLD_NEXT, "realloc");
+	real.free = dlsym(RTLD_NEXT, "free");
+	real.memset = dlsym(RTLD_NEXT, "memset");
+	real.memcpy = dlsym(RTLD_NEXT, "memcpy");
+	in_shim --;
+}
+
+static inline uint64_t
+measure_begin(unsigned f)
+{
+	if (in_shim) {
+		return CYC_NOT_SAMPLED;
+	}
+	in_shim ++;
+	uint64_t start = cyc_region_begin(&func_site[f]);
+	in_shim --;
+	return start;
+}
+
+static inline void
+measure_end(unsigned f, size_t size, uint64_t start)
+{
+	if (start == CYC_NOT_SAMPLED) {
+		return;
+	}
+	uint64_t end = core_cycles();
+	in_shim ++;
+	cyc_site *site = &func_site[f];
+	uint32_t weight = cyc_region_weight(site);
+	cyc_region_record_weighted(site, start, end, weight);
+	if (f != F_FREE) {
+		cyc_region_record_weighted(&class_site[f][size_class(size)],
+			start, end, weight);
+	}
+	in_shim --;
+}
+
+EXPORT void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	if (real.memcpy == NULL) {
+		resolve();
+		if (real.memcpy == NULL) {
+			unsigned char *d = dst;
+			const unsigned char *s = src;
+			while (n -- > 0) {
+				*d ++ = *s ++;
+			}
+			return dst;
+		}
+	}
+	uint64_t start = measure_begin(F_MEMCPY);
+	void *r = real.memcpy(dst, src, n);
+	measure_end(F_MEMCPY, n, start);
+	return r;
+}
+
+EXPORT void *
+memset(void *dst, int c, size_t n)
+{
+	if (real.memset == NULL) {
+		resolve();
+		if (real.memset == NULL) {
+			unsigned char *d = dst;
+			while (n -- > 0) {
+				*d ++ = (unsigned char)c;
+			}
+			return dst;
+		}
+	}
+	uint64_t start = measure_begin(F_MEMSET);
+	void *r = real.memset(dst, c, n);
+	measure_end(F_MEMSET, n, start);
+	return r;
+}
+
+EXPORT void *
+malloc(size_t n)
+{
+	if (real.malloc == NULL) {
+		resolve();
+		if (real.malloc == NULL) {
+			return boot_alloc(n);
+		}
+	}
+	uint64_t start = measure_begin(F_MALLOC);
+	void *r = real.malloc(n);
+	measure_end(F_MALLOC, n, start);
+	return r;
+}
+
+EXPORT void *
+calloc(size_t n, size_t m)
+{
+	if (real.calloc == NULL) {
+		resolve();
+		if (real.calloc == NULL) {
+			/* The buffer is in BSS, hence already zero. */
+			if (m != 0 && n > (size_t)-1 / m) {
+				return NULL;
+			}
+			return boot_alloc(n * m);
+		}
+	}
+	uint64_t start = measure_begin(F_CALLOC);
+	void *r = real.calloc(n, m);
+	measure_end(F_CALLOC, n * m, start);
+	return r;
+}
+
+EXPORT void *
+realloc(void *p, size_t n)
+{
+	if (real.realloc == NULL) {
+		resolve();
+		if (real.realloc == NULL) {
+			return NULL;
+		}
+	}
+	if (is_boot(p)) {
+		/* Move out of the bootstrap buffer. */
+		size_t old = *(size_t *)((unsigned char *)p - 16);
+		void *q = real.malloc(n);
+		if (q != NULL) {
+			real.memcpy(q, p, old < n ? old : n);
+		}
+		return q;
+	}
+	uint64_t start = measure_begin(F_REALLOC);
+	void *r = real.realloc(p, n);
+	measure_end(F_REALLOC, n, start);
+	return r;
+}
+
+EXPORT void
+free(void *p)
+{
+	if (p == NULL || is_boot(p)) {
+		return;
+	}
+	if (real.free == NULL) {
+		resolve();
+		if (real.free == NULL) {
+			return;
+		}
+	}
+	uint64_t start = measure_begin(F_FREE);
+	real.free(p);
+	measure_end(F_FREE, 0, start);
+}
+
+/* Private copy of the standard error descriptor: programs may close
+   stderr at exit (e.g. in an atexit() handler) before the report. */
+static int report_fd = -1;
+
+__attribute__((constructor))
+static void
+shim_init(void)
+{
+	resolve();
+	report_fd = fcntl(2, F_DUPFD_CLOEXEC, 3);
+	cyc_set_record_mode(CYC_RECORD_HIST);
+	const char *s = getenv("CYCPROF_PRELOAD_PERIOD");
+	if (s != NULL) {
+		unsigned long period = strtoul(s, NULL, 10);
+		if (period > 1) {
+			cyc_set_sampling((uint32_t)period, 1);
+		}
+	}
+}
+
+__attribute__((destructor))
+static void
+shim_report(void)
+{
+	in_shim ++;
+	FILE *err = report_fd >= 0 ? fdopen(report_fd, "w") : NULL;
+	const char *path = getenv("CYCPROF_PRELOAD_REPORT");
+	if (path != NULL && path[0] != 0) {
+		FILE *out = fopen(path, "w");
+		if (out != NULL) {
+			cyc_hist_dump(out);
+			fclose(out);
+		} else if (err != NULL) {
+			fprintf(err, "%s: %s\n", path, strerror(errno));
+		}
+	} else if (err != NULL) {
+		cyc_hist_dump(err);
+	}
+	if (err != NULL) {
+		fclose(err);
+	} else if (report_fd >= 0) {
+		close(report_fd);
+	}
+	in_shim --;
+}
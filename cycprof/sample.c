@@ -0,0 +1,108 @@
+/*
+ * cycprof: sampling configuration and overhead-based tuning of the
+ * sampling periods. The sampling decision itself is inline in cycprof.h.
+ */
+
+#include <stdlib.h>
+
+#include "cycprof.h"
+
+unsigned cyc_sample_random;
+uint32_t cyc_default_period;
+
+void
+cyc_set_sampling(uint32_t period, int random)
+{
+	__atomic_store_n(&cyc_sample_random, random != 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&cyc_default_period, period, __ATOMIC_RELAXED);
+	uint32_t ns = cyc_site_count();
+	for (uint32_t id = 1; id <= ns; id ++) {
+		cyc_site_set_period(id, period);
+	}
+}
+
+void
+cyc_site_set_period(uint32_t id, uint32_t period)
+{
+	/* cyc_site_get() returns a const pointer, since sites are owned
+	   by the instrumented code; the period is the one field that
+	   the library may update after registration. */
+	cyc_site *site = (cyc_site *)cyc_site_get(id);
+	if (site != NULL) {
+		__atomic_store_n(&site->period, period, __ATOMIC_RELAXED);
+	}
+}
+
+static int
+cmp_u64(const void *v1, const void *v2)
+{
+	uint64_t x1 = *(const uint64_t *)v1;
+	uint64_t x2 = *(const uint64_t *)v2;
+	if (x1 < x2) {
+		return -1;
+	} else if (x1 == x2) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+uint64_t
+cyc_overhead_cycles(void)
+{
+	static uint64_t overhead;
+	uint64_t r = __atomic_load_n(&overhead, __ATOMIC_RELAXED);
+	if (r != 0) {
+		return r;
+	}
+	uint64_t tt[101];
+	for (int i = 0; i < 101; i ++) {
+		uint64_t c0 = core_cycles();
+		uint64_t c1 = core_cycles();
+		tt[i] = c1 - c0;
+	}
+	qsort(tt, 101, sizeof(uint64_t), &cmp_u64);
+	r = tt[50] != 0 ? tt[50] : 1;
+	__atomic_store_n(&overhead, r, __ATOMIC_RELAXED);
+	return r;
+}
+
+size_t
+cyc_sampling_autotune(double budget)
+{
+	if (!(budget > 0.0)) {
+		return 0;
+	}
+	cyc_hist *h = malloc(sizeof *h);
+	if (h == NULL) {
+		return 0;
+	}
+	double overhead = (double)cyc_overhead_cycles();
+	size_t n = 0;
+	uint32_t ns = cyc_site_count();
+	for (uint32_t id = 1; id <= ns; id ++) {
+		if (cyc_hist_merge(id, h) < 0 || h->count == 0) {
+			continue;
+		}
+		double mean = (double)h->sum / (double)h->count;
+		if (mean < 1.0) {
+			mean = 1.0;
+		}
+		double p = overhead / (budget * mean);
+		uint32_t period;
+		if (p <= 1.0) {
+			period = 1;
+		} else if (p >= (double)(1u << 20)) {
+			period = 1u << 20;
+		} else {
+			period = (uint32_t)p;
+			if ((double)period < p) {
+				period ++;
+			}
+		}
+		cyc_site_set_period(id, period);
+		n ++;
+	}
+	free(h);
+	return n;
+}
@@ -0,0 +1,155 @@
+/*
+ * cycprof: publication of the merged per-site histograms into a named
+ * POSIX shared-memory segment. The layout is described in cycshm.h.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cycshm.h"
+
+static struct {
+	cyc_shm_header *hdr;
+	size_t len;
+	char name[256];
+	pthread_t thread;
+	unsigned period_ms;
+	int running;
+	int stop;
+	cyc_hist tmp;
+} shm;
+
+static cyc_shm_site *
+shm_site(uint32_t id)
+{
+	return (cyc_shm_site *)((unsigned char *)shm.hdr
+		+ sizeof(cyc_shm_header) + (size_t)id * sizeof(cyc_shm_site));
+}
+
+int
+cyc_shm_open(const char *name)
+{
+	if (shm.hdr != NULL || name[0] != '/' || strlen(name) >= sizeof shm.name) {
+		return -1;
+	}
+	size_t len = sizeof(cyc_shm_header)
+		+ (size_t)CYCPROF_MAX_SITES * sizeof(cyc_shm_site);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, (off_t)len) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+	cyc_shm_header *hdr = m;
+	hdr->version = CYC_SHM_VERSION;
+	hdr->header_size = sizeof(cyc_shm_header);
+	hdr->site_size = sizeof(cyc_shm_site);
+	hdr->max_sites = CYCPROF_MAX_SITES;
+	hdr->hist_buckets = CYC_HIST_BUCKETS;
+	hdr->hist_sub_bits = CYC_HIST_SUB_BITS;
+	hdr->pid = (uint64_t)getpid();
+	hdr->overhead = cyc_overhead_cycles();
+	snprintf(hdr->backend, sizeof hdr->backend, "%s", CORE_CYCLES_BACKEND);
+	/* The magic is written last, so that a reader that attaches
+	   early does not accept a half-initialized header. */
+	__atomic_store_n(&hdr->magic, CYC_SHM_MAGIC, __ATOMIC_RELEASE);
+	shm.hdr = hdr;
+	shm.len = len;
+	strcpy(shm.name, name);
+	return 0;
+}
+
+void
+cyc_shm_publish(void)
+{
+	cyc_shm_header *hdr = shm.hdr;
+	if (hdr == NULL) {
+		return;
+	}
+	uint32_t ns = cyc_site_count();
+
+	/* Sequence becomes odd: update in progress. */
+	uint64_t seq = hdr->seq;
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (uint32_t id = 1; id <= ns; id ++) {
+		cyc_shm_site *ss = shm_site(id);
+		if (cyc_hist_merge(id, &shm.tmp) < 0) {
+			continue;
+		}
+		const cyc_site *site = cyc_site_get(id);
+		if (ss->name[0] == 0 && site != NULL) {
+			snprintf(ss->name, sizeof ss->name, "%s", site->name);
+		}
+		memcpy(&ss->hist, &shm.tmp, sizeof shm.tmp);
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr->update_ns = (uint64_t)ts.tv_sec * 1000000000u
+		+ (uint64_t)ts.tv_nsec;
+	hdr->num_sites = ns;
+
+	/* Sequence becomes even again: update complete. */
+	__atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void *
+publisher_main(void *arg)
+{
+	(void)arg;
+	while (!__atomic_load_n(&shm.stop, __ATOMIC_ACQUIRE)) {
+		cyc_shm_publish();
+		struct timespec ts;
+		ts.tv_sec = shm.period_ms / 1000;
+		ts.tv_nsec = (long)(shm.period_ms % 1000) * 1000000;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+	}
+	cyc_shm_publish();
+	return NULL;
+}
+
+int
+cyc_shm_start(unsigned period_ms)
+{
+	if (shm.hdr == NULL || shm.running) {
+		return -1;
+	}
+	shm.period_ms = period_ms;
+	shm.stop = 0;
+	if (pthread_create(&shm.thread, NULL, &publisher_main, NULL) != 0) {
+		return -1;
+	}
+	shm.running = 1;
+	return 0;
+}
+
+void
+cyc_shm_close(void)
+{
+	if (shm.running) {
+		__atomic_store_n(&shm.stop, 1, __ATOMIC_RELEASE);
+		pthread_join(shm.thread, NULL);
+		shm.running = 0;
+	}
+	if (shm.hdr != NULL) {
+		munmap(shm.hdr, shm.len);
+		shm_unlink(shm.name);
+		shm.hdr = NULL;
+	}
+}
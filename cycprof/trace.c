@@ -0,0 +1,351 @@
+/*
+ * cycprof: binary trace writer. The format is described in tracefmt.h.
+ * The writer is a sink (see cyc_sink in cycprof.h), normally driven by
+ * the collector thread; encoded chunks accumulate in a large buffer
+ * which is written out with write() only when half full, or at close.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cycprof.h"
+#include "tracefmt.h"
+
+#define TRACE_BUF_LEN   ((size_t)1 << 21)
+
+typedef struct {
+	int fd;
+	int err;
+	unsigned char *buf;
+	size_t len;
+	uint32_t sites_written;
+} trace_writer;
+
+static void
+tw_write_out(trace_writer *w)
+{
+	size_t off = 0;
+	while (off < w->len && !w->err) {
+		ssize_t r = write(w->fd, w->buf + off, w->len - off);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			w->err = 1;
+			break;
+		}
+		off += (size_t)r;
+	}
+	w->len = 0;
+}
+
+/*
+ * Ensure that at least 'n' bytes are free in the buffer. Returns 0 on
+ * success, -1 if the request cannot be satisfied.
+ */
+static int
+tw_reserve(trace_writer *w, size_t n)
+{
+	if (n > TRACE_BUF_LEN - w->len) {
+		tw_write_out(w);
+		if (n > TRACE_BUF_LEN) {
+			w->err = 1;
+		}
+	}
+	return w->err ? -1 : 0;
+}
+
+static void
+tw_put_string(trace_writer *w, const char *s)
+{
+	size_t n = s != NULL ? strlen(s) : 0;
+	w->len += cyc_put_varint(w->buf + w->len, n);
+	if (n > 0) {
+		memcpy(w->buf + w->len, s, n);
+		w->len += n;
+	}
+}
+
+/* Start a chunk; returns the offset of the length field. */
+static size_t
+tw_chunk_begin(trace_writer *w, int type)
+{
+	w->buf[w->len ++] = (unsigned char)type;
+	size_t off = w->len;
+	w->len += 4;
+	return off;
+}
+
+static void
+tw_chunk_end(trace_writer *w, size_t off)
+{
+	cyc_put_u32le(w->buf + off, (uint32_t)(w->len - off - 4));
+}
+
+/*
+ * Emit definitions for the sites registered since the last call. A site
+ * is counted in cyc_site_count() slightly before its definition is
+ * published; the chunk stops before the first such site, which is
+ * emitted by a later call. Identifiers that will never be named are
+ * not pending (see cyc_site_pending()) and are written without a name.
+ */
+static void
+tw_emit_sites(trace_writer *w)
+{
+	uint32_t ns = cyc_site_count();
+	uint32_t last = w->sites_written;
+	while (last < ns && !cyc_site_pending(last + 1)) {
+		last ++;
+	}
+	if (last == w->sites_written) {
+		return;
+	}
+	size_t need = 5 + CYC_VARINT_MAX;
+	for (uint32_t id = w->sites_written + 1; id <= last; id ++) {
+		const cyc_site *s = cyc_site_get(id);
+		need += 4 * CYC_VARINT_MAX;
+		if (s != NULL) {
+			need += strlen(s->name) + strlen(s->file);
+		}
+	}
+	if (tw_reserve(w, need) < 0) {
+		return;
+	}
+	size_t off = tw_chunk_begin(w, CYC_CHUNK_SITES);
+	w->len += cyc_put_varint(w->buf + w->len, last - w->sites_written);
+	for (uint32_t id = w->sites_written + 1; id <= last; id ++) {
+		const cyc_site *s = cyc_site_get(id);
+		w->len += cyc_put_varint(w->buf + w->len, id);
+		tw_put_string(w, s != NULL ? s->name : NULL);
+		tw_put_string(w, s != NULL ? s->file : NULL);
+		w->len += cyc_put_varint(w->buf + w->len,
+			s != NULL ? (uint64_t)s->line : 0);
+	}
+	tw_chunk_end(w, off);
+	w->sites_written = last;
+}
+
+/* Largest number of events in one EVENTS chunk, so that the chunk fits
+   in the buffer; larger batches are split. */
+#define TRACE_MAX_CHUNK_EVENTS \
+	((TRACE_BUF_LEN - 5 - 3 * CYC_VARINT_MAX) / (4 * CYC_VARINT_MAX))
+
+static void
+trace_write(void *ctx, const cyc_thread *t, const cyc_event *ev, size_t num)
+{
+	trace_writer *w = ctx;
+	tw_emit_sites(w);
+	while (num > 0) {
+		size_t n = num < TRACE_MAX_CHUNK_EVENTS
+			? num : TRACE_MAX_CHUNK_EVENTS;
+		size_t need = 5 + 3 * CYC_VARINT_MAX + n * 4 * CYC_VARINT_MAX;
+		if (tw_reserve(w, need) < 0) {
+			return;
+		}
+		size_t off = tw_chunk_begin(w, CYC_CHUNK_EVENTS);
+		unsigned char *buf = w->buf;
+		size_t len = w->len;
+		len += cyc_put_varint(buf + len, t->index);
+		len += cyc_put_varint(buf + len, (uint32_t)t->tid);
+		len += cyc_put_varint(buf + len, n);
+		uint64_t prev = 0;
+		for (size_t i = 0; i < n; i ++) {
+			len += cyc_put_varint(buf + len, ev[i].site);
+			len += cyc_put_varint(buf + len,
+				(uint32_t)(ev[i].cpu + 1));
+			len += cyc_put_svarint(buf + len,
+				(int64_t)(ev[i].start - prev));
+			len += cyc_put_varint(buf + len,
+				ev[i].end - ev[i].start);
+			prev = ev[i].start;
+		}
+		w->len = len;
+		tw_chunk_end(w, off);
+		ev += n;
+		num -= n;
+	}
+}
+
+static void
+trace_flush(void *ctx)
+{
+	trace_writer *w = ctx;
+	if (w->len >= TRACE_BUF_LEN / 2) {
+		tw_write_out(w);
+	}
+}
+
+/*
+ * Emit a calibration chunk: for each CPU in the affinity mask of the
+ * calling thread, migrate to that CPU and read the cycle counter along
+ * with the monotonic clock. The best of a few attempts (the one with the
+ * smallest clock window around the counter read) is kept. The original
+ * affinity mask is restored afterwards.
+ */
+static void
+tw_emit_calib(trace_writer *w)
+{
+	cpu_set_t orig, one;
+	if (sched_getaffinity(0, sizeof orig, &orig) < 0) {
+		return;
+	}
+	int n = CPU_COUNT(&orig);
+	if (tw_reserve(w, 5 + CYC_VARINT_MAX
+		+ (size_t)n * 3 * CYC_VARINT_MAX) < 0)
+	{
+		return;
+	}
+	size_t off = tw_chunk_begin(w, CYC_CHUNK_CALIB);
+	size_t count_off = w->len;
+	w->len += 5;
+	uint32_t count = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && count < (uint32_t)n; cpu ++) {
+		if (!CPU_ISSET(cpu, &orig)) {
+			continue;
+		}
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		if (sched_setaffinity(0, sizeof one, &one) < 0) {
+			continue;
+		}
+		uint64_t best_win = (uint64_t)-1, best_cc = 0, best_ns = 0;
+		for (int i = 0; i < 8; i ++) {
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			uint64_t cc = core_cycles();
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			uint64_t ns0 = (uint64_t)t0.tv_sec * 1000000000u
+				+ (uint64_t)t0.tv_nsec;
+			uint64_t ns1 = (uint64_t)t1.tv_sec * 1000000000u
+				+ (uint64_t)t1.tv_nsec;
+			if (ns1 - ns0 < best_win) {
+				best_win = ns1 - ns0;
+				best_cc = cc;
+				best_ns = ns0 + ((ns1 - ns0) >> 1);
+			}
+		}
+		w->len += cyc_put_varint(w->buf + w->len, (uint64_t)cpu);
+		w->len += cyc_put_varint(w->buf + w->len, best_cc);
+		w->len += cyc_put_varint(w->buf + w->len, best_ns);
+		count ++;
+	}
+	sched_setaffinity(0, sizeof orig, &orig);
+	/* The count is written as a fixed 5-byte varint (with redundant
+	   continuation bits) since it is known only at the end. */
+	for (int i = 0; i < 4; i ++) {
+		w->buf[count_off + i] = (unsigned char)(count | 0x80);
+		count >>= 7;
+	}
+	w->buf[count_off + 4] = (unsigned char)count;
+	tw_chunk_end(w, off);
+}
+
+void
+cyc_cpu_model(char *dst, size_t len)
+{
+	static const char *const keys[] = {
+		"model name", "Model", "uarch", "CPU part", NULL
+	};
+	dst[0] = 0;
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if (f == NULL) {
+		return;
+	}
+	char line[256];
+	int best = -1;
+	while (fgets(line, sizeof line, f) != NULL) {
+		for (int i = 0; keys[i] != NULL; i ++) {
+			size_t kl = strlen(keys[i]);
+			if (best >= 0 && i >= best) {
+				break;
+			}
+			if (strncmp(line, keys[i], kl) != 0
+				|| (line[kl] != ' ' && line[kl] != '\t'
+				&& line[kl] != ':'))
+			{
+				continue;
+			}
+			char *p = strchr(line, ':');
+			if (p == NULL) {
+				continue;
+			}
+			p ++;
+			while (*p == ' ' || *p == '\t') {
+				p ++;
+			}
+			p[strcspn(p, "\n")] = 0;
+			snprintf(dst, len, "%s", p);
+			best = i;
+			break;
+		}
+	}
+	fclose(f);
+}
+
+int
+cyc_trace_open(cyc_sink *sink, const char *path)
+{
+	trace_writer *w = calloc(1, sizeof *w);
+	if (w == NULL) {
+		return -1;
+	}
+	w->buf = malloc(TRACE_BUF_LEN);
+	if (w->buf == NULL) {
+		free(w);
+		return -1;
+	}
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (w->fd < 0) {
+		free(w->buf);
+		free(w);
+		return -1;
+	}
+	char cpu[128];
+	cyc_cpu_model(cpu, sizeof cpu);
+	memcpy(w->buf, CYC_TRACE_MAGIC, 8);
+	cyc_put_u32le(w->buf + 8, CYC_TRACE_VERSION);
+	w->len = 12;
+	tw_put_string(w, CORE_CYCLES_BACKEND);
+	tw_put_string(w, cpu);
+	w->len += cyc_put_varint(w->buf + w->len, (uint64_t)getpid());
+	tw_emit_calib(w);
+	sink->write = &trace_write;
+	sink->flush = &trace_flush;
+	sink->ctx = w;
+	return 0;
+}
+
+int
+cyc_trace_close(cyc_sink *sink)
+{
+	trace_writer *w = sink->ctx;
+	tw_emit_sites(w);
+	size_t nt = cyc_thread_count();
+	for (size_t i = 0; i < nt; i ++) {
+		const cyc_thread *t = cyc_thread_get(i);
+		if (tw_reserve(w, 5 + 2 * CYC_VARINT_MAX) < 0) {
+			break;
+		}
+		size_t off = tw_chunk_begin(w, CYC_CHUNK_DROPS);
+		w->len += cyc_put_varint(w->buf + w->len, t->index);
+		w->len += cyc_put_varint(w->buf + w->len,
+			__atomic_load_n(&t->dropped, __ATOMIC_RELAXED));
+		tw_chunk_end(w, off);
+	}
+	tw_emit_calib(w);
+	tw_write_out(w);
+	int err = w->err;
+	if (close(w->fd) < 0) {
+		err = 1;
+	}
+	free(w->buf);
+	free(w);
+	sink->ctx = NULL;
+	return err ? -1 : 0;
+}
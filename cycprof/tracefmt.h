@@ -0,0 +1,146 @@
+/*
+ * cycprof binary trace format. This header is shared by the writer
+ * (trace.c) and the decoder tool (cyctrace.c).
+ *
+ * All fixed-size integers are little-endian. "varint" is the usual
+ * unsigned LEB128 encoding (7 bits per byte, low bits first, top bit
+ * set on all bytes but the last); "svarint" is a signed value encoded
+ * as a varint after zigzag mapping (0, -1, 1, -2... -> 0, 1, 2, 3...).
+ * A "string" is a varint length followed by that many bytes (no
+ * terminating zero).
+ *
+ * File header:
+ *    magic     8 bytes, "CYCTRACE"
+ *    version   u32 (CYC_TRACE_VERSION)
+ *    backend   string (CORE_CYCLES_BACKEND of the writer)
+ *    cpu       string (CPU model, as reported by the OS; may be empty)
+ *    pid       varint
+ *
+ * Then follows a sequence of chunks, until the end of file. Each chunk
+ * is a one-byte type, a u32 payload length, then the payload. Unknown
+ * chunk types must be skipped by readers. The file is append-only: a
+ * truncated last chunk (e.g. after a crash) can be ignored.
+ *
+ * CYC_CHUNK_SITES: site definitions
+ *    count     varint
+ *    then 'count' times:
+ *       id     varint
+ *       name   string
+ *       file   string
+ *       line   varint
+ *
+ * CYC_CHUNK_EVENTS: events from a single thread
+ *    thread    varint (thread slot index)
+ *    tid       varint (OS thread identifier)
+ *    count     varint
+ *    then 'count' times:
+ *       site   varint
+ *       cpu    varint (CPU number plus 1; 0 if unknown)
+ *       start  svarint (start minus start of previous event in chunk;
+ *              the first event is relative to zero)
+ *       len    varint (end minus start)
+ *
+ * CYC_CHUNK_DROPS: dropped events (written at close)
+ *    thread    varint (thread slot index)
+ *    dropped   varint (total over the lifetime of the thread)
+ *
+ * CYC_CHUNK_CALIB: calibration points (written at open and at close)
+ *    count     varint
+ *    then 'count' times:
+ *       cpu    varint
+ *       cycles varint (core_cycles() value on that CPU)
+ *       ns     varint (CLOCK_MONOTONIC time, in nanoseconds)
+ *    For a given CPU, two calibration points yield the counter frequency
+ *    and offset on that CPU.
+ */
+
+#ifndef CYCPROF_TRACEFMT_H__
+#define CYCPROF_TRACEFMT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CYC_TRACE_MAGIC     "CYCTRACE"
+#define CYC_TRACE_VERSION   2
+
+#define CYC_CHUNK_SITES     1
+#define CYC_CHUNK_EVENTS    2
+#define CYC_CHUNK_DROPS     3
+#define CYC_CHUNK_CALIB     4
+
+/* Maximum encoded length of a varint (64-bit value). */
+#define CYC_VARINT_MAX      10
+
+static inline size_t
+cyc_put_varint(unsigned char *buf, uint64_t x)
+{
+	size_t n = 0;
+	while (x >= 0x80) {
+		buf[n ++] = (unsigned char)(x | 0x80);
+		x >>= 7;
+	}
+	buf[n ++] = (unsigned char)x;
+	return n;
+}
+
+static inline size_t
+cyc_put_svarint(unsigned char *buf, int64_t x)
+{
+	return cyc_put_varint(buf,
+		((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+}
+
+/*
+ * Decode a varint from buf[*off..len-1]. On success, *off is updated
+ * and 0 is returned; -1 is returned on truncated or overlong input.
+ */
+static inline int
+cyc_get_varint(const unsigned char *buf, size_t len, size_t *off, uint64_t *x)
+{
+	uint64_t r = 0;
+	size_t u = *off;
+	for (int sh = 0; sh < 64; sh += 7) {
+		if (u >= len) {
+			return -1;
+		}
+		unsigned b = buf[u ++];
+		r |= (uint64_t)(b & 0x7F) << sh;
+		if (b < 0x80) {
+			*off = u;
+			*x = r;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static inline int
+cyc_get_svarint(const unsigned char *buf, size_t len, size_t *off, int64_t *x)
+{
+	uint64_t z;
+	if (cyc_get_varint(buf, len, off, &z) < 0) {
+		return -1;
+	}
+	*x = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+	return 0;
+}
+
+static inline void
+cyc_put_u32le(unsigned char *buf, uint32_t x)
+{
+	buf[0] = (unsigned char)x;
+	buf[1] = (unsigned char)(x >> 8);
+	buf[2] = (unsigned char)(x >> 16);
+	buf[3] = (unsigned char)(x >> 24);
+}
+
+static inline uint32_t
+cyc_get_u32le(const unsigned char *buf)
+{
+	return (uint32_t)buf[0]
+		| ((uint32_t)buf[1] << 8)
+		| ((uint32_t)buf[2] << 16)
+		| ((uint32_t)buf[3] << 24);
+}
+
+#endif
@@ -4,86 +4,23 @@
  * three cases some superuser-level operations must first be done to allow
  * access to the counter.
  *
- * The core_cycles() function returns the current value of the cycle
- * counter. The test program uses core_cycles() to perform a measurement
- * of the cost (latency) of integer multiplications; a base integer
- * value should be provided as starting point, then the program
- * multiplies it with itself repeatedly. The starting point is obtained
- * as a program argument to prevent the compiler from optimizing it.
- * Relevant argument values are 0, 1 and 3; 0 and 1 exercise "special cases"
- * (i.e. values for which a variable-time multiplier is likely to return
- * "early") while 3 will use more-or-less pseudorandom values and should thus
- * exercise the "general case".
+ * The core_cycles() function (from core_cycles.h) returns the current
+ * value of the cycle counter. The test program uses core_cycles() to
+ * perform a measurement of the cost (latency) of integer multiplications;
+ * a base integer value should be provided as starting point, then the
+ * program multiplies it with itself repeatedly. The starting point is
+ * obtained as a program argument to prevent the compiler from optimizing
+ * it. Relevant argument values are 0, 1 and 3; 0 and 1 exercise "special
+ * cases" (i.e. values for which a variable-time multiplier is likely to
+ * return "early") while 3 will use more-or-less pseudorandom values and
+ * should thus exercise the "general case".
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 
-#if defined __x86_64__ || defined _M_X64 || defined __i386__ || defined _M_IX86
-/*
- * x86: the cycle counter is accessible with the rdpmc instruction. Access
- * must first be allowed, which, on Linux, is done with:
- *   echo 2 > /sys/bus/event_source/devices/cpu/rdpmc
- * (only root can perform this write; the setting is "volatile" in that
- * it lasts only until next reboot).
- */
-#include <immintrin.h>
-#ifdef _MSC_VER
-/* On Windows, the intrinsic is called __readpmc(), not __rdpmc(). But it
-   will usually imply a crash, since Windows does no enable access to the
-   performance counters. */
-#ifndef __rdpmc
-#define __rdpmc   __readpmc
-#endif
-#else
-#include <x86intrin.h>
-#endif
-#if defined __GNUC__ || defined __clang__
-__attribute__((target("sse2")))
-#endif
-static inline uint64_t
-core_cycles(void)
-{
-	_mm_lfence();
-	return __rdpmc(0x40000001);
-}
-
-#elif defined __aarch64__ && (defined __GNUC__ || defined __clang__)
-/*
- * ARMv8, 64-bit (aarch64): the cycle counter is pmccntr_el0; it must be
- * enabled through dedicated kernel code.
- */
-static inline uint64_t
-core_cycles(void)
-{
-	uint64_t x;
-	__asm__ __volatile__ ("dsb sy\n\tmrs %0, pmccntr_el0" : "=r" (x) : : );
-	return x;
-}
-
-#elif defined __riscv && defined __riscv_xlen && __riscv_xlen >= 64
-/*
- * RISC-V, 64-bit (rv64gc): the cycle counter is read with the
- * pseudo-instruction rdcycle (which is just an alias for csrrs with
- * the appropriate register identifier). The cycle counter must be enabled
- * and its userland access allowed, which requires machine-level actions
- * that can be triggered from dedicated kernel code.
- */
-static inline uint64_t
-core_cycles(void)
-{
-	/* We don't use a memory fence here because the RISC-V ISA
-	   already requires the CPU to enforce appropriate ordering for
-	   this access. */
-	uint64_t x;
-	__asm__ __volatile__ ("rdcycle %0" : "=r" (x));
-	return x;
-}
-
-#else
-#error Architecture is not supported.
-#endif
+#include "core_cycles.h"
 
 static int
 cmp_u64(const void *v1, const void *v2)
@@ -110,6 +47,13 @@ main(int argc, char *argv[])
 
 	uint64_t tt[100];
 
+	/* Results are printed only once all measurements are done, so
+	   that stdio does not disturb the caches between them. */
+	double m32, m64;
+#if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
+	double m128;
+#endif
+
 	/* 32-bit multiplications. */
 	uint32_t x32 = (uint32_t)st;
 	uint32_t y32 = x32;
@@ -147,7 +91,7 @@ main(int argc, char *argv[])
 		}
 	}
 	qsort(tt, 100, sizeof(uint64_t), &cmp_u64);
-	printf("32x32->32 muls:  %7.3f\n", (double)tt[50] / 20000.0);
+	m32 = (double)tt[50] / 20000.0;
 
 	/* 64-bit multiplications. */
 	uint64_t x64 = (uint64_t)x32;
@@ -183,7 +127,7 @@ main(int argc, char *argv[])
 		}
 	}
 	qsort(tt, 100, sizeof(uint64_t), &cmp_u64);
-	printf("64x64->64 muls:  %7.3f\n", (double)tt[50] / 20000.0);
+	m64 = (double)tt[50] / 20000.0;
 
 #if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
 	/* 64x64->128 multiplications.
@@ -216,7 +160,13 @@ main(int argc, char *argv[])
 		}
 	}
 	qsort(tt, 100, sizeof(uint64_t), &cmp_u64);
-	printf("64x64->128 muls: %7.3f\n", (double)tt[50] / 8000.0);
+	m128 = (double)tt[50] / 8000.0;
+#endif
+
+	printf("32x32->32 muls:  %7.3f\n", m32);
+	printf("64x64->64 muls:  %7.3f\n", m64);
+#if (defined __GNUC__ || defined __clang) && defined __SIZEOF_INT128__
+	printf("64x64->128 muls: %7.3f\n", m128);
 #endif
 
 	/* Get some bytes from the final value and print them out; this